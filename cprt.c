@@ -25,11 +25,26 @@
 #include <time.h>
 #include <errno.h>
 
+#if ! defined(_WIN32)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(CPRT_HAVE_TSC) && defined(__GNUC__)
+#include <cpuid.h>
+#endif
+
 #if defined(_WIN32)
 LARGE_INTEGER cprt_frequency;
 LARGE_INTEGER cprt_start_time;
 #endif
 
+int cprt_inittime_done = 0;
+int cprt_tsc_in_use = 0;
+uint64_t cprt_ticks_per_sec = 1000000000;
+uint64_t cprt_ns_per_tick_fx = (uint64_t)1 << 32;  /* 32.32 fixed point. */
+
 
 #if defined(_WIN32)
 int cprt_timeofday(struct cprt_timeval *tv, void *unused_tz)
@@ -53,11 +68,11 @@ int cprt_timeofday(struct cprt_timeval *tv, void *unused_tz)
 }  /* cprt_timeofday */
 
 
-void cprt_inittime()
+void cprt_inittime_os()
 {
   QueryPerformanceFrequency(&cprt_frequency);
   QueryPerformanceCounter(&cprt_start_time);
-}  /* cprt_inittime */
+}  /* cprt_inittime_os */
 
 
 void cprt_gettime(struct cprt_timespec *ts)
@@ -75,18 +90,272 @@ void cprt_gettime(struct cprt_timespec *ts)
 
 
 #elif defined(__APPLE__)
-void cprt_inittime()
+void cprt_inittime_os()
 {
-}  /* cprt_inittime */
+}  /* cprt_inittime_os */
 
 
 #else  /* Non-Apple Unixes */
+void cprt_inittime_os()
+{
+}  /* cprt_inittime_os */
+
+
+#endif
+
+
+/* Return 1 if the CPU says its TSC runs at a constant rate in all
+ * power states (CPUID 0x80000007, EDX bit 8). */
+int cprt_tsc_invariant()
+{
+#if defined(CPRT_HAVE_TSC) && defined(__GNUC__)
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+    return 0;
+  }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return ((edx & (1 << 8)) != 0);
+
+#elif defined(CPRT_HAVE_TSC)  /* Windows */
+  int regs[4];
+
+  __cpuid(regs, 0x80000000);
+  if ((unsigned int)regs[0] < 0x80000007) {
+    return 0;
+  }
+  __cpuid(regs, 0x80000007);
+  return ((regs[3] & (1 << 8)) != 0);
+
+#else
+  return 0;
+#endif
+}  /* cprt_tsc_invariant */
+
+
+#if defined(CPRT_HAVE_TSC)
+/* Read the TSC and CPRT_GETTIME as close together as possible. */
+void cprt_tsc_sample(uint64_t *tsc, uint64_t *ns)
+{
+  struct cprt_timespec ts;
+  uint64_t tsc_before, tsc_after;
+
+  tsc_before = CPRT_RDTSC();
+  CPRT_GETTIME(&ts);
+  tsc_after = CPRT_RDTSC();
+
+  *tsc = tsc_before + (tsc_after - tsc_before) / 2;
+  *ns = CPRT_TS_TO_NS(ts);
+}  /* cprt_tsc_sample */
+#endif
+
+
+/* Initialize the time functions. Safe to call more than once. */
 void cprt_inittime()
 {
+  if (cprt_inittime_done) {
+    return;
+  }
+  cprt_inittime_done = 1;
+
+  cprt_inittime_os();
+
+#if defined(CPRT_HAVE_TSC)
+  if (cprt_tsc_invariant() && getenv("CPRT_NO_TSC") == NULL) {
+    uint64_t tsc_start, tsc_end, ns_start, ns_end;
+    uint64_t ticks_per_sec;
+
+    /* Calibrate the TSC against the OS clock over 10 ms. */
+    cprt_tsc_sample(&tsc_start, &ns_start);
+    CPRT_SLEEP_MS(10);
+    cprt_tsc_sample(&tsc_end, &ns_end);
+    ticks_per_sec = ((tsc_end - tsc_start) * 1000000000) / (ns_end - ns_start);
+
+    /* cprt_ticks_to_ns() needs at least 1 tick per ns. */
+    if (ticks_per_sec >= 1000000000) {
+      cprt_ticks_per_sec = ticks_per_sec;
+      cprt_ns_per_tick_fx = (1000000000ull << 32) / ticks_per_sec;
+      cprt_tsc_in_use = 1;
+    }
+  }
+#endif
 }  /* cprt_inittime */
 
 
+/* Uses 32.32 fixed point so there is no division. Valid over the full
+ * 64-bit tick range since there is at least 1 tick per ns. */
+uint64_t cprt_ticks_to_ns(uint64_t ticks)
+{
+  return (ticks >> 32) * cprt_ns_per_tick_fx
+      + (((ticks & 0xffffffff) * cprt_ns_per_tick_fx) >> 32);
+}  /* cprt_ticks_to_ns */
+
+
+uint64_t cprt_ns_to_ticks(uint64_t ns)
+{
+  return (ns / 1000000000) * cprt_ticks_per_sec
+      + ((ns % 1000000000) * cprt_ticks_per_sec) / 1000000000;
+}  /* cprt_ns_to_ticks */
+
+
+/* Sleep until the CPRT_GETTIME clock reaches "wake_ts". The OS may
+ * oversleep by its timer slack (tens of microseconds on Linux). */
+void cprt_sleep_until(struct cprt_timespec *wake_ts)
+{
+#if defined(_WIN32)
+  struct cprt_timespec cur_ts;
+  uint64_t diff_ns;
+
+  cprt_gettime(&cur_ts);
+  if (cur_ts.tv_sec > wake_ts->tv_sec ||
+      (cur_ts.tv_sec == wake_ts->tv_sec && cur_ts.tv_nsec >= wake_ts->tv_nsec)) {
+    return;
+  }
+  CPRT_DIFF_TS(diff_ns, (*wake_ts), cur_ts);
+  Sleep((DWORD)(diff_ns / 1000000));
+
+#elif defined(__APPLE__)
+  struct cprt_timespec cur_ts;
+  struct timespec rel_ts;
+  uint64_t diff_ns;
+
+  CPRT_GETTIME(&cur_ts);
+  if (cur_ts.tv_sec > wake_ts->tv_sec ||
+      (cur_ts.tv_sec == wake_ts->tv_sec && cur_ts.tv_nsec >= wake_ts->tv_nsec)) {
+    return;
+  }
+  CPRT_DIFF_TS(diff_ns, (*wake_ts), cur_ts);
+  rel_ts.tv_sec = (time_t)(diff_ns / 1000000000);
+  rel_ts.tv_nsec = (long)(diff_ns % 1000000000);
+  while (nanosleep(&rel_ts, &rel_ts) == -1 && errno == EINTR) {
+  }
+
+#else  /* Non-Apple Unixes */
+  while ((errno = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, wake_ts, NULL)) == EINTR) {
+  }
+#endif
+}  /* cprt_sleep_until */
+
+
+/* Wall clock (CLOCK_REALTIME) in nanoseconds since the Unix epoch. */
+uint64_t cprt_realtime_ns()
+{
+#if defined(_WIN32)
+  FILETIME ft;
+  ULARGE_INTEGER t;
+
+  GetSystemTimePreciseAsFileTime(&ft);
+  t.LowPart = ft.dwLowDateTime;
+  t.HighPart = ft.dwHighDateTime;
+  /* FILETIME is 100 ns units since 1601. */
+  return (t.QuadPart - 116444736000000000ull) * 100;
+
+#else  /* Unixes */
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return CPRT_TS_TO_NS(ts);
+#endif
+}  /* cprt_realtime_ns */
+
+
+/* Map "size" bytes of the named shared memory segment ("/name"),
+ * creating it (zero-filled) if it doesn't exist. */
+void *cprt_shm_map(char *name, size_t size)
+{
+  void *ptr;
+#if defined(_WIN32)
+  HANDLE map_handle;
+
+  /* The handle is left open; the mapping goes away with the process. */
+  map_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      0, (DWORD)size, name);
+  if (map_handle == NULL) {
+    errno = GetLastError();
+    CPRT_PERRNO("CreateFileMapping");
+    CPRT_ERR_EXIT;
+  }
+  ptr = MapViewOfFile(map_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (ptr == NULL) {
+    errno = GetLastError();
+    CPRT_PERRNO("MapViewOfFile");
+    CPRT_ERR_EXIT;
+  }
+
+#else  /* Unixes */
+  int fd;
+
+  fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+  if (fd == -1) {
+    CPRT_PERRNO("shm_open");
+    CPRT_ERR_EXIT;
+  }
+  if (ftruncate(fd, size) == -1) {
+    CPRT_PERRNO("ftruncate");
+    CPRT_ERR_EXIT;
+  }
+  ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    CPRT_PERRNO("mmap");
+    CPRT_ERR_EXIT;
+  }
+  close(fd);
+#endif
+
+  return ptr;
+}  /* cprt_shm_map */
+
+
+void cprt_shm_unmap(void *ptr, size_t size)
+{
+#if defined(_WIN32)
+  UnmapViewOfFile(ptr);
+#else  /* Unixes */
+  munmap(ptr, size);
+#endif
+}  /* cprt_shm_unmap */
+
+
+/* Remove the name; processes that already have it mapped keep their
+ * mapping, and the next cprt_shm_map() of the name gets a new segment. */
+void cprt_shm_unlink(char *name)
+{
+#if defined(_WIN32)
+  /* Named mappings disappear when the last handle is closed. */
+#else  /* Unixes */
+  (void)shm_unlink(name);
+#endif
+}  /* cprt_shm_unlink */
+
+
+long cprt_getpid()
+{
+#if defined(_WIN32)
+  return (long)GetCurrentProcessId();
+#else  /* Unixes */
+  return (long)getpid();
+#endif
+}  /* cprt_getpid */
+
+
+/* False only if the process is known to be gone. */
+int cprt_pid_alive(long pid)
+{
+#if defined(_WIN32)
+  HANDLE proc_handle;
+  DWORD status;
+
+  proc_handle = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+  if (proc_handle == NULL) {
+    return (GetLastError() != ERROR_INVALID_PARAMETER);
+  }
+  status = WaitForSingleObject(proc_handle, 0);
+  CloseHandle(proc_handle);
+  return (status != WAIT_OBJECT_0);
+#else  /* Unixes */
+  return (kill((pid_t)pid, 0) == 0 || errno != ESRCH);
 #endif
+}  /* cprt_pid_alive */
 
 
 void cprt_localtime_r(time_t *timep, struct tm *result)
@@ -89,9 +89,11 @@ extern "C" {
 #if defined(_WIN32)
   #define CPRT_ATOMIC_INC_VAL(_p) InterlockedIncrement(_p)
   #define CPRT_ATOMIC_DEC_VAL(_p) InterlockedDecrement(_p)
+  #define CPRT_ATOMIC_CAS(_p, _old, _new) (InterlockedCompareExchange(_p, _new, _old) == (_old))
 #else  /* Unix */
   #define CPRT_ATOMIC_INC_VAL(_p) __sync_add_and_fetch(_p, 1)
   #define CPRT_ATOMIC_DEC_VAL(_p) __sync_sub_and_fetch(_p, 1)
+  #define CPRT_ATOMIC_CAS(_p, _old, _new) __sync_bool_compare_and_swap(_p, _old, _new)
 #endif
 
 /* Macro to approximate the basename() function. */
@@ -483,11 +485,59 @@ extern "C" {
                          - (uint64_t)diff_ts_start_ts_.tv_nsec; \
 } while (0)  /* DIFF_TS */
 
+/* Fast "tick" clock for timing loops. If the CPU has an invariant time
+ * stamp counter, ticks are read with rdtsc and calibrated against
+ * CPRT_GETTIME by cprt_inittime(). Otherwise (or if the environment
+ * variable CPRT_NO_TSC is set), ticks are CPRT_GETTIME nanoseconds.
+ * cprt_inittime() must be called before using ticks. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <x86intrin.h>
+  #define CPRT_HAVE_TSC 1
+  #define CPRT_RDTSC() __rdtsc()
+#elif defined(_WIN32) && (defined(_M_X64) || defined(_M_IX86))
+  #include <intrin.h>
+  #define CPRT_HAVE_TSC 1
+  #define CPRT_RDTSC() __rdtsc()
+#endif
+
+#define CPRT_TS_TO_NS(ts_to_ns_ts_) \
+  ((uint64_t)(ts_to_ns_ts_).tv_sec * 1000000000 + (uint64_t)(ts_to_ns_ts_).tv_nsec)
+
+#if defined(CPRT_HAVE_TSC)
+  #define CPRT_GETTICKS(getticks_result_) do { \
+    if (cprt_tsc_in_use) { \
+      (getticks_result_) = CPRT_RDTSC(); \
+    } else { \
+      struct cprt_timespec getticks_ts_; \
+      CPRT_GETTIME(&getticks_ts_); \
+      (getticks_result_) = CPRT_TS_TO_NS(getticks_ts_); \
+    } \
+  } while (0)
+#else
+  #define CPRT_GETTICKS(getticks_result_) do { \
+    struct cprt_timespec getticks_ts_; \
+    CPRT_GETTIME(&getticks_ts_); \
+    (getticks_result_) = CPRT_TS_TO_NS(getticks_ts_); \
+  } while (0)
+#endif
+
 /* externals in cprt.c. */
 char *cprt_strerror(int errnum, char *buffer, size_t buf_sz);
 void cprt_set_affinity(uint64_t in_mask);
 int cprt_try_affinity(uint64_t in_mask);
 void cprt_inittime();
+void cprt_sleep_until(struct cprt_timespec *wake_ts);
+uint64_t cprt_realtime_ns();
+void *cprt_shm_map(char *name, size_t size);
+void cprt_shm_unmap(void *ptr, size_t size);
+void cprt_shm_unlink(char *name);
+long cprt_getpid();
+int cprt_pid_alive(long pid);
+uint64_t cprt_ticks_to_ns(uint64_t ticks);
+uint64_t cprt_ns_to_ticks(uint64_t ns);
+
+extern int cprt_tsc_in_use;  /* 1 if ticks come from the TSC. */
+extern uint64_t cprt_ticks_per_sec;
 void cprt_localtime_r(time_t *timep, struct tm *result);
 
 #if defined(_WIN32)
@@ -12,572 +12,3899 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
+#include <math.h>
 #include "cprt.h"  /* See https://github.com/fordsfords/cprt */
 #include "tgen.h"
+#if ! defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 
-/* Return multiplication factor. */
-int tgen_convert_byte_multiplier(char *in_str)
-{
-  if (strcmp(in_str, "bytes") == 0) return 1;
-  if (strcmp(in_str, "kbytes") == 0) return 1000;
-  if (strcmp(in_str, "mbytes") == 0) return 1000000;
-
-  fprintf(stderr, "Error: invalid byte multiplier '%s'\n", in_str);
-  CPRT_ERR_EXIT;
-}  /* tgen_convert_byte_multiplier */
+/*
+ * Script parsing.
+ *
+ * A script is parsed in a single pass, a token at a time, without
+ * copying it. The statement's keyword is looked up with a switch on its
+ * first character, and that instruction's parser reads the fields it
+ * expects. Errors are reported with the line and column, and the parse
+ * functions return -1 instead of exiting; tgen_add_step() and
+ * tgen_add_multi_steps() return the number of errors to the caller.
+ */
 
 
-/* Return multiplication factor. */
-int tgen_convert_rate_multiplier(char *in_str)
+/* Scanner over script text. Tokens point into the text. */
+struct tgen_lex_s {
+  char *cur;  /* Next character to scan. */
+  char *end;  /* End of the text (need not be NUL-terminated). */
+  char *line;  /* Start of the current line. */
+  char *tok;  /* Most recent token. */
+  int tok_len;
+  int line_num;
+  char *filename;  /* NULL if the text isn't from a file. */
+  int depth;  /* Of includes. */
+  int errors;
+};
+typedef struct tgen_lex_s tgen_lex_t;
+
+/* A word a field may contain, and what it stands for. */
+struct tgen_keyword_s {
+  char *name;
+  uint64_t value;
+};
+typedef struct tgen_keyword_s tgen_keyword_t;
+
+/* For thread blocks and includes. */
+int tgen_parse_add(tgen_t *tgen, tgen_lex_t *lex);
+int tgen_parse_file(tgen_t *tgen, char *filename, int depth);
+void tgen_run_prepare(tgen_t *tgen);
+
+static tgen_keyword_t tgen_byte_units[] = {
+  {"bytes", 1}, {"kbytes", 1000}, {"mbytes", 1000000}, {NULL, 0}
+};
+static tgen_keyword_t tgen_rate_units[] = {
+  {"persec", 1}, {"kpersec", 1000}, {"mpersec", 1000000}, {NULL, 0}
+};
+static tgen_keyword_t tgen_duration_units[] = {  /* To usec. */
+  {"usec", 1}, {"msec", 1000}, {"sec", 1000000}, {"min", 60000000},
+  {"hour", 3600000000ull}, {NULL, 0}
+};
+static tgen_keyword_t tgen_msgs_units[] = {
+  {"msgs", 1}, {"kmsgs", 1000}, {"mmsgs", 1000000}, {NULL, 0}
+};
+static tgen_keyword_t tgen_catchup_policies[] = {
+  {"burst", TGEN_CATCHUP_BURST}, {"skip", TGEN_CATCHUP_SKIP},
+  {"token", TGEN_CATCHUP_TOKEN}, {NULL, 0}
+};
+static tgen_keyword_t tgen_arrival_dists[] = {
+  {"even", TGEN_ARRIVAL_EVEN}, {"poisson", TGEN_ARRIVAL_POISSON},
+  {"uniform", TGEN_ARRIVAL_UNIFORM}, {"pareto", TGEN_ARRIVAL_PARETO}, {NULL, 0}
+};
+static tgen_keyword_t tgen_report_formats[] = {
+  {"csv", TGEN_REPORT_CSV}, {"json", TGEN_REPORT_JSON}, {NULL, 0}
+};
+
+/* True if the current token is the literal "str_". */
+#define TGEN_LEX_IS(lex_, str_) ((lex_)->tok_len == (int)sizeof(str_) - 1 \
+    && memcmp((lex_)->tok, (str_), sizeof(str_) - 1) == 0)
+
+#define TGEN_LEX_SPACE(c_) ((c_) == ' ' || (c_) == '\t' || (c_) == '\r' \
+    || (c_) == '\f' || (c_) == '\v')
+
+
+void tgen_lex_init(tgen_lex_t *lex, char *text, char *end, int line_num)
 {
-  if (strcmp(in_str, "persec") == 0) return 1;
-  if (strcmp(in_str, "kpersec") == 0) return 1000;
-  if (strcmp(in_str, "mpersec") == 0) return 1000000;
+  lex->cur = text;
+  lex->end = end;
+  lex->line = text;
+  lex->tok = text;
+  lex->tok_len = 0;
+  lex->line_num = line_num;
+  lex->filename = NULL;
+  lex->depth = 0;
+  lex->errors = 0;
+}  /* tgen_lex_init */
+
+
+/* Print "fmt" followed by the line and column of "at", then the line
+ * with a caret under that column. Returns -1 for the caller to return. */
+/* Where "at" is: the line and column, the line, and a caret under it.
+ * Returned string is malloced. */
+char *tgen_lex_where(tgen_lex_t *lex, char *at)
+{
+  char *eol = lex->line;
+  char *where;
+  char *w;
+  char *p;
+  size_t len;
+
+  while (eol < lex->end && *eol != '\n' && *eol != '\0') {
+    eol++;
+  }
+  len = 64 + ((lex->filename != NULL) ? strlen(lex->filename) : 0) + 2 * (size_t)(eol - lex->line);
+  CPRT_ENULL(where = (char *)malloc(len));
+  w = where + sprintf(where, " (%s%sline %d, col %d)\n  %.*s\n  ",
+      (lex->filename != NULL) ? lex->filename : "", (lex->filename != NULL) ? " " : "",
+      lex->line_num, (int)(at - lex->line) + 1, (int)(eol - lex->line), lex->line);
+  for (p = lex->line; p < at; p++) {
+    *w++ = (*p == '\t') ? '\t' : ' ';
+  }
+  strcpy(w, "^\n");
 
-  fprintf(stderr, "Error: invalid rate multiplier '%s'\n", in_str);
-  CPRT_ERR_EXIT;
-}  /* tgen_convert_rate_multiplier */
+  return where;
+}  /* tgen_lex_where */
 
 
-/* Return multiplication factor to give usec. */
-int tgen_convert_duration_multiplier(char *in_str)
+int tgen_parse_error(tgen_lex_t *lex, char *at, char *fmt, ...)
 {
-  if (strcmp(in_str, "usec") == 0) return 1;
-  if (strcmp(in_str, "msec") == 0) return 1000;
-  if (strcmp(in_str, "sec") == 0) return 1000000;
+  va_list args;
+  char *where;
+
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  where = tgen_lex_where(lex, at);
+  fputs(where, stderr);
+  free(where);
 
-  fprintf(stderr, "Error: invalid duration multiplier '%s'\n", in_str);
-  CPRT_ERR_EXIT;
-}  /* tgen_convert_duration_multiplier */
+  return -1;
+}  /* tgen_parse_error */
 
 
-/* Return multiplication factor to give num msgs. */
-int tgen_convert_msgs_multiplier(char *in_str)
+void tgen_lex_space(tgen_lex_t *lex)
 {
-  if (strcmp(in_str, "msgs") == 0) return 1;
-  if (strcmp(in_str, "kmsgs") == 0) return 1000;
-  if (strcmp(in_str, "mmsgs") == 0) return 1000000;
-
-  fprintf(stderr, "Error: invalid msgs multiplier '%s'\n", in_str);
-  CPRT_ERR_EXIT;
-}  /* tgen_convert_msgs_multiplier */
+  while (lex->cur < lex->end && TGEN_LEX_SPACE(*lex->cur)) {
+    lex->cur++;
+  }
+}  /* tgen_lex_space */
 
 
-/* Return variable index 0-25 (a-z). */
-int tgen_convert_variable(char *in_str)
+/* Skip spaces and a comment. True if that's the end of the statement. */
+int tgen_lex_at_end(tgen_lex_t *lex)
 {
-  if (strlen(in_str) != 1 || in_str[0] < 'a' || in_str[0] > 'z') {
-    fprintf(stderr, "Error: invalid variable variable_name '%s'\n", in_str);
-    CPRT_ERR_EXIT;
+  tgen_lex_space(lex);
+  if (lex->cur < lex->end && *lex->cur == '#') {
+    while (lex->cur < lex->end && *lex->cur != ';' && *lex->cur != '\n') {
+      lex->cur++;
+    }
   }
 
-  return (in_str[0] - 'a');
-}  /* tgen_convert_variable */
+  return (lex->cur == lex->end || *lex->cur == ';' || *lex->cur == '\n');
+}  /* tgen_lex_at_end */
 
 
-/*
- * The tgen_parse_*() functions return -1 for error,
- * 0 for success but no steps parsed (e.g. comment),
- * 1 for step parsed.
- */
+/* The rest of the statement must be empty (or a comment). */
+int tgen_lex_end(tgen_lex_t *lex)
+{
+  char *p;
 
+  if (tgen_lex_at_end(lex)) return 0;
 
-int tgen_parse_comment(char *iline, tgen_step_t *step)
+  for (p = lex->cur; p < lex->end && ! TGEN_LEX_SPACE(*p) && *p != ';' && *p != '\n'; p++) {
+  }
+  return tgen_parse_error(lex, lex->cur, "Error: unexpected '%.*s'", (int)(p - lex->cur), lex->cur);
+}  /* tgen_lex_end */
+
+
+/* Skip to the end of the statement and past its ';' or newline. */
+void tgen_lex_next_stmt(tgen_lex_t *lex)
 {
-  int null_ofs = 0;
+  while (lex->cur < lex->end && *lex->cur != ';' && *lex->cur != '\n') {
+    lex->cur++;
+  }
+  if (lex->cur < lex->end) {
+    if (*lex->cur == '\n') {
+      lex->line_num++;
+      lex->line = lex->cur + 1;
+    }
+    lex->cur++;
+  }
+}  /* tgen_lex_next_stmt */
 
-  (void)sscanf(iline, " %n", &null_ofs);
-  if (iline[null_ofs] == '\0' || iline[null_ofs] == '#') return 0;
 
-  return -1;
-}  /* tgen_parse_comment */
-
-
-int tgen_parse_sendt(char *iline, tgen_step_t *step)
-{
-  char byte_multiplier[TGEN_MAX_KEYWORD+1];
-  char rate_multiplier[TGEN_MAX_KEYWORD+1];
-  char duration_multiplier[TGEN_MAX_KEYWORD+1];
-  int null_ofs = 0;
-
-  (void)sscanf(iline, " sendt"
-      " %9u %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %9u %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %9u %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %n",
-      &step->len, byte_multiplier,
-      &step->rate, rate_multiplier,
-      &step->duration_usec, duration_multiplier,
-      &null_ofs);
-  if (iline[null_ofs] != '\0' && iline[null_ofs] != '#') {
-    return -1;
+/* Scan a word (letters, digits, '_'). Returns its length, 0 if none. */
+int tgen_lex_word(tgen_lex_t *lex)
+{
+  char *p;
+
+  tgen_lex_space(lex);
+  for (p = lex->cur; p < lex->end && (isalnum((unsigned char)*p) || *p == '_'); p++) {
   }
+  lex->tok = lex->cur;
+  lex->tok_len = (int)(p - lex->cur);
+  lex->cur = p;
 
-  step->len *= tgen_convert_byte_multiplier(byte_multiplier);
+  return lex->tok_len;
+}  /* tgen_lex_word */
 
-  step->rate *= tgen_convert_rate_multiplier(rate_multiplier);
 
-  step->duration_usec *= tgen_convert_duration_multiplier(duration_multiplier);
+/* Scan the character "c". Returns 1 if it's next, else 0. */
+int tgen_lex_char(tgen_lex_t *lex, char c)
+{
+  tgen_lex_space(lex);
+  if (lex->cur == lex->end || *lex->cur != c) return 0;
 
-  step->opcode = TGEN_OPCODE_SENDT;
+  lex->tok = lex->cur;
+  lex->tok_len = 1;
+  lex->cur++;
 
   return 1;
-}  /* tgen_parse_sendt */
+}  /* tgen_lex_char */
 
 
-int tgen_parse_sendc(char *iline, tgen_step_t *step)
+/* Scan the word "word" (e.g. "every" in burst). */
+int tgen_lex_expect(tgen_lex_t *lex, char *word)
 {
-  char byte_multiplier[TGEN_MAX_KEYWORD+1];
-  char rate_multiplier[TGEN_MAX_KEYWORD+1];
-  char msgs_multiplier[TGEN_MAX_KEYWORD+1];
-  int null_ofs = 0;
+  int len = (int)strlen(word);
 
-  (void)sscanf(iline, " sendc"
-      " %9u %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %9u %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %9u %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %n",
-      &step->len, byte_multiplier,
-      &step->rate, rate_multiplier,
-      &step->num_msgs, msgs_multiplier,
-      &null_ofs);
-  if (iline[null_ofs] != '\0' && iline[null_ofs] != '#') {
-    return -1;
+  tgen_lex_word(lex);
+  if (lex->tok_len != len || memcmp(lex->tok, word, len) != 0) {
+    return tgen_parse_error(lex, lex->tok, "Error: expected '%s'", word);
   }
 
-  step->len *= tgen_convert_byte_multiplier(byte_multiplier);
+  return 0;
+}  /* tgen_lex_expect */
+
 
-  step->rate *= tgen_convert_rate_multiplier(rate_multiplier);
+/* Scan a file name (anything up to a space) into "buf". */
+int tgen_lex_path(tgen_lex_t *lex, char *name, char *buf, int buf_size)
+{
+  char *p;
 
-  step->num_msgs *= tgen_convert_msgs_multiplier(msgs_multiplier);
+  tgen_lex_space(lex);
+  for (p = lex->cur; p < lex->end && ! TGEN_LEX_SPACE(*p) && *p != ';' && *p != '\n'; p++) {
+  }
+  lex->tok = lex->cur;
+  lex->tok_len = (int)(p - lex->cur);
+  lex->cur = p;
 
-  step->opcode = TGEN_OPCODE_SENDC;
+  if (lex->tok_len == 0) {
+    return tgen_parse_error(lex, lex->tok, "Error: expected %s", name);
+  }
+  if (lex->tok_len >= buf_size) {
+    return tgen_parse_error(lex, lex->tok, "Error: %s too long", name);
+  }
+  memcpy(buf, lex->tok, lex->tok_len);
+  buf[lex->tok_len] = '\0';
 
-  return 1;
-}  /* tgen_parse_sendc */
+  return 0;
+}  /* tgen_lex_path */
 
 
-int tgen_parse_set(char *iline, tgen_step_t *step)
+/* Scan an unsigned number, decimal or hex ("0x"). "name" is the field,
+ * for errors. */
+int tgen_lex_u64(tgen_lex_t *lex, char *name, uint64_t *value)
 {
-  char variable_name[TGEN_MAX_KEYWORD+1];
-  int null_ofs = 0;
+  uint64_t v = 0;
+  int base = 10;
+  int overflow = 0;
+  char *digits;
+  char *p;
+
+  tgen_lex_space(lex);
+  p = lex->cur;
+  if (lex->end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')
+      && isxdigit((unsigned char)p[2])) {
+    base = 16;
+    p += 2;
+  }
+  digits = p;
+  while (p < lex->end) {
+    int d;
+    if (*p >= '0' && *p <= '9') d = *p - '0';
+    else if (base == 16 && *p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+    else if (base == 16 && *p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+    else break;
+    if (v > ((uint64_t)-1 - d) / base) {
+      overflow = 1;
+    }
+    v = v * base + d;
+    p++;
+  }
+  lex->tok = lex->cur;
+  lex->tok_len = (int)(p - lex->cur);
+  lex->cur = p;
 
-  (void)sscanf(iline, " set"
-      " %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %9u"
-      " %n",
-      variable_name,
-      &step->value,
-      &null_ofs);
-  if (iline[null_ofs] != '\0' && iline[null_ofs] != '#') {
-    return -1;
+  if (p == digits) {
+    return tgen_parse_error(lex, lex->tok, "Error: expected %s", name);
   }
+  if (overflow) {
+    return tgen_parse_error(lex, lex->tok, "Error: %s too large", name);
+  }
+  *value = v;
 
-  step->variable_index = tgen_convert_variable(variable_name);
+  return 0;
+}  /* tgen_lex_u64 */
 
-  step->opcode = TGEN_OPCODE_SET;
 
-  return 1;
-}  /* tgen_parse_set */
+/* An unsigned number that fits an int. */
+int tgen_lex_int(tgen_lex_t *lex, char *name, int *value)
+{
+  uint64_t v;
+
+  if (tgen_lex_u64(lex, name, &v) < 0) return -1;
+  if (v > 0x7fffffff) {
+    return tgen_parse_error(lex, lex->tok, "Error: %s too large", name);
+  }
+  *value = (int)v;
+
+  return 0;
+}  /* tgen_lex_int */
 
 
-int tgen_parse_loop(char *iline, tgen_step_t *step)
+/* Scan a word that must be one of "keywords"; "kind" is what they are
+ * (e.g. "byte multiplier"), for errors. */
+int tgen_lex_keyword(tgen_lex_t *lex, tgen_keyword_t *keywords, char *kind, uint64_t *value)
 {
-  char label_name[TGEN_MAX_KEYWORD+1];
-  char variable_name[TGEN_MAX_KEYWORD+1];
-  int null_ofs = 0;
+  int i;
 
-  (void)sscanf(iline, " loop"
-      " %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %n",
-      label_name,
-      variable_name,
-      &null_ofs);
-  if (iline[null_ofs] != '\0' && iline[null_ofs] != '#') {
-    return -1;
+  if (tgen_lex_word(lex) == 0) {
+    return tgen_parse_error(lex, lex->tok, "Error: expected %s", kind);
+  }
+  for (i = 0; keywords[i].name != NULL; i++) {
+    if ((int)strlen(keywords[i].name) == lex->tok_len
+        && memcmp(keywords[i].name, lex->tok, lex->tok_len) == 0) {
+      *value = keywords[i].value;
+      return 0;
+    }
   }
 
-  step->label_index = tgen_convert_variable(label_name);
-  step->variable_index = tgen_convert_variable(variable_name);
+  return tgen_parse_error(lex, lex->tok, "Error: invalid %s '%.*s'", kind, lex->tok_len, lex->tok);
+}  /* tgen_lex_keyword */
 
-  step->opcode = TGEN_OPCODE_LOOP;
 
-  return 1;
-}  /* tgen_parse_loop */
+/* A number and its multiplier, e.g. "50 kpersec". Errors if the product
+ * doesn't fit. */
+int tgen_lex_quantity(tgen_lex_t *lex, char *name, tgen_keyword_t *units, char *kind, uint64_t *value)
+{
+  uint64_t num;
+  uint64_t multiplier;
+  char *at;
+
+  if (tgen_lex_u64(lex, name, &num) < 0) return -1;
+  at = lex->tok;
+  if (tgen_lex_keyword(lex, units, kind, &multiplier) < 0) return -1;
+  if (multiplier != 0 && num > (uint64_t)-1 / multiplier) {
+    return tgen_parse_error(lex, at, "Error: %s too large", name);
+  }
+  *value = num * multiplier;
+
+  return 0;
+}  /* tgen_lex_quantity */
 
 
-int tgen_parse_label(tgen_t *tgen, char *iline, tgen_step_t *step)
+/* Message length, which must fit my_send()'s int. */
+int tgen_lex_len(tgen_lex_t *lex, int *len)
 {
-  char variable_name[TGEN_MAX_KEYWORD+1];
-  int label_index;
-  int null_ofs = 0;
-
-  (void)sscanf(iline, " label"
-      " %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %n",
-      variable_name,
-      &null_ofs);
-  if (iline[null_ofs] != '\0' && iline[null_ofs] != '#') {
-    return -1;
+  uint64_t value;
+  char *at;
+
+  tgen_lex_space(lex);
+  at = lex->cur;
+  if (tgen_lex_quantity(lex, "len", tgen_byte_units, "byte multiplier", &value) < 0) return -1;
+  if (value > 0x7fffffff) {
+    return tgen_parse_error(lex, at, "Error: len too large");
   }
-
-  label_index = tgen_convert_variable(variable_name);
-  tgen->script->labels[label_index] = step->index;
+  *len = (int)value;
 
   return 0;
-}  /* tgen_parse_label */
+}  /* tgen_lex_len */
 
 
-int tgen_parse_delay(char *iline, tgen_step_t *step)
+int tgen_lex_rate(tgen_lex_t *lex, uint64_t *rate)
 {
-  char duration_multiplier[TGEN_MAX_KEYWORD+1];
-  int null_ofs = 0;
+  return tgen_lex_quantity(lex, "rate", tgen_rate_units, "rate multiplier", rate);
+}  /* tgen_lex_rate */
 
-  (void)sscanf(iline, " delay"
-      " %9u %" CPRT_STRDEF(TGEN_MAX_KEYWORD) "[A-Za-z]"
-      " %n",
-      &step->duration_usec, duration_multiplier,
-      &null_ofs);
-  if (iline[null_ofs] != '\0' && iline[null_ofs] != '#') {
-    return -1;
-  }
 
-  step->duration_usec *= tgen_convert_duration_multiplier(duration_multiplier);
+/* A duration, in usec. */
+int tgen_lex_duration(tgen_lex_t *lex, char *name, uint64_t *usec)
+{
+  return tgen_lex_quantity(lex, name, tgen_duration_units, "duration multiplier", usec);
+}  /* tgen_lex_duration */
 
-  step->opcode = TGEN_OPCODE_DELAY;
 
-  return 1;
-}  /* tgen_parse_delay */
+int tgen_lex_msgs(tgen_lex_t *lex, char *name, uint64_t *num_msgs)
+{
+  return tgen_lex_quantity(lex, name, tgen_msgs_units, "msgs multiplier", num_msgs);
+}  /* tgen_lex_msgs */
 
 
-int tgen_parse_repl(char *iline, tgen_step_t *step)
+/* Variable or label name a-z, returned as index 0-25. */
+int tgen_lex_variable(tgen_lex_t *lex, char *kind, int *index)
 {
-  int null_ofs = 0;
-
-  (void)sscanf(iline, " repl"
-      " %n",
-      &null_ofs);
-  if (iline[null_ofs] != '\0' && iline[null_ofs] != '#') {
-    return -1;
+  if (tgen_lex_word(lex) == 0) {
+    return tgen_parse_error(lex, lex->tok, "Error: expected %s", kind);
   }
+  if (lex->tok_len != 1 || lex->tok[0] < 'a' || lex->tok[0] > 'z') {
+    return tgen_parse_error(lex, lex->tok, "Error: invalid %s '%.*s'", kind, lex->tok_len, lex->tok);
+  }
+  *index = lex->tok[0] - 'a';
 
-  step->opcode = TGEN_OPCODE_REPL;
-
-  return 1;
-}  /* tgen_parse_repl */
+  return 0;
+}  /* tgen_lex_variable */
 
 
-int tgen_parse_step(tgen_t *tgen, char *iline, tgen_step_t *step)
+/* If a number is next (an optional value), scan it; else "value" is 0. */
+int tgen_lex_optional_int(tgen_lex_t *lex, char *name, int *value)
 {
-  int stat;
-
-  if ((stat = tgen_parse_comment(iline, step)) >= 0) return stat;
-  if ((stat = tgen_parse_sendt(iline, step)) >= 0) return stat;
-  if ((stat = tgen_parse_sendc(iline, step)) >= 0) return stat;
-  if ((stat = tgen_parse_set(iline, step)) >= 0) return stat;
-  if ((stat = tgen_parse_label(tgen, iline, step)) >= 0) return stat;
-  if ((stat = tgen_parse_loop(iline, step)) >= 0) return stat;
-  if ((stat = tgen_parse_delay(iline, step)) >= 0) return stat;
-  if ((stat = tgen_parse_repl(iline, step)) >= 0) return stat;
+  *value = 0;
+  tgen_lex_space(lex);
+  if (lex->cur < lex->end && *lex->cur >= '0' && *lex->cur <= '9') {
+    return tgen_lex_int(lex, name, value);
+  }
 
-  fprintf(stderr, "tgen_parse_step: unrecognized input line: '%s'\n", iline);
-  return -1;
-}  /* tgen_parse_step */
+  return 0;
+}  /* tgen_lex_optional_int */
 
 
 /*
- * Run-time functions.
+ * The tgen_parse_*() functions are called with the statement's keyword
+ * just scanned (lex->tok), and parse its fields. They return -1 for
+ * error, 0 for success but no step (e.g. label), 1 for step parsed.
+ * The caller checks that nothing follows.
  */
 
 
-void tgen_run_sendt(tgen_t *tgen, int len, int rate, int duration_usec)
+/* sendt <len> <mult> <rate> <mult> <duration> <mult> */
+int tgen_parse_sendt(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  uint64_t duration_ns = 1000 * (uint64_t)duration_usec;
-  uint64_t ns_so_far;
-  struct cprt_timespec cur_ts;
-  struct cprt_timespec start_ts;
-  uint64_t num_sent;
+  if (tgen_lex_len(lex, &step->len) < 0) return -1;
+  if (tgen_lex_rate(lex, &step->rate) < 0) return -1;
+  if (tgen_lex_duration(lex, "duration", &step->duration_usec) < 0) return -1;
 
-  if (tgen->flags & TGEN_FLAGS_TST1) {
-    fprintf(stderr, "sendt, %d %d %d\n", len, rate, duration_usec);
-    return;
-  }
+  step->opcode = TGEN_OPCODE_SENDT;
 
-  /* Send messages evenly-spaced using busy looping. Based on algorithm:
-   * http://www.geeky-boy.com/catchup/html/ */
-  CPRT_GETTIME(&start_ts);
-  cur_ts = start_ts;
-  ns_so_far = 0;
-  num_sent = 0;
-  do {  /* while */
-    /* The +1 is because we want to send, then pause. */
-    uint64_t should_have_sent = (ns_so_far * rate)/1000000000 + 1;
+  return 1;
+}  /* tgen_parse_sendt */
 
-    /* If we are behind where we should be, tight loop to get caught up. */
-    if (should_have_sent > num_sent + 20) {
-      should_have_sent = num_sent + 20;  /* Limit tight loops to 20. */
-    }
-    while (num_sent < should_have_sent) {
-      my_send(tgen, len);
 
-      num_sent++;
-    }  /* while num_sent < should_have_sent */
-    CPRT_GETTIME(&cur_ts);
-    CPRT_DIFF_TS(ns_so_far, cur_ts, start_ts);
-  } while (ns_so_far < duration_ns);
+/* sendc <len> <mult> <rate> <mult> <num_msgs> <mult> */
+int tgen_parse_sendc(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  if (tgen_lex_len(lex, &step->len) < 0) return -1;
+  if (tgen_lex_rate(lex, &step->rate) < 0) return -1;
+  if (tgen_lex_msgs(lex, "msgs", &step->num_msgs) < 0) return -1;
 
-  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
-    printf("sendt len=%d rate=%d duration_usec=%d, actual rate=%ld, actual msgs=%ld\n",
-        len, rate, duration_usec,
-        (long)((num_sent * 1000000) / (ns_so_far / 1000)),
-        (long)num_sent);
-  }
-}  /* tgen_run_sendt */
+  step->opcode = TGEN_OPCODE_SENDC;
+
+  return 1;
+}  /* tgen_parse_sendc */
 
 
-void tgen_run_sendc(tgen_t *tgen, int len, int rate, int num_msgs)
+/* ramp <len> <mult> <start_rate> <mult> <end_rate> <mult> <duration> <mult> */
+int tgen_parse_ramp(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  struct cprt_timespec cur_ts;
-  struct cprt_timespec start_ts;
-  uint64_t num_sent;
-  uint64_t ns_so_far;
+  if (tgen_lex_len(lex, &step->len) < 0) return -1;
+  if (tgen_lex_rate(lex, &step->rate) < 0) return -1;
+  if (tgen_lex_rate(lex, &step->end_rate) < 0) return -1;
+  if (tgen_lex_duration(lex, "duration", &step->duration_usec) < 0) return -1;
 
-  if (tgen->flags & TGEN_FLAGS_TST1) {
-    fprintf(stderr, "sendc, %d %d %d\n", len, rate, num_msgs);
-    return;
-  }
+  step->opcode = TGEN_OPCODE_RAMP;
 
-  /* Send messages evenly-spaced using busy looping. Based on algorithm:
-   * http://www.geeky-boy.com/catchup/html/ */
-  CPRT_GETTIME(&start_ts);
-  cur_ts = start_ts;
-  ns_so_far = 0;
-  num_sent = 0;
-  do {  /* while num_sent < num_msgs */
-    /* The +1 is because we want to send, then pause. */
-    uint64_t should_have_sent = (ns_so_far * rate)/1000000000 + 1;
-    if (should_have_sent > num_msgs) {
-      should_have_sent = num_msgs;
-    }
+  return 1;
+}  /* tgen_parse_ramp */
 
-    /* If we are behind where we should be, tight loop to get caught up. */
-    if (should_have_sent > num_sent + 20) {
-      should_have_sent = num_sent + 20;  /* Limit tight loops to 20. */
-    }
-    while (num_sent < should_have_sent) {
-      my_send(tgen, len);
 
-      num_sent++;
-    }  /* while num_sent < should_have_sent */
-    CPRT_GETTIME(&cur_ts);
-    CPRT_DIFF_TS(ns_so_far, cur_ts, start_ts);
-  } while (num_sent < num_msgs);
+/* burst <len> <mult> <num_msgs> <mult> every <period> <mult> for <duration> <mult> */
+int tgen_parse_burst(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  char *at = lex->tok;
 
-  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
-    printf("sendc len=%d rate=%d num_msgs=%d, actual rate=%ld\n",
-        len, rate, num_msgs,
-        (long)((num_sent * 1000000) / (ns_so_far / 1000)));
+  if (tgen_lex_len(lex, &step->len) < 0) return -1;
+  if (tgen_lex_msgs(lex, "num msgs", &step->num_msgs) < 0) return -1;
+  if (tgen_lex_expect(lex, "every") < 0) return -1;
+  if (tgen_lex_duration(lex, "period", &step->period_usec) < 0) return -1;
+  if (tgen_lex_expect(lex, "for") < 0) return -1;
+  if (tgen_lex_duration(lex, "duration", &step->duration_usec) < 0) return -1;
+
+  if (step->num_msgs < 1 || step->period_usec < 1) {
+    return tgen_parse_error(lex, at, "Error: burst needs at least 1 msg every at least 1 usec");
   }
-}  /* tgen_run_sendc */
 
+  step->opcode = TGEN_OPCODE_BURST;
 
-void tgen_run_set(tgen_t *tgen, int variable_index, int value)
-{
-  tgen->variables[variable_index] = value;
-  my_variable_change(tgen, variable_index + 'a', value);
-}  /* tgen_run_set */
+  return 1;
+}  /* tgen_parse_burst */
 
 
-void tgen_run_loop(tgen_t *tgen, int variable_index, int label_index)
+/* <thread_num> [cpu <cpu>] {   (after "thread") */
+int tgen_parse_thread_header(tgen_t *tgen, tgen_lex_t *lex, int *thread_num, int *cpu)
 {
-  if (tgen->script->labels[label_index] == -1) {
-    fprintf(stderr, "tgen_run_loop: unknown label: %c\n", ('a' + label_index));
-    CPRT_ERR_EXIT;
+  if (tgen->parent != NULL) {
+    return tgen_parse_error(lex, lex->tok, "Error: thread blocks can't be nested");
   }
-  if (tgen->variables[variable_index] > 0) {
-    tgen->variables[variable_index] --;
-    my_variable_change(tgen, variable_index + 'a', tgen->variables[variable_index]);
+  if (tgen_lex_int(lex, "thread number", thread_num) < 0) return -1;
+  if (*thread_num >= TGEN_MAX_THREADS) {
+    return tgen_parse_error(lex, lex->tok, "Error: thread number must be 0 to %d", TGEN_MAX_THREADS - 1);
   }
-
-  if (tgen->variables[variable_index] > 0) {
-    tgen->pc = tgen->script->labels[label_index];
+  if (tgen->threads != NULL && tgen->threads[*thread_num].tgen != NULL) {
+    return tgen_parse_error(lex, lex->tok, "Error: thread %d already defined", *thread_num);
+  }
+  tgen_lex_word(lex);
+  if (TGEN_LEX_IS(lex, "cpu")) {
+    if (tgen_lex_int(lex, "cpu", cpu) < 0) return -1;
+    if (*cpu > 63) {
+      return tgen_parse_error(lex, lex->tok, "Error: thread cpu must be 0 to 63");
+    }
+  }
+  else {
+    lex->cur = lex->tok;
+  }
+  if (! tgen_lex_char(lex, '{')) {
+    return tgen_parse_error(lex, lex->cur, "Error: expected '{'");
   }
-}  /* tgen_run_loop */
-
-
-void tgen_run_delay(tgen_t *tgen, int duration_usec)
-{
-  uint64_t duration_ns = 1000 * (uint64_t)duration_usec;
-  uint64_t ns_so_far;
-  struct cprt_timespec cur_ts;
-  struct cprt_timespec start_ts;
 
-  CPRT_GETTIME(&start_ts);
-  cur_ts = start_ts;
-  do {  /* while */
-    CPRT_DIFF_TS(ns_so_far, cur_ts, start_ts);
-    CPRT_GETTIME(&cur_ts);
-  } while (ns_so_far < duration_ns);
-}  /* tgen_run_set */
+  return 0;
+}  /* tgen_parse_thread_header */
 
 
-void tgen_run_repl(tgen_t *tgen)
+/* thread <thread_num> [cpu <cpu>] {
+ * Starts a thread block. The statements up to the matching "}" are added
+ * to the block's own instance (see tgen_parse_thread_body()). */
+int tgen_parse_thread(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  char iline[TGEN_MAX_LINE+1];
-  tgen_step_t my_step;
-
-  printf("repl? "); fflush(stdout);
-  while (fgets(iline, TGEN_MAX_LINE, stdin)) {
-    if (tgen_parse_step(tgen, iline, &my_step) > 0) {
-      tgen_run1(tgen, &my_step);
+  char *brace = lex->cur;
+  tgen_t *child;
+  int thread_num = 0;
+  int cpu = -1;
+
+  if (tgen_parse_thread_header(tgen, lex, &thread_num, &cpu) < 0) {
+    /* If the bad header opens a block, the block goes to an instance that
+     * is thrown away at its "}", so that only the header is reported. */
+    while (brace < lex->end && *brace != '{' && *brace != ';' && *brace != '\n') {
+      brace++;
     }
-    printf("repl? "); fflush(stdout);
+    if (brace < lex->end && *brace == '{') {
+      child = tgen_create(tgen->flags, NULL);
+      child->parent = tgen;  /* thread_num stays -1. */
+      tgen->parse_thread = child;
+    }
+    return -1;
   }
-}  /* tgen_run_set */
 
+  child = tgen_thread_create(tgen, thread_num, cpu);
+  tgen->parse_thread = child;
 
-void tgen_run1(tgen_t *tgen, tgen_step_t *step)
-{
-  switch (step->opcode) {
-  case TGEN_OPCODE_SENDT: tgen_run_sendt(tgen, step->len, step->rate, step->duration_usec); break;
-  case TGEN_OPCODE_SENDC: tgen_run_sendc(tgen, step->len, step->rate, step->num_msgs); break;
-  case TGEN_OPCODE_SET: tgen_run_set(tgen, step->variable_index, step->value); break;
-  case TGEN_OPCODE_LOOP: tgen_run_loop(tgen, step->variable_index, step->label_index); break;
-  case TGEN_OPCODE_DELAY: tgen_run_delay(tgen, step->duration_usec); break;
-  case TGEN_OPCODE_REPL: tgen_run_repl(tgen); break;
-  default:
-    fprintf(stderr, "tgen_run1: unknown opcode: %d\n", step->opcode);
-    CPRT_ERR_EXIT;
-  }  /* switch */
-}  /* tgen_run1 */
+  /* Allow a step on the same line as the "{". */
+  if (! tgen_lex_at_end(lex)) {
+    if (tgen_parse_add(child, lex) < 0) return -1;
+  }
+
+  return 0;
+}  /* tgen_parse_thread */
 
 
-void tgen_run(tgen_t *tgen)
+/* Inside a thread block, add the statement to the block's instance. The
+ * closing "}" produces the step that starts the thread (unless the block
+ * has a bad nested block of its own open, which the "}" closes). */
+int tgen_parse_thread_body(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  tgen->state = TGEN_STATE_RUNNING;
-  while (tgen->state == TGEN_STATE_RUNNING) {
-    if (tgen->pc >= tgen->script->num_steps) {
-      /* No more steps, exit. */
-      tgen->state = TGEN_STATE_STOPPED;
-    }
-    else {
-      tgen_step_t *step = &tgen->script->steps[tgen->pc];
-      tgen->pc++;
-
-      tgen_run1(tgen, step);
+  char *start = lex->cur;
+
+  if (tgen->parse_thread->parse_thread == NULL && tgen_lex_char(lex, '}')) {
+    if (tgen_lex_end(lex) < 0) return -1;
+    if (tgen->parse_thread->thread_num < 0) {
+      tgen_delete(tgen->parse_thread);  /* The block of a bad header. */
+      tgen->parse_thread = NULL;
+      return 0;
     }
+    step->value = tgen->parse_thread->thread_num;
+    step->opcode = TGEN_OPCODE_THREAD;
+    tgen->parse_thread = NULL;
+    return 1;
   }
-}  /* tgen_run */
 
+  lex->cur = start;
+  return (tgen_parse_add(tgen->parse_thread, lex) < 0) ? -1 : 0;
+}  /* tgen_parse_thread_body */
 
-/*
- * APIs
- */
 
-tgen_t *tgen_create(uint32_t flags, void *user_data)
+int tgen_parse_join(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  tgen_t *tgen;
-  tgen_script_t *script;
-  tgen_step_t *steps;
-  int max_steps;
-  int i;
+  step->opcode = TGEN_OPCODE_JOIN;
 
-  CPRT_ENULL(tgen = (tgen_t *)malloc(sizeof(tgen_t)));
+  return 1;
+}  /* tgen_parse_join */
 
-  max_steps = 64;
-  CPRT_ENULL(script = (tgen_script_t *)malloc(sizeof(tgen_script_t)));
 
-  CPRT_ENULL(steps = (tgen_step_t *)malloc(max_steps * sizeof(tgen_step_t)));
+/* at <time> <mult>       (wall-clock time since the Unix epoch)
+ * at next <period> <mult> */
+int tgen_parse_at(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  char *at;
 
-  for (i = 0; i < max_steps; i++) {
-    steps[i].index = i;
+  step->mode = TGEN_AT_ABSOLUTE;
+  tgen_lex_word(lex);
+  if (TGEN_LEX_IS(lex, "next")) {
+    step->mode = TGEN_AT_NEXT;
+  }
+  else {
+    lex->cur = lex->tok;
+  }
+  tgen_lex_space(lex);
+  at = lex->cur;
+  if (tgen_lex_duration(lex, "time", &step->duration_usec) < 0) return -1;
+  /* Checked here so tgen_run_at() can convert to ns. */
+  if (step->duration_usec > (uint64_t)-1 / 1000) {
+    return tgen_parse_error(lex, at, "Error: time too large");
+  }
+  if (step->mode == TGEN_AT_NEXT && step->duration_usec == 0) {
+    return tgen_parse_error(lex, at, "Error: at next needs a period of at least 1 usec");
   }
 
-  for (i = 0; i < 26; i++) {
-    script->labels[i] = -1;
+  step->opcode = TGEN_OPCODE_AT;
+
+  return 1;
+}  /* tgen_parse_at */
+
+
+/* sync <name> <num_procs> */
+int tgen_parse_sync(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  if (tgen_lex_word(lex) == 0) {
+    return tgen_parse_error(lex, lex->tok, "Error: expected sync name");
   }
-  script->num_steps = 0;
-  script->max_steps = max_steps;
-  script->steps = steps;
+  if (lex->tok_len > TGEN_MAX_KEYWORD) {
+    return tgen_parse_error(lex, lex->tok, "Error: sync name too long");
+  }
+  memcpy(step->name, lex->tok, lex->tok_len);
+  step->name[lex->tok_len] = '\0';
 
-  for (i = 0; i < 26; i++) {
-    tgen->variables[i] = 0;
+  if (tgen_lex_int(lex, "number of processes", &step->value) < 0) return -1;
+  if (step->value < 1) {
+    return tgen_parse_error(lex, lex->tok, "Error: sync needs at least 1 process");
   }
-  tgen->flags = flags;
-  tgen->user_data = user_data;
-  tgen->pc = 0;
-  tgen->script = script;
-  tgen->state = TGEN_STATE_STOPPED;
 
-  return tgen;
-}  /* tgen_create */
+  step->opcode = TGEN_OPCODE_SYNC;
+
+  return 1;
+}  /* tgen_parse_sync */
 
 
-void tgen_delete(tgen_t *tgen)
+/* report csv|json <interval> <mult> <filename>
+ * report stop */
+int tgen_parse_report(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  free(tgen->script->steps);
-  free(tgen->script);
-  free(tgen);
-}  /* tgen_delete */
+  char filename[TGEN_MAX_LINE+1];
+  uint64_t format;
+  char *at;
+
+  step->str = NULL;
+  tgen_lex_word(lex);
+  if (TGEN_LEX_IS(lex, "stop")) {
+    step->mode = 0;
+    step->opcode = TGEN_OPCODE_REPORT;
+    return 1;
+  }
+  lex->cur = lex->tok;
+
+  if (tgen_lex_keyword(lex, tgen_report_formats, "report format", &format) < 0) return -1;
+  step->mode = (int)format;
+  tgen_lex_space(lex);
+  at = lex->cur;
+  if (tgen_lex_duration(lex, "interval", &step->duration_usec) < 0) return -1;
+  if (step->duration_usec < 1000) {
+    return tgen_parse_error(lex, at, "Error: report interval must be at least 1 msec");
+  }
+  if (tgen_lex_path(lex, "report file name", filename, sizeof(filename)) < 0) return -1;
+  if (tgen_lex_end(lex) < 0) return -1;  /* Before the copy, so it can't leak. */
+  CPRT_ENULL(step->str = CPRT_STRDUP(filename));
 
+  step->opcode = TGEN_OPCODE_REPORT;
 
-void *tgen_user_data_get(tgen_t *tgen)
-{
-  return tgen->user_data;
-}  /* tgen_user_data_get */
+  return 1;
+}  /* tgen_parse_report */
 
 
-int tgen_variable_get(tgen_t *tgen, char var_id)
+/* set <variable> <value> */
+int tgen_parse_set(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  CPRT_ASSERT(var_id >= 'a' && var_id <= 'z');
-  return tgen->variables[var_id - 'a'];
-}  /* tgen_variable_get */
+  if (tgen_lex_variable(lex, "variable name", &step->variable_index) < 0) return -1;
+  if (tgen_lex_int(lex, "value", &step->value) < 0) return -1;
 
+  step->opcode = TGEN_OPCODE_SET;
 
-void tgen_variable_set(tgen_t *tgen, char var_id, int value)
-{
-  CPRT_ASSERT(var_id >= 'a' && var_id <= 'z');
-  tgen->variables[var_id - 'a'] = value;
-  my_variable_change(tgen, var_id, value);
-}  /* tgen_variable_set */
+  return 1;
+}  /* tgen_parse_set */
 
 
-void tgen_add_step(tgen_t *tgen, char *iline)
+/* loop <label> <variable> */
+int tgen_parse_loop(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  int status;
-
-  if (tgen->script->num_steps == tgen->script->max_steps) {
-    /* Dynamically grow the "steps" array (double). */
-    tgen->script->max_steps *= 2;
-    tgen->script->steps = (tgen_step_t *)realloc(tgen->script->steps, tgen->script->max_steps);
+  char *at;
+
+  tgen_lex_space(lex);
+  at = lex->cur;
+  if (tgen_lex_variable(lex, "label name", &step->label_index) < 0) return -1;
+  /* The label can come later, so it is checked by tgen_compile(). */
+  if (tgen->script->loop_where[step->label_index] == NULL) {
+    tgen->script->loop_where[step->label_index] = tgen_lex_where(lex, at);
   }
-  CPRT_ASSERT(tgen->script->num_steps < tgen->script->max_steps);
+  if (tgen_lex_variable(lex, "variable name", &step->variable_index) < 0) return -1;
 
-  status = tgen_parse_step(tgen, iline, &tgen->script->steps[tgen->script->num_steps]);
-  if (status > 0) {
-    tgen->script->num_steps ++;
-  }
-  else if (status < 0) {
-    CPRT_ERR_EXIT;
-  }
-}  /* tgen_add_step */
+  step->opcode = TGEN_OPCODE_LOOP;
+
+  return 1;
+}  /* tgen_parse_loop */
 
 
-void tgen_add_multi_steps(tgen_t *tgen, char *iline)
+/* label <label> */
+int tgen_parse_label(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
 {
-  char *local_buffer = CPRT_STRDUP(iline);
-  char *strtok_state;
-  char *token;
+  int label_index;
 
-  token = CPRT_STRTOK(local_buffer, ";\n", &strtok_state);
-  while (token != NULL) {
-    tgen_add_step(tgen, token);
+  if (tgen_lex_variable(lex, "label name", &label_index) < 0) return -1;
+  tgen->script->labels[label_index] = (int)tgen->script->size;  /* Next step. */
 
-    token = CPRT_STRTOK(NULL, ";\n", &strtok_state);
-  }
+  return 0;
+}  /* tgen_parse_label */
 
-  free(local_buffer);
+
+/* delay <duration> <mult> */
+int tgen_parse_delay(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  if (tgen_lex_duration(lex, "duration", &step->duration_usec) < 0) return -1;
+
+  step->opcode = TGEN_OPCODE_DELAY;
+
+  return 1;
+}  /* tgen_parse_delay */
+
+
+int tgen_parse_repl(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  step->opcode = TGEN_OPCODE_REPL;
+
+  return 1;
+}  /* tgen_parse_repl */
+
+
+/* catchup burst|token <value>
+ * catchup skip */
+int tgen_parse_catchup(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  uint64_t policy;
+  char *name;
+  int name_len;
+
+  if (tgen_lex_keyword(lex, tgen_catchup_policies, "catchup policy", &policy) < 0) return -1;
+  step->mode = (int)policy;
+  name = lex->tok;
+  name_len = lex->tok_len;
+  /* The value is optional ("catchup skip" has none). */
+  if (tgen_lex_optional_int(lex, "value", &step->value) < 0) return -1;
+
+  if (step->mode == TGEN_CATCHUP_SKIP && step->value != 0) {
+    return tgen_parse_error(lex, name, "Error: catchup skip does not take a value");
+  }
+  if (step->mode != TGEN_CATCHUP_SKIP && step->value < 1) {
+    return tgen_parse_error(lex, name, "Error: catchup %.*s needs a value of at least 1", name_len, name);
+  }
+
+  step->opcode = TGEN_OPCODE_CATCHUP;
+
+  return 1;
+}  /* tgen_parse_catchup */
+
+
+/* arrival even|poisson
+ * arrival uniform|pareto <value> */
+int tgen_parse_arrival(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  uint64_t dist;
+  char *name;
+  int name_len;
+
+  if (tgen_lex_keyword(lex, tgen_arrival_dists, "arrival distribution", &dist) < 0) return -1;
+  step->mode = (int)dist;
+  name = lex->tok;
+  name_len = lex->tok_len;
+  /* The value is optional ("arrival poisson" has none). */
+  if (tgen_lex_optional_int(lex, "value", &step->value) < 0) return -1;
+
+  if ((step->mode == TGEN_ARRIVAL_EVEN || step->mode == TGEN_ARRIVAL_POISSON)
+      && step->value != 0) {
+    return tgen_parse_error(lex, name, "Error: arrival %.*s does not take a value", name_len, name);
+  }
+  if (step->mode == TGEN_ARRIVAL_UNIFORM && (step->value < 1 || step->value > 100)) {
+    return tgen_parse_error(lex, name, "Error: arrival uniform needs a percentage from 1 to 100");
+  }
+  if (step->mode == TGEN_ARRIVAL_PARETO && step->value <= 100) {
+    return tgen_parse_error(lex, name, "Error: arrival pareto needs a shape (times 100) above 100");
+  }
+
+  step->opcode = TGEN_OPCODE_ARRIVAL;
+
+  return 1;
+}  /* tgen_parse_arrival */
+
+
+/* payload none
+ * payload pattern <stream> */
+int tgen_parse_payload(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  step->value = 0;
+  tgen_lex_word(lex);
+  if (TGEN_LEX_IS(lex, "none")) {
+    step->mode = TGEN_PAYLOAD_NONE;
+  }
+  else if (TGEN_LEX_IS(lex, "pattern")) {
+    step->mode = TGEN_PAYLOAD_PATTERN;
+    if (tgen_lex_int(lex, "stream", &step->value) < 0) return -1;
+  }
+  else {
+    return tgen_parse_error(lex, lex->tok, "Error: expected 'none' or 'pattern'");
+  }
+
+  step->opcode = TGEN_OPCODE_PAYLOAD;
+
+  return 1;
+}  /* tgen_parse_payload */
+
+
+/* stamp <stream>
+ * stamp off */
+int tgen_parse_stamp(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  step->mode = 0;
+  step->value = 0;
+  tgen_lex_word(lex);
+  if (! TGEN_LEX_IS(lex, "off")) {
+    lex->cur = lex->tok;
+    step->mode = 1;
+    if (tgen_lex_int(lex, "stream", &step->value) < 0) return -1;
+  }
+
+  step->opcode = TGEN_OPCODE_STAMP;
+
+  return 1;
+}  /* tgen_parse_stamp */
+
+
+/* Into "path": "name" relative to the directory of file "from" (NULL
+ * for the current directory). Returns -1 if it doesn't fit. */
+int tgen_include_path(char *from, char *name, char *path, int path_size)
+{
+  char *slash = (from != NULL) ? strrchr(from, '/') : NULL;
+  int dir_len = 0;
+
+  if (slash != NULL && name[0] != '/') {
+    dir_len = (int)(slash - from) + 1;
+  }
+  if (dir_len + (int)strlen(name) >= path_size) return -1;
+  memcpy(path, from, dir_len);
+  strcpy(&path[dir_len], name);
+
+  return 0;
+}  /* tgen_include_path */
+
+
+/* include <filename>
+ * The file's statements are parsed here, so they go into the thread
+ * block if this is in one. A relative name is relative to the including
+ * file. Errors in the file are counted in "lex" and don't fail this
+ * statement. */
+int tgen_parse_include(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  char name[TGEN_MAX_LINE+1];
+  char path[TGEN_MAX_LINE+1];
+  char *at;
+  int errors;
+
+  tgen_lex_space(lex);
+  at = lex->cur;
+  if (tgen_lex_path(lex, "include file name", name, sizeof(name)) < 0) return -1;
+  if (tgen_lex_end(lex) < 0) return -1;
+  if (lex->depth >= TGEN_MAX_INCLUDE_DEPTH) {
+    return tgen_parse_error(lex, at, "Error: includes nested more than %d deep", TGEN_MAX_INCLUDE_DEPTH);
+  }
+  if (tgen_include_path(lex->filename, name, path, sizeof(path)) < 0) {
+    return tgen_parse_error(lex, at, "Error: include file name too long");
+  }
+
+  errors = tgen_parse_file(tgen, path, lex->depth + 1);
+  if (errors < 0) {
+    return tgen_parse_error(lex, at, "Error: could not read include file '%s': %s", path, strerror(errno));
+  }
+  lex->errors += errors;
+
+  return 0;
+}  /* tgen_parse_include */
+
+
+/* size weighted <len> <mult> <weight> [<len> <mult> <weight> ...] */
+int tgen_parse_size_weighted(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  char *at = lex->tok;
+  int max_lens = 8;
+  int num_lens = 0;
+  int *lens;
+  uint64_t *weights;
+  uint64_t total = 0;
+
+  CPRT_ENULL(lens = (int *)malloc(max_lens * sizeof(int)));
+  CPRT_ENULL(weights = (uint64_t *)malloc(max_lens * sizeof(uint64_t)));
+  do {
+    if (num_lens == max_lens) {
+      max_lens *= 2;
+      CPRT_ENULL(lens = (int *)realloc(lens, max_lens * sizeof(int)));
+      CPRT_ENULL(weights = (uint64_t *)realloc(weights, max_lens * sizeof(uint64_t)));
+    }
+    if (tgen_lex_len(lex, &lens[num_lens]) < 0
+        || tgen_lex_u64(lex, "weight", &weights[num_lens]) < 0) {
+      free(lens);
+      free(weights);
+      return -1;
+    }
+    total |= weights[num_lens];
+    num_lens++;
+  } while (! tgen_lex_at_end(lex));
+
+  if (total == 0) {
+    free(lens);
+    free(weights);
+    return tgen_parse_error(lex, at, "Error: size weights must not all be zero");
+  }
+  step->sizes = tgen_sizes_table_create(tgen, num_lens, lens, weights);
+  free(lens);
+  free(weights);
+
+  return 1;
+}  /* tgen_parse_size_weighted */
+
+
+/* size fixed
+ * size uniform <min_len> <mult> <max_len> <mult>
+ * size weighted <len> <mult> <weight> [<len> <mult> <weight> ...]
+ * size file <filename>
+ */
+int tgen_parse_size(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  tgen_lex_word(lex);
+  if (TGEN_LEX_IS(lex, "fixed")) {
+    step->sizes = NULL;
+  }
+  else if (TGEN_LEX_IS(lex, "uniform")) {
+    int min_len;
+    int max_len;
+    char *at;
+
+    tgen_lex_space(lex);
+    at = lex->cur;
+    if (tgen_lex_len(lex, &min_len) < 0) return -1;
+    if (tgen_lex_len(lex, &max_len) < 0) return -1;
+    if (min_len > max_len) {
+      return tgen_parse_error(lex, at, "Error: size uniform min len must not exceed max len");
+    }
+    step->sizes = tgen_sizes_uniform_create(tgen, min_len, max_len);
+  }
+  else if (TGEN_LEX_IS(lex, "weighted")) {
+    if (tgen_parse_size_weighted(tgen, lex, step) < 0) return -1;
+  }
+  else if (TGEN_LEX_IS(lex, "file")) {
+    char filename[TGEN_MAX_LINE+1];
+    char *at;
+
+    tgen_lex_space(lex);
+    at = lex->cur;
+    if (tgen_lex_path(lex, "size file name", filename, sizeof(filename)) < 0) return -1;
+    step->sizes = tgen_sizes_file_create(tgen, filename);
+    if (step->sizes == NULL) {
+      return tgen_parse_error(lex, at, "Error: size file '%s' not loaded", filename);
+    }
+  }
+  else if (lex->tok_len == 0) {
+    return tgen_parse_error(lex, lex->tok, "Error: expected size distribution");
+  }
+  else {
+    return tgen_parse_error(lex, lex->tok, "Error: invalid size distribution '%.*s'", lex->tok_len, lex->tok);
+  }
+
+  step->opcode = TGEN_OPCODE_SIZE;
+
+  return 1;
+}  /* tgen_parse_size */
+
+
+typedef int tgen_parse_fn_t(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step);
+
+/* The parser for the keyword just scanned, NULL if it isn't one. */
+tgen_parse_fn_t *tgen_parse_lookup(tgen_lex_t *lex)
+{
+  switch (lex->tok[0]) {
+  case 'a':
+    if (TGEN_LEX_IS(lex, "arrival")) return tgen_parse_arrival;
+    if (TGEN_LEX_IS(lex, "at")) return tgen_parse_at;
+    break;
+  case 'b':
+    if (TGEN_LEX_IS(lex, "burst")) return tgen_parse_burst;
+    break;
+  case 'c':
+    if (TGEN_LEX_IS(lex, "catchup")) return tgen_parse_catchup;
+    break;
+  case 'd':
+    if (TGEN_LEX_IS(lex, "delay")) return tgen_parse_delay;
+    break;
+  case 'i':
+    if (TGEN_LEX_IS(lex, "include")) return tgen_parse_include;
+    break;
+  case 'j':
+    if (TGEN_LEX_IS(lex, "join")) return tgen_parse_join;
+    break;
+  case 'l':
+    if (TGEN_LEX_IS(lex, "label")) return tgen_parse_label;
+    if (TGEN_LEX_IS(lex, "loop")) return tgen_parse_loop;
+    break;
+  case 'p':
+    if (TGEN_LEX_IS(lex, "payload")) return tgen_parse_payload;
+    break;
+  case 'r':
+    if (TGEN_LEX_IS(lex, "ramp")) return tgen_parse_ramp;
+    if (TGEN_LEX_IS(lex, "repl")) return tgen_parse_repl;
+    if (TGEN_LEX_IS(lex, "report")) return tgen_parse_report;
+    break;
+  case 's':
+    if (TGEN_LEX_IS(lex, "sendc")) return tgen_parse_sendc;
+    if (TGEN_LEX_IS(lex, "sendt")) return tgen_parse_sendt;
+    if (TGEN_LEX_IS(lex, "set")) return tgen_parse_set;
+    if (TGEN_LEX_IS(lex, "size")) return tgen_parse_size;
+    if (TGEN_LEX_IS(lex, "stamp")) return tgen_parse_stamp;
+    if (TGEN_LEX_IS(lex, "sync")) return tgen_parse_sync;
+    break;
+  case 't':
+    if (TGEN_LEX_IS(lex, "thread")) return tgen_parse_thread;
+    break;
+  }  /* switch */
+
+  return NULL;
+}  /* tgen_parse_lookup */
+
+
+/* Parse the statement at "lex" into "step". Returns -1 for error
+ * (already reported), 0 for no step (e.g. blank or comment), 1 for step. */
+int tgen_parse_step(tgen_t *tgen, tgen_lex_t *lex, tgen_step_t *step)
+{
+  tgen_parse_fn_t *parse_fn = NULL;
+  int stat;
+
+  if (tgen->parse_thread != NULL) return tgen_parse_thread_body(tgen, lex, step);
+
+  if (tgen_lex_word(lex) > 0) {
+    parse_fn = tgen_parse_lookup(lex);
+  }
+  else if (tgen_lex_at_end(lex)) {
+    return 0;
+  }
+  if (parse_fn == NULL) {
+    char *eos = lex->cur;
+    while (eos < lex->end && *eos != ';' && *eos != '\n') eos++;
+    while (eos > lex->tok && TGEN_LEX_SPACE(eos[-1])) eos--;
+    return tgen_parse_error(lex, lex->tok, "tgen_parse_step: unrecognized input line: '%.*s'",
+        (int)(eos - lex->tok), lex->tok);
+  }
+
+  stat = (*parse_fn)(tgen, lex, step);
+  if (stat >= 0 && tgen_lex_end(lex) < 0) {
+    stat = -1;
+  }
+
+  return stat;
+}  /* tgen_parse_step */
+
+
+/* Make room for "bytes" more at the end of the script's arena. */
+void tgen_script_reserve(tgen_script_t *script, size_t bytes)
+{
+  if (script->size + bytes <= script->max_size) {
+    return;
+  }
+
+  /* Dynamically grow the arena (double). */
+  while (script->size + bytes > script->max_size) {
+    script->max_size *= 2;
+  }
+  if (script->max_size > TGEN_ARENA_MAX) {
+    fprintf(stderr, "Error: script too large (over %d bytes of steps)\n", TGEN_ARENA_MAX);
+    CPRT_ERR_EXIT;
+  }
+  CPRT_ENULL(script->arena = (char *)realloc(script->arena, script->max_size));
+}  /* tgen_script_reserve */
+
+
+/* Add "step" to the end of the script as a record (see tgen_rec_t). The
+ * record owns step->str from now on. */
+void tgen_script_append(tgen_script_t *script, tgen_step_t *step)
+{
+  uint64_t words[3];
+  int num_words = 0;
+  uint64_t count;
+  tgen_rec_t *rec;
+  size_t rec_size;
+
+  switch (step->opcode) {
+  case TGEN_OPCODE_SENDT:
+  case TGEN_OPCODE_SENDC:
+    count = (step->opcode == TGEN_OPCODE_SENDT) ? step->duration_usec : step->num_msgs;
+    if (step->rate <= 0xffffffff && count <= 0xffffffff) {
+      words[num_words++] = step->rate | (count << 32);
+    }
+    else {
+      words[num_words++] = step->rate;
+      words[num_words++] = count;
+    }
+    break;
+  case TGEN_OPCODE_RAMP:
+    words[num_words++] = step->rate;
+    words[num_words++] = step->end_rate;
+    words[num_words++] = step->duration_usec;
+    break;
+  case TGEN_OPCODE_BURST:
+    words[num_words++] = step->num_msgs;
+    words[num_words++] = step->period_usec;
+    words[num_words++] = step->duration_usec;
+    break;
+  case TGEN_OPCODE_DELAY:
+  case TGEN_OPCODE_AT:
+    words[num_words++] = step->duration_usec;
+    break;
+  case TGEN_OPCODE_SIZE:
+    words[num_words++] = (uint64_t)(uintptr_t)step->sizes;
+    break;
+  case TGEN_OPCODE_SYNC:
+    memcpy(words, step->name, sizeof(step->name));
+    num_words = sizeof(step->name) / sizeof(uint64_t);
+    break;
+  case TGEN_OPCODE_REPORT:
+    words[num_words++] = step->duration_usec;
+    words[num_words++] = (uint64_t)(uintptr_t)step->str;
+    break;
+  }  /* switch */
+
+  rec_size = sizeof(tgen_rec_t) + num_words * sizeof(uint64_t);
+  tgen_script_reserve(script, rec_size);
+  rec = (tgen_rec_t *)(script->arena + script->size);
+  rec->opcode = (uint8_t)step->opcode;
+  rec->words = (uint8_t)num_words;
+  rec->mode = (uint8_t)step->mode;
+  rec->variable_index = (uint8_t)step->variable_index;
+  rec->value = step->value;
+  switch (step->opcode) {
+  case TGEN_OPCODE_SENDT:
+  case TGEN_OPCODE_SENDC:
+  case TGEN_OPCODE_RAMP:
+  case TGEN_OPCODE_BURST:
+    rec->value = step->len;
+    break;
+  case TGEN_OPCODE_LOOP:
+    rec->mode = (uint8_t)step->label_index;
+    rec->value = -1;  /* Target, set by tgen_compile(). */
+    break;
+  }  /* switch */
+  memcpy(TGEN_REC_WORDS(rec), words, num_words * sizeof(uint64_t));
+
+  script->size += rec_size;
+  script->num_steps++;
+}  /* tgen_script_append */
+
+
+/* Unpack record "rec" into "step" (see tgen_script_append()). */
+void tgen_rec_step(tgen_rec_t *rec, tgen_step_t *step)
+{
+  uint64_t *words = TGEN_REC_WORDS(rec);
+
+  memset(step, 0, sizeof(tgen_step_t));
+  step->opcode = rec->opcode;
+  step->mode = rec->mode;
+  step->variable_index = rec->variable_index;
+  step->value = rec->value;
+
+  switch (rec->opcode) {
+  case TGEN_OPCODE_SENDT:
+  case TGEN_OPCODE_SENDC:
+    step->len = rec->value;
+    if (rec->words == 1) {
+      step->rate = words[0] & 0xffffffff;
+      step->num_msgs = words[0] >> 32;
+    }
+    else {
+      step->rate = words[0];
+      step->num_msgs = words[1];
+    }
+    step->duration_usec = step->num_msgs;  /* SENDT's count is a duration. */
+    break;
+  case TGEN_OPCODE_LOOP:
+    step->label_index = rec->mode;
+    break;
+  case TGEN_OPCODE_RAMP:
+    step->len = rec->value;
+    step->rate = words[0];
+    step->end_rate = words[1];
+    step->duration_usec = words[2];
+    break;
+  case TGEN_OPCODE_BURST:
+    step->len = rec->value;
+    step->num_msgs = words[0];
+    step->period_usec = words[1];
+    step->duration_usec = words[2];
+    break;
+  case TGEN_OPCODE_DELAY:
+  case TGEN_OPCODE_AT:
+    step->duration_usec = words[0];
+    break;
+  case TGEN_OPCODE_SIZE:
+    step->sizes = (tgen_sizes_t *)(uintptr_t)words[0];
+    break;
+  case TGEN_OPCODE_SYNC:
+    memcpy(step->name, words, sizeof(step->name));
+    break;
+  case TGEN_OPCODE_REPORT:
+    step->duration_usec = words[0];
+    step->str = (char *)(uintptr_t)words[1];
+    break;
+  }  /* switch */
+}  /* tgen_rec_step */
+
+
+/* Parse the statement at "lex" and add its step, if any, to the script. */
+int tgen_parse_add(tgen_t *tgen, tgen_lex_t *lex)
+{
+  tgen_step_t step;
+  int status;
+
+  memset(&step, 0, sizeof(step));
+  status = tgen_parse_step(tgen, lex, &step);
+  if (status > 0) {
+    tgen_script_append(tgen->script, &step);
+  }
+
+  return status;
+}  /* tgen_parse_add */
+
+
+/* Parse every statement in "lex", continuing after an error so that they
+ * are all reported. Errors are counted in lex->errors. */
+void tgen_parse_all(tgen_t *tgen, tgen_lex_t *lex)
+{
+  while (lex->cur < lex->end) {
+    if (tgen_parse_add(tgen, lex) < 0) {
+      lex->errors++;
+    }
+    tgen_lex_next_stmt(lex);
+  }
+}  /* tgen_parse_all */
+
+
+/* Parse "text" up to "end". Returns the number of errors. */
+int tgen_parse_text(tgen_t *tgen, char *text, char *end)
+{
+  tgen_lex_t lex;
+
+  tgen_lex_init(&lex, text, end, tgen->parse_lines + 1);
+  tgen_parse_all(tgen, &lex);
+  /* Line numbers carry on into the next call (e.g. a line at a time). */
+  tgen->parse_lines = (lex.cur > lex.line) ? lex.line_num : lex.line_num - 1;
+  tgen->parse_errors += lex.errors;
+
+  return lex.errors;
+}  /* tgen_parse_text */
+
+
+/* Map "filename" read-only into "text" and "size" (NULL and 0 if it's
+ * empty). Returns 0, or -1 with errno set. */
+int tgen_file_map(char *filename, char **text, size_t *size)
+{
+#if defined(_WIN32)
+  FILE *fp;
+  long len;
+
+  /* No mmap(); read it into one buffer. */
+  if ((fp = fopen(filename, "rb")) == NULL) return -1;
+  if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+    fclose(fp);
+    return -1;
+  }
+  CPRT_ENULL(*text = (char *)malloc(len + 1));
+  if (fread(*text, 1, len, fp) != (size_t)len) {
+    free(*text);
+    fclose(fp);
+    errno = EIO;
+    return -1;
+  }
+  fclose(fp);
+  *size = len;
+#else
+  struct stat st;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) == -1) return -1;
+  if (fstat(fd, &st) == -1) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    close(fd);
+    errno = EISDIR;
+    return -1;
+  }
+  *text = NULL;
+  *size = (size_t)st.st_size;
+  if (*size > 0) {
+    *text = (char *)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (*text == (char *)MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    (void)madvise(*text, *size, MADV_SEQUENTIAL);
+  }
+  CPRT_EM1(close(fd));
+#endif
+
+  return 0;
+}  /* tgen_file_map */
+
+
+void tgen_file_unmap(char *text, size_t size)
+{
+#if defined(_WIN32)
+  free(text);
+#else
+  if (size > 0) {
+    CPRT_EM1(munmap(text, size));
+  }
+#endif
+}  /* tgen_file_unmap */
+
+
+/* Parse script file "filename" in place. "depth" counts the includes
+ * that led to it. Returns the number of errors, or -1 (with errno set)
+ * if the file can't be read. */
+int tgen_parse_file(tgen_t *tgen, char *filename, int depth)
+{
+  tgen_lex_t lex;
+  char *text;
+  size_t size;
+
+  if (tgen_file_map(filename, &text, &size) == -1) return -1;
+
+  tgen_lex_init(&lex, text, text + size, 1);
+  lex.filename = filename;
+  lex.depth = depth;
+  tgen_parse_all(tgen, &lex);
+
+  tgen_file_unmap(text, size);
+
+  return lex.errors;
+}  /* tgen_parse_file */
+
+
+/*
+ * Run-time functions.
+ */
+
+
+/* Wall-clock ns for a tick count read during the current send step. */
+uint64_t tgen_stamp_ns(tgen_t *tgen, uint64_t ticks)
+{
+  if (ticks >= tgen->stamp_base_ticks) {
+    return tgen->stamp_base_ns + cprt_ticks_to_ns(ticks - tgen->stamp_base_ticks);
+  }
+  return tgen->stamp_base_ns - cprt_ticks_to_ns(tgen->stamp_base_ticks - ticks);
+}  /* tgen_stamp_ns */
+
+
+/* Take the next buffer from the payload ring and stamp and fill it for
+ * seq tgen->payload_seq (the caller advances the seq). */
+char *tgen_buf_next(tgen_t *tgen, int len)
+{
+  char *buf;
+
+  if (len > tgen->buf_size) {
+    tgen_bufs_alloc(tgen, len);  /* Not sized in advance (e.g. REPL). */
+  }
+  buf = &tgen->bufs[tgen->buf_index * tgen->buf_stride];
+  tgen->buf_index = (tgen->buf_index + 1) & (TGEN_BUF_RING - 1);
+  if (tgen->stamp_on) {
+    tgen_stamp_t stamp;
+
+    stamp.stream = (uint32_t)tgen->payload_stream;
+    stamp.seq = tgen->payload_seq;
+    stamp.sched_ns = tgen_stamp_ns(tgen, (tgen->stamp_pace != NULL)
+        ? tgen_pace_sched_next(tgen->stamp_pace) : tgen->stamp_sched_ticks);
+    stamp.send_ns = tgen_stamp_ns(tgen, tgen->stamp_send_ticks);
+    tgen_stamp_write(buf, len, &stamp);
+    if (tgen->payload_mode == TGEN_PAYLOAD_PATTERN && len > TGEN_STAMP_SIZE) {
+      tgen_payload_fill(&buf[TGEN_STAMP_SIZE], len - TGEN_STAMP_SIZE,
+          tgen->payload_stream, tgen->payload_seq);
+    }
+  }
+  else if (tgen->payload_mode == TGEN_PAYLOAD_PATTERN) {
+    tgen_payload_fill(buf, len, tgen->payload_stream, tgen->payload_seq);
+  }
+
+  return buf;
+}  /* tgen_buf_next */
+
+
+/* Call my_send() (or the batch callback if "count" > 1, or the buffer
+ * callback with the next payload buffer). With
+ * TGEN_FLAGS_SEND_HIST, every send_hist_sample'th call is timed into
+ * the step's histogram (not including the payload fill). */
+void tgen_send1(tgen_t *tgen, int len, int count)
+{
+  uint64_t before_ticks = 0;
+  uint64_t after_ticks;
+  char *buf = NULL;
+  int timed = 0;
+
+  if (count == 1 && tgen->send_buf_cb != NULL) {
+    buf = tgen_buf_next(tgen, len);
+  }
+
+  if ((tgen->flags & TGEN_FLAGS_SEND_HIST) && --tgen->send_hist_countdown <= 0) {
+    tgen->send_hist_countdown = tgen->send_hist_sample;
+    timed = 1;
+    CPRT_GETTICKS(before_ticks);
+  }
+
+  if (count > 1) {
+    (*tgen->send_batch_cb)(tgen, len, count);
+  }
+  else if (buf != NULL) {
+    (*tgen->send_buf_cb)(tgen, buf, len);
+    tgen->payload_seq++;
+  }
+  else {
+    my_send(tgen, len);
+  }
+
+  if (timed) {
+    CPRT_GETTICKS(after_ticks);
+    tgen_hist_record(tgen->step_send_hist, cprt_ticks_to_ns(after_ticks - before_ticks));
+  }
+}  /* tgen_send1 */
+
+
+/* Let the buffers callback finish with all of the payload buffers. */
+void tgen_send_bufs_flush(tgen_t *tgen)
+{
+  if (tgen->send_bufs_cb != NULL && ! (tgen->flags & TGEN_FLAGS_TST1)) {
+    (*tgen->send_bufs_cb)(tgen, tgen->send_bufs_data, NULL, NULL, 0);
+  }
+}  /* tgen_send_bufs_flush */
+
+
+/* Send "count" messages with the buffers callback, up to
+ * TGEN_SEND_BUFS_MAX per call. The lens are picked before any buffer is
+ * filled so that growing the ring can't move buffers already filled. */
+void tgen_send_bufs(tgen_t *tgen, int len, int count)
+{
+  char *bufs[TGEN_SEND_BUFS_MAX];
+  int lens[TGEN_SEND_BUFS_MAX];
+  uint64_t before_ticks = 0;
+  uint64_t after_ticks;
+  int num;
+  int max_len;
+  int timed;
+  int i;
+
+  while (count > 0) {
+    num = (count < TGEN_SEND_BUFS_MAX) ? count : TGEN_SEND_BUFS_MAX;
+    max_len = len;
+    for (i = 0; i < num; i++) {
+      lens[i] = len;
+      if (tgen->sizes != NULL) {
+        lens[i] = tgen_sizes_sample(tgen->sizes, tgen->rng);
+        if (lens[i] > max_len) max_len = lens[i];
+      }
+      tgen->counters->bytes += lens[i];
+    }
+    if (max_len > tgen->buf_size) {
+      tgen_send_bufs_flush(tgen);
+      tgen_bufs_alloc(tgen, max_len);
+    }
+    for (i = 0; i < num; i++) {
+      bufs[i] = tgen_buf_next(tgen, lens[i]);
+      tgen->payload_seq++;
+    }
+
+    timed = 0;
+    if ((tgen->flags & TGEN_FLAGS_SEND_HIST) && --tgen->send_hist_countdown <= 0) {
+      tgen->send_hist_countdown = tgen->send_hist_sample;
+      timed = 1;
+      CPRT_GETTICKS(before_ticks);
+    }
+
+    (*tgen->send_bufs_cb)(tgen, tgen->send_bufs_data, bufs, lens, num);
+
+    if (timed) {
+      CPRT_GETTICKS(after_ticks);
+      tgen_hist_record(tgen->step_send_hist, cprt_ticks_to_ns(after_ticks - before_ticks));
+    }
+
+    tgen->counters->msgs += num;
+    count -= num;
+  }
+}  /* tgen_send_bufs */
+
+
+/* Send "count" messages. If more than one is due and the application
+ * registered a batch callback, hand them all off in one call. With a
+ * size distribution, each message gets its own len, so the batch
+ * callback (which takes a single len) is not used. */
+void tgen_send_msgs(tgen_t *tgen, int len, int count)
+{
+  int i;
+
+  if (tgen->send_bufs_cb != NULL) {
+    tgen_send_bufs(tgen, len, count);
+    return;
+  }
+
+  if (tgen->sizes != NULL) {
+    for (i = 0; i < count; i++) {
+      int msg_len = tgen_sizes_sample(tgen->sizes, tgen->rng);
+      tgen_send1(tgen, msg_len, 1);
+      tgen->counters->bytes += msg_len;
+    }
+    tgen->counters->msgs += count;
+    return;
+  }
+
+  if (count > 1 && tgen->send_batch_cb != NULL && tgen->send_buf_cb == NULL) {
+    tgen_send1(tgen, len, count);
+  }
+  else {
+    for (i = 0; i < count; i++) {
+      tgen_send1(tgen, len, 1);
+    }
+  }
+  tgen->counters->bytes += (uint64_t)len * count;
+  tgen->counters->msgs += count;
+}  /* tgen_send_msgs */
+
+
+/* A send loop found "num_due" msgs due, the first one "late_ticks" ago.
+ * Plain stores; the reporter thread only reads. */
+void tgen_behind_record(tgen_t *tgen, uint64_t late_ticks, uint64_t num_due)
+{
+  tgen->counters->behind_ticks += late_ticks;
+  if (num_due > 1) {
+    tgen->counters->catchup_bursts++;
+  }
+}  /* tgen_behind_record */
+
+
+/* Start of a send step: clear the step's histograms, and tie the tick
+ * clock to the wall clock for stamping. */
+void tgen_step_begin(tgen_t *tgen)
+{
+  if (tgen->stamp_on) {
+    tgen->stamp_base_ns = cprt_realtime_ns();
+    CPRT_GETTICKS(tgen->stamp_base_ticks);
+  }
+  if (tgen->flags & TGEN_FLAGS_SEND_HIST) {
+    tgen_hist_reset(tgen->step_send_hist);
+  }
+  if (tgen->flags & TGEN_FLAGS_GAP_HIST) {
+    tgen_hist_reset(tgen->step_gap_hist);
+    tgen->gap_prev_valid = 0;
+    tgen->gaps_over_2x = 0;
+    tgen->gaps_over_10x = 0;
+  }
+}  /* tgen_step_begin */
+
+
+/* End of a send step: merge the step's send histogram into the
+ * instance's. */
+void tgen_step_end(tgen_t *tgen)
+{
+  if (tgen->flags & TGEN_FLAGS_SEND_HIST) {
+    tgen_hist_merge(tgen->send_hist, tgen->step_send_hist);
+  }
+}  /* tgen_step_end */
+
+
+/* TGEN_FLAGS_GAP_HIST: "num_due" messages are being sent at
+ * "send_ticks" (the time the pacing loop already read). Record the gap
+ * since the previous send, plus a 0 gap for each extra message sent
+ * back-to-back. "interval_ticks" is the target (mean) gap. */
+void tgen_gap_record(tgen_t *tgen, uint64_t send_ticks, uint64_t num_due, uint64_t interval_ticks)
+{
+  if (tgen->gap_prev_valid) {
+    uint64_t gap_ticks = send_ticks - tgen->gap_prev_ticks;
+
+    tgen_hist_record(tgen->step_gap_hist, cprt_ticks_to_ns(gap_ticks));
+    if (gap_ticks > 2 * interval_ticks) {
+      tgen->gaps_over_2x++;
+      if (gap_ticks > 10 * interval_ticks) {
+        tgen->gaps_over_10x++;
+      }
+    }
+  }
+  tgen_hist_record_n(tgen->step_gap_hist, 0, num_due - 1);
+
+  tgen->gap_prev_ticks = send_ticks;
+  tgen->gap_prev_valid = 1;
+}  /* tgen_gap_record */
+
+
+/* Append ", <name> p50=... p99=... p99.9=... max=..." to a
+ * TGEN_FLAGS_PRINT_RATE line. */
+void tgen_hist_print(char *name, tgen_hist_t *hist)
+{
+  printf(", %s p50=%" PRIu64 " p99=%" PRIu64 " p99.9=%" PRIu64 " max=%" PRIu64,
+      name, tgen_hist_percentile(hist, 50.0), tgen_hist_percentile(hist, 99.0),
+      tgen_hist_percentile(hist, 99.9), hist->max);
+}  /* tgen_hist_print */
+
+
+/* Append send call times to a TGEN_FLAGS_PRINT_RATE line. */
+void tgen_send_hist_print(tgen_t *tgen, tgen_hist_t *hist)
+{
+  if (tgen->flags & TGEN_FLAGS_SEND_HIST) {
+    tgen_hist_print("send_ns", hist);
+  }
+}  /* tgen_send_hist_print */
+
+
+/* Append the step's gaps between sends to a TGEN_FLAGS_PRINT_RATE line. */
+void tgen_gap_hist_print(tgen_t *tgen)
+{
+  if (tgen->flags & TGEN_FLAGS_GAP_HIST) {
+    tgen_hist_print("gap_ns", tgen->step_gap_hist);
+    printf(" over2x=%" PRIu64 " over10x=%" PRIu64, tgen->gaps_over_2x, tgen->gaps_over_10x);
+  }
+}  /* tgen_gap_hist_print */
+
+
+/* With TGEN_FLAGS_HYBRID_SLEEP, if "deadline_ticks" is far enough in the
+ * future, sleep until shortly before it. The caller's busy loop spins the
+ * rest of the way. */
+void tgen_hybrid_sleep(tgen_t *tgen, uint64_t cur_ticks, uint64_t deadline_ticks)
+{
+  struct cprt_timespec wake_ts;
+  uint64_t wait_ns;
+
+  if (! (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP)) return;
+  if (deadline_ticks <= cur_ticks) return;
+  wait_ns = cprt_ticks_to_ns(deadline_ticks - cur_ticks);
+  if (wait_ns < tgen->sleep_threshold_ns) return;
+
+  /* Ticks might not be on the CPRT_GETTIME clock, so the absolute wakeup
+   * time is computed from a fresh reading of it. */
+  wait_ns -= tgen->sleep_spin_ns;
+  CPRT_GETTIME(&wake_ts);
+  wake_ts.tv_sec += (time_t)(wait_ns / 1000000000);
+  wake_ts.tv_nsec += (long)(wait_ns % 1000000000);
+  if (wake_ts.tv_nsec >= 1000000000) {
+    wake_ts.tv_sec++;
+    wake_ts.tv_nsec -= 1000000000;
+  }
+  cprt_sleep_until(&wake_ts);
+
+  tgen->slept_ns += wait_ns;
+}  /* tgen_hybrid_sleep */
+
+
+/* Convert a duration to ticks, saturating instead of overflowing. */
+uint64_t tgen_usec_to_ticks(uint64_t usec)
+{
+  uint64_t secs = usec / 1000000;
+
+  if (secs > ((uint64_t)-1 - cprt_ticks_per_sec) / cprt_ticks_per_sec) {
+    return (uint64_t)-1;
+  }
+  return secs * cprt_ticks_per_sec
+      + ((usec % 1000000) * cprt_ticks_per_sec) / 1000000;
+}  /* tgen_usec_to_ticks */
+
+
+/* Add a duration to a tick count, saturating instead of overflowing. */
+uint64_t tgen_ticks_add(uint64_t ticks, uint64_t duration_ticks)
+{
+  if (duration_ticks > (uint64_t)-1 - ticks) {
+    return (uint64_t)-1;
+  }
+  return ticks + duration_ticks;
+}  /* tgen_ticks_add */
+
+
+/* Actual rate in msgs/sec for printing. Uses floating point since
+ * num_sent * 1000000 can overflow on long runs. */
+uint64_t tgen_actual_rate(uint64_t num_sent, uint64_t ticks)
+{
+  uint64_t usec = cprt_ticks_to_ns(ticks) / 1000;
+
+  if (usec == 0) {
+    usec = 1;
+  }
+  return (uint64_t)(((double)num_sent * 1000000.0) / (double)usec);
+}  /* tgen_actual_rate */
+
+
+/* Advance the xorshift128+ state "rng" and return 64 random bits. */
+uint64_t tgen_rng_next(uint64_t *rng)
+{
+  uint64_t s1 = rng[0];
+  uint64_t s0 = rng[1];
+
+  rng[0] = s0;
+  s1 ^= s1 << 23;
+  rng[1] = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
+
+  return rng[1] + s0;
+}  /* tgen_rng_next */
+
+
+/* Return a random number in (0, 1] from the xorshift128+ state "rng". */
+double tgen_rng_uniform(uint64_t *rng)
+{
+  /* Top 53 bits, plus 1 so it can't be 0. */
+  return (double)((tgen_rng_next(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}  /* tgen_rng_uniform */
+
+
+/* Pick a message len from "sizes". Both kinds scale the top 32 random
+ * bits by multiplying instead of dividing. */
+int tgen_sizes_sample(tgen_sizes_t *sizes, uint64_t *rng)
+{
+  uint64_t r = tgen_rng_next(rng);
+  int slot;
+
+  if (sizes->kind == TGEN_SIZES_UNIFORM) {
+    uint64_t range = (uint64_t)(sizes->max_len - sizes->min_len) + 1;
+    return sizes->min_len + (int)(((r >> 32) * range) >> 32);
+  }
+
+  slot = (int)(((r >> 32) * (uint64_t)sizes->num_lens) >> 32);
+  if ((r & 0xffffffff) < sizes->cutoffs[slot]) {
+    return sizes->lens[slot];
+  }
+  return sizes->lens[sizes->aliases[slot]];
+}  /* tgen_sizes_sample */
+
+
+/* Fill the gap block with random gaps (in ticks) whose mean is the
+ * current interval. */
+void tgen_pace_gaps_fill(tgen_pace_t *pace)
+{
+  double mean = (double)pace->interval + (double)pace->interval_frac / 4294967296.0;
+  double alpha = (double)pace->arrival_param / 100.0;
+  double gap = mean;
+  double total;
+  int i;
+
+  for (i = 0; i < TGEN_GAP_BLOCK; i++) {
+    double u = tgen_rng_uniform(pace->rng);
+
+    switch (pace->arrival_dist) {
+    case TGEN_ARRIVAL_POISSON:
+      gap = -log(u) * mean;
+      break;
+    case TGEN_ARRIVAL_UNIFORM:
+      gap = mean * (1.0 + (pace->arrival_param / 100.0) * (2.0 * u - 1.0));
+      break;
+    case TGEN_ARRIVAL_PARETO:
+      /* Scale x_m chosen so the mean is "mean". */
+      gap = (mean * (alpha - 1.0) / alpha) / pow(u, 1.0 / alpha);
+      if (gap > mean * TGEN_GAP_MAX_MEANS) {
+        gap = mean * TGEN_GAP_MAX_MEANS;  /* Keeps the deadline in range. */
+      }
+      break;
+    }  /* switch */
+
+    /* Carry the rounding error so the mean stays exact. */
+    total = gap + pace->gap_carry;
+    pace->gaps[i] = (uint64_t)total;
+    pace->gap_carry = total - (double)pace->gaps[i];
+  }
+  pace->gap_index = 0;
+}  /* tgen_pace_gaps_fill */
+
+
+/* Set the interval between messages for "rate" msgs/sec. This is where
+ * all of the pacing division is done. */
+void tgen_pace_interval_set(tgen_pace_t *pace, uint64_t rate)
+{
+  CPRT_ASSERT(rate > 0);
+  if (rate > 0xffffffff) {
+    rate = 0xffffffff;  /* Keeps the fraction calculation below in range. */
+  }
+
+  pace->interval = cprt_ticks_per_sec / rate;
+  pace->interval_frac = ((cprt_ticks_per_sec % rate) << 32) / rate;
+
+  /* With a token bucket "param" deep, the deadline may lag the current
+   * time by up to "param - 1" intervals. */
+  pace->window = 0;
+  if (pace->catchup_policy == TGEN_CATCHUP_TOKEN) {
+    uint64_t slots = pace->catchup_param - 1;
+    pace->window = slots * pace->interval
+        + (slots >> 32) * pace->interval_frac
+        + (((slots & 0xffffffff) * pace->interval_frac) >> 32);
+  }
+
+  /* Random gaps for the old rate are discarded. */
+  pace->gap_index = TGEN_GAP_BLOCK;
+}  /* tgen_pace_interval_set */
+
+
+/* Set up pacing at "rate" msgs/sec with the first msg due at
+ * "start_ticks". */
+void tgen_pace_init(tgen_t *tgen, tgen_pace_t *pace, uint64_t rate, uint64_t start_ticks)
+{
+  pace->deadline = start_ticks;
+  pace->deadline_frac = 0;
+  pace->catchup_policy = tgen->catchup_policy;
+  pace->catchup_param = tgen->catchup_param;
+  pace->arrival_dist = tgen->arrival_dist;
+  pace->arrival_param = tgen->arrival_param;
+  pace->gaps = NULL;
+  pace->gap_carry = 0.0;
+  pace->rng = tgen->rng;
+  if (pace->arrival_dist != TGEN_ARRIVAL_EVEN) {
+    if (tgen->gaps == NULL) {
+      CPRT_ENULL(tgen->gaps = (uint64_t *)malloc(TGEN_GAP_BLOCK * sizeof(uint64_t)));
+    }
+    pace->gaps = tgen->gaps;
+  }
+  tgen_pace_interval_set(pace, rate);
+}  /* tgen_pace_init */
+
+
+/* Change the rate mid-send. The next message is rescheduled to be one
+ * new interval after the previous one. */
+void tgen_pace_rate_set(tgen_pace_t *pace, uint64_t rate)
+{
+  uint64_t old_interval = pace->interval;
+  uint64_t old_interval_frac = pace->interval_frac;
+  uint64_t frac;
+
+  tgen_pace_interval_set(pace, rate);
+
+  /* deadline - old_interval + interval, borrowing 1 to keep the
+   * fraction non-negative. */
+  frac = pace->deadline_frac + pace->interval_frac
+      + ((uint64_t)1 << 32) - old_interval_frac;
+  pace->deadline = pace->deadline - old_interval - 1
+      + pace->interval + (frac >> 32);
+  pace->deadline_frac = frac & 0xffffffff;
+}  /* tgen_pace_rate_set */
+
+
+/* Move the deadline forward by "num" intervals. */
+void tgen_pace_advance(tgen_pace_t *pace, uint64_t num)
+{
+  uint64_t frac;
+
+  if (pace->gaps != NULL) {
+    /* Random inter-arrival gaps (whole ticks). */
+    while (num > 0) {
+      if (pace->gap_index == TGEN_GAP_BLOCK) {
+        tgen_pace_gaps_fill(pace);
+      }
+      pace->deadline += pace->gaps[pace->gap_index++];
+      num--;
+    }
+    return;
+  }
+
+  if (num == 1) {
+    frac = pace->deadline_frac + pace->interval_frac;
+    pace->deadline += pace->interval + (frac >> 32);
+  }
+  else {
+    /* num * interval_frac, split so it can't overflow. */
+    frac = pace->deadline_frac + (num & 0xffffffff) * pace->interval_frac;
+    pace->deadline += num * pace->interval
+        + (num >> 32) * pace->interval_frac + (frac >> 32);
+  }
+  pace->deadline_frac = frac & 0xffffffff;
+}  /* tgen_pace_advance */
+
+
+/* Whole intervals from the deadline to "cur_ticks" (at least one
+ * interval later), in one division of the 32.32 values. */
+uint64_t tgen_pace_slots_behind(tgen_pace_t *pace, uint64_t cur_ticks)
+{
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 behind = (((unsigned __int128)(cur_ticks - pace->deadline)) << 32)
+      - pace->deadline_frac;
+  unsigned __int128 interval = (((unsigned __int128)pace->interval) << 32)
+      + pace->interval_frac;
+
+  return (uint64_t)(behind / interval);
+#else
+  /* A double is within a slot or two for any real stall; round down so
+   * the caller only has to finish with single steps. */
+  double behind = (double)(cur_ticks - pace->deadline)
+      - (double)pace->deadline_frac / 4294967296.0;
+  double interval = (double)pace->interval + (double)pace->interval_frac / 4294967296.0;
+  uint64_t slots = (uint64_t)(behind / interval);
+
+  return (slots > 2) ? slots - 2 : 0;
+#endif
+}  /* tgen_pace_slots_behind */
+
+
+/* Return the number of messages (up to "max_due") to send now, applying
+ * the catch-up policy, and move the deadline past them. */
+uint64_t tgen_pace_due(tgen_pace_t *pace, uint64_t cur_ticks, uint64_t max_due)
+{
+  uint64_t num_due = 0;
+
+  if (cur_ticks < pace->deadline) {
+    return 0;
+  }
+
+  switch (pace->catchup_policy) {
+  case TGEN_CATCHUP_BURST:
+    if (max_due > pace->catchup_param) {
+      max_due = pace->catchup_param;
+    }
+    break;
+
+  case TGEN_CATCHUP_SKIP:
+    /* Send only the msg for the slot we are in; drop the ones before it. */
+    if (max_due > 1) {
+      max_due = 1;
+    }
+    if (pace->gaps != NULL) {
+      /* Random arrivals have no phase to keep; send now and draw the
+       * next gap from here. */
+      pace->deadline = cur_ticks;
+      pace->deadline_frac = 0;
+    }
+    else if (cur_ticks - pace->deadline > pace->interval) {
+      /* Behind by at least a slot; move to the slot we are in. (The
+       * loop is only for a non-exact tgen_pace_slots_behind().) */
+      tgen_pace_advance(pace, tgen_pace_slots_behind(pace, cur_ticks));
+      while (pace->deadline + pace->interval
+          + ((pace->deadline_frac + pace->interval_frac) >> 32) <= cur_ticks) {
+        tgen_pace_advance(pace, 1);
+      }
+    }
+    break;
+
+  case TGEN_CATCHUP_TOKEN:
+    if (cur_ticks - pace->deadline > pace->window) {
+      pace->deadline = cur_ticks - pace->window;
+      pace->deadline_frac = 0;
+    }
+    break;
+  }  /* switch */
+
+  /* Remember where these msgs start for tgen_pace_sched_next(). A call
+   * doesn't go past the end of the random gaps, so that they are all
+   * still there for it. */
+  if (pace->gaps != NULL && pace->gap_index == TGEN_GAP_BLOCK) {
+    tgen_pace_gaps_fill(pace);
+  }
+  pace->sched = pace->deadline;
+  pace->sched_frac = pace->deadline_frac;
+  pace->sched_gap_index = pace->gap_index;
+  while (num_due < max_due && pace->deadline <= cur_ticks) {
+    tgen_pace_advance(pace, 1);
+    num_due++;
+    if (pace->gaps != NULL && pace->gap_index == TGEN_GAP_BLOCK) {
+      break;  /* The rest are due on the next call. */
+    }
+  }
+
+  return num_due;
+}  /* tgen_pace_due */
+
+
+/* Return when the next of the msgs from the last tgen_pace_due() was
+ * due, so that each msg of a catch-up gets its own scheduled time. */
+uint64_t tgen_pace_sched_next(tgen_pace_t *pace)
+{
+  uint64_t sched = pace->sched;
+  uint64_t frac;
+
+  if (pace->gaps != NULL) {
+    pace->sched += pace->gaps[pace->sched_gap_index++];
+  }
+  else {
+    frac = pace->sched_frac + pace->interval_frac;
+    pace->sched += pace->interval + (frac >> 32);
+    pace->sched_frac = frac & 0xffffffff;
+  }
+
+  return sched;
+}  /* tgen_pace_sched_next */
+
+
+void tgen_run_sendt(tgen_t *tgen, int len, uint64_t rate, uint64_t duration_usec)
+{
+  uint64_t duration_ticks = tgen_usec_to_ticks(duration_usec);
+  tgen_pace_t pace;
+  uint64_t cur_ticks;
+  uint64_t start_ticks;
+  uint64_t end_ticks;
+  uint64_t num_sent;
+  uint64_t start_bytes = tgen->counters->bytes;
+  uint64_t start_slept_ns = tgen->slept_ns;
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "sendt, %d %" PRIu64 " %" PRIu64 "\n", len, rate, duration_usec);
+    return;
+  }
+
+  /* Send messages evenly-spaced using busy looping. Each message has an
+   * absolute deadline; see http://www.geeky-boy.com/catchup/html/ for
+   * why falling behind needs a catch-up policy. */
+  tgen_step_begin(tgen);
+  CPRT_GETTICKS(start_ticks);
+  end_ticks = tgen_ticks_add(start_ticks, duration_ticks);
+  tgen_pace_init(tgen, &pace, rate, start_ticks);
+  tgen->stamp_pace = &pace;
+  cur_ticks = start_ticks;
+  num_sent = 0;
+  do {  /* while cur_ticks < end_ticks */
+    if (cur_ticks >= pace.deadline) {
+      uint64_t late_ticks = cur_ticks - pace.deadline;
+      uint64_t num_due;
+
+      tgen->stamp_send_ticks = cur_ticks;
+      num_due = tgen_pace_due(&pace, cur_ticks, (uint64_t)-1);
+      tgen_behind_record(tgen, late_ticks, num_due);
+      if (tgen->flags & TGEN_FLAGS_GAP_HIST) {
+        tgen_gap_record(tgen, cur_ticks, num_due, pace.interval);
+      }
+      tgen_send_msgs(tgen, len, (int)num_due);
+
+      num_sent += num_due;
+    }
+    CPRT_GETTICKS(cur_ticks);
+
+    if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+      tgen_hybrid_sleep(tgen, cur_ticks,
+          (pace.deadline < end_ticks) ? pace.deadline : end_ticks);
+    }
+  } while (cur_ticks < end_ticks);
+  tgen->stamp_pace = NULL;
+
+  tgen_step_end(tgen);
+  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+    printf("sendt len=%d rate=%" PRIu64 " duration_usec=%" PRIu64
+        ", actual rate=%" PRIu64 ", actual msgs=%" PRIu64 ", actual bytes=%" PRIu64,
+        len, rate, duration_usec,
+        tgen_actual_rate(num_sent, cur_ticks - start_ticks),
+        num_sent, tgen->counters->bytes - start_bytes);
+    if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+      printf(", slept_usec=%" PRIu64, (tgen->slept_ns - start_slept_ns) / 1000);
+    }
+    tgen_send_hist_print(tgen, tgen->step_send_hist);
+    tgen_gap_hist_print(tgen);
+    printf("\n");
+  }
+}  /* tgen_run_sendt */
+
+
+void tgen_run_sendc(tgen_t *tgen, int len, uint64_t rate, uint64_t num_msgs)
+{
+  tgen_pace_t pace;
+  uint64_t cur_ticks;
+  uint64_t start_ticks;
+  uint64_t num_sent;
+  uint64_t start_bytes = tgen->counters->bytes;
+  uint64_t start_slept_ns = tgen->slept_ns;
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "sendc, %d %" PRIu64 " %" PRIu64 "\n", len, rate, num_msgs);
+    return;
+  }
+
+  /* Send messages evenly-spaced using busy looping. Each message has an
+   * absolute deadline; see http://www.geeky-boy.com/catchup/html/ for
+   * why falling behind needs a catch-up policy. */
+  tgen_step_begin(tgen);
+  CPRT_GETTICKS(start_ticks);
+  tgen_pace_init(tgen, &pace, rate, start_ticks);
+  tgen->stamp_pace = &pace;
+  cur_ticks = start_ticks;
+  num_sent = 0;
+  while (num_sent < num_msgs) {
+    if (cur_ticks >= pace.deadline) {
+      uint64_t late_ticks = cur_ticks - pace.deadline;
+      uint64_t num_due;
+
+      tgen->stamp_send_ticks = cur_ticks;
+      num_due = tgen_pace_due(&pace, cur_ticks, num_msgs - num_sent);
+      tgen_behind_record(tgen, late_ticks, num_due);
+      if (tgen->flags & TGEN_FLAGS_GAP_HIST) {
+        tgen_gap_record(tgen, cur_ticks, num_due, pace.interval);
+      }
+      tgen_send_msgs(tgen, len, (int)num_due);
+
+      num_sent += num_due;
+    }
+    CPRT_GETTICKS(cur_ticks);
+
+    if ((tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) && num_sent < num_msgs) {
+      tgen_hybrid_sleep(tgen, cur_ticks, pace.deadline);
+    }
+  }  /* while num_sent < num_msgs */
+  tgen->stamp_pace = NULL;
+
+  tgen_step_end(tgen);
+  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+    printf("sendc len=%d rate=%" PRIu64 " num_msgs=%" PRIu64 ", actual rate=%" PRIu64
+        ", actual bytes=%" PRIu64,
+        len, rate, num_msgs,
+        tgen_actual_rate(num_sent, cur_ticks - start_ticks),
+        tgen->counters->bytes - start_bytes);
+    if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+      printf(", slept_usec=%" PRIu64, (tgen->slept_ns - start_slept_ns) / 1000);
+    }
+    tgen_send_hist_print(tgen, tgen->step_send_hist);
+    tgen_gap_hist_print(tgen);
+    printf("\n");
+  }
+}  /* tgen_run_sendc */
+
+
+/* Rate for ramp update number "update_num", at the middle of its
+ * period. Never less than 1 msg/sec. */
+uint64_t tgen_ramp_rate(uint64_t start_rate, uint64_t end_rate, int update_num)
+{
+  double rate = (double)start_rate + ((double)end_rate - (double)start_rate)
+      * ((double)update_num + 0.5) / (double)TGEN_RAMP_UPDATES;
+
+  return (rate < 1.0) ? 1 : (uint64_t)rate;
+}  /* tgen_ramp_rate */
+
+
+void tgen_run_ramp(tgen_t *tgen, int len, uint64_t start_rate, uint64_t end_rate, uint64_t duration_usec)
+{
+  uint64_t duration_ticks = tgen_usec_to_ticks(duration_usec);
+  uint64_t slice_msgs[TGEN_RAMP_SLICES + 1];  /* Msgs sent at slice start. */
+  uint64_t slice_ticks[TGEN_RAMP_SLICES + 1];  /* Tick at slice start. */
+  tgen_pace_t pace;
+  uint64_t update_ticks;
+  uint64_t next_update_ticks;
+  uint64_t cur_ticks;
+  uint64_t start_ticks;
+  uint64_t end_ticks;
+  uint64_t num_sent;
+  uint64_t start_bytes = tgen->counters->bytes;
+  uint64_t start_slept_ns = tgen->slept_ns;
+  int update_num;
+  int slice_num;  /* Slices whose start has been recorded. */
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "ramp, %d %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+        len, start_rate, end_rate, duration_usec);
+    return;
+  }
+
+  /* Same pacing as sendt, but the rate is changed TGEN_RAMP_UPDATES
+   * times, evenly spaced across the duration. */
+  update_ticks = duration_ticks / TGEN_RAMP_UPDATES;
+  if (update_ticks == 0) {
+    update_ticks = 1;
+  }
+  tgen_step_begin(tgen);
+  CPRT_GETTICKS(start_ticks);
+  end_ticks = tgen_ticks_add(start_ticks, duration_ticks);
+  update_num = 0;
+  next_update_ticks = start_ticks + update_ticks;
+  tgen_pace_init(tgen, &pace, tgen_ramp_rate(start_rate, end_rate, 0), start_ticks);
+  tgen->stamp_pace = &pace;
+  slice_msgs[0] = 0;
+  slice_ticks[0] = start_ticks;
+  slice_num = 1;
+  cur_ticks = start_ticks;
+  num_sent = 0;
+  do {  /* while cur_ticks < end_ticks */
+    if (cur_ticks >= pace.deadline) {
+      uint64_t late_ticks = cur_ticks - pace.deadline;
+      uint64_t num_due;
+
+      tgen->stamp_send_ticks = cur_ticks;
+      num_due = tgen_pace_due(&pace, cur_ticks, (uint64_t)-1);
+      tgen_behind_record(tgen, late_ticks, num_due);
+      if (tgen->flags & TGEN_FLAGS_GAP_HIST) {
+        tgen_gap_record(tgen, cur_ticks, num_due, pace.interval);
+      }
+      tgen_send_msgs(tgen, len, (int)num_due);
+
+      num_sent += num_due;
+    }
+    CPRT_GETTICKS(cur_ticks);
+
+    while (cur_ticks >= next_update_ticks && update_num < TGEN_RAMP_UPDATES - 1) {
+      update_num++;
+      if (update_num % (TGEN_RAMP_UPDATES / TGEN_RAMP_SLICES) == 0) {
+        slice_num = update_num / (TGEN_RAMP_UPDATES / TGEN_RAMP_SLICES);
+        slice_msgs[slice_num] = num_sent;
+        slice_ticks[slice_num] = cur_ticks;
+        slice_num++;
+      }
+      tgen_pace_rate_set(&pace, tgen_ramp_rate(start_rate, end_rate, update_num));
+      next_update_ticks += update_ticks;
+    }
+
+    if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+      uint64_t wake_ticks = (pace.deadline < end_ticks) ? pace.deadline : end_ticks;
+      tgen_hybrid_sleep(tgen, cur_ticks,
+          (next_update_ticks < wake_ticks) ? next_update_ticks : wake_ticks);
+    }
+  } while (cur_ticks < end_ticks);
+  tgen->stamp_pace = NULL;
+  /* A ramp shorter than TGEN_RAMP_UPDATES ticks ends before its last
+   * slices start; those are empty (rate 0). */
+  while (slice_num <= TGEN_RAMP_SLICES) {
+    slice_msgs[slice_num] = num_sent;
+    slice_ticks[slice_num] = cur_ticks;
+    slice_num++;
+  }
+
+  tgen_step_end(tgen);
+  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+    int slice;
+
+    printf("ramp len=%d start_rate=%" PRIu64 " end_rate=%" PRIu64 " duration_usec=%" PRIu64
+        ", actual msgs=%" PRIu64 ", actual bytes=%" PRIu64,
+        len, start_rate, end_rate, duration_usec, num_sent,
+        tgen->counters->bytes - start_bytes);
+    if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+      printf(", slept_usec=%" PRIu64, (tgen->slept_ns - start_slept_ns) / 1000);
+    }
+    tgen_send_hist_print(tgen, tgen->step_send_hist);
+    tgen_gap_hist_print(tgen);
+    printf("\n");
+    for (slice = 0; slice < TGEN_RAMP_SLICES; slice++) {
+      /* Target is the ramp's rate at the middle of the slice. */
+      uint64_t target_rate = tgen_ramp_rate(start_rate, end_rate,
+          slice * (TGEN_RAMP_UPDATES / TGEN_RAMP_SLICES) + TGEN_RAMP_UPDATES / TGEN_RAMP_SLICES / 2);
+      printf("ramp slice %d: target rate=%" PRIu64 ", actual rate=%" PRIu64 "\n",
+          slice, target_rate,
+          tgen_actual_rate(slice_msgs[slice + 1] - slice_msgs[slice],
+              slice_ticks[slice + 1] - slice_ticks[slice]));
+    }
+  }
+}  /* tgen_run_ramp */
+
+
+/* Send "burst_msgs" back-to-back at the start of every "period_usec"
+ * for "duration_usec". */
+void tgen_run_burst(tgen_t *tgen, int len, uint64_t burst_msgs, uint64_t period_usec, uint64_t duration_usec)
+{
+  uint64_t duration_ticks = tgen_usec_to_ticks(duration_usec);
+  uint64_t period_ticks = tgen_usec_to_ticks(period_usec);  /* For lateness. */
+  uint64_t burst_ticks;
+  uint64_t cur_ticks;
+  uint64_t start_ticks;
+  uint64_t end_ticks;
+  uint64_t num_bursts;
+  uint64_t num_late;
+  uint64_t start_bytes = tgen->counters->bytes;
+  uint64_t start_slept_ns = tgen->slept_ns;
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "burst, %d %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+        len, burst_msgs, period_usec, duration_usec);
+    return;
+  }
+
+  if (period_ticks == 0) {
+    period_ticks = 1;
+  }
+
+  /* Burst start times are absolute (start + n * period, converted to
+   * ticks from usec each time), so they don't drift. Within a burst the
+   * clock is not read at all. A burst that starts after the next one
+   * was due is counted as late, and the following burst starts
+   * immediately. */
+  tgen_step_begin(tgen);
+  CPRT_GETTICKS(start_ticks);
+  end_ticks = tgen_ticks_add(start_ticks, duration_ticks);
+  burst_ticks = start_ticks;
+  cur_ticks = start_ticks;
+  num_bursts = 0;
+  num_late = 0;
+  while (burst_ticks < end_ticks) {
+    uint64_t num_left = burst_msgs;
+
+    while (cur_ticks < burst_ticks) {
+      if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+        tgen_hybrid_sleep(tgen, cur_ticks, burst_ticks);
+      }
+      CPRT_GETTICKS(cur_ticks);
+    }
+    tgen->counters->behind_ticks += cur_ticks - burst_ticks;
+    tgen->stamp_sched_ticks = burst_ticks;
+    tgen->stamp_send_ticks = cur_ticks;
+    if (cur_ticks - burst_ticks >= period_ticks) {
+      num_late++;
+      tgen->counters->catchup_bursts++;
+    }
+
+    while (num_left > 0) {
+      int count = (num_left > 0x7fffffff) ? 0x7fffffff : (int)num_left;
+      tgen_send_msgs(tgen, len, count);
+      num_left -= count;
+    }
+    num_bursts++;
+
+    burst_ticks = tgen_ticks_add(start_ticks, tgen_usec_to_ticks(num_bursts * period_usec));
+    CPRT_GETTICKS(cur_ticks);
+  }  /* while burst_ticks < end_ticks */
+
+  /* Like sendt, take the full duration. */
+  while (cur_ticks < end_ticks) {
+    if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+      tgen_hybrid_sleep(tgen, cur_ticks, end_ticks);
+    }
+    CPRT_GETTICKS(cur_ticks);
+  }
+
+  tgen_step_end(tgen);
+  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+    printf("burst len=%d burst_msgs=%" PRIu64 " period_usec=%" PRIu64 " duration_usec=%" PRIu64
+        ", actual bursts=%" PRIu64 ", late bursts=%" PRIu64
+        ", actual msgs=%" PRIu64 ", actual bytes=%" PRIu64,
+        len, burst_msgs, period_usec, duration_usec,
+        num_bursts, num_late, num_bursts * burst_msgs,
+        tgen->counters->bytes - start_bytes);
+    if (tgen->flags & TGEN_FLAGS_HYBRID_SLEEP) {
+      printf(", slept_usec=%" PRIu64, (tgen->slept_ns - start_slept_ns) / 1000);
+    }
+    tgen_send_hist_print(tgen, tgen->step_send_hist);
+    printf("\n");
+  }
+}  /* tgen_run_burst */
+
+
+/* Thread block entry point: pin, wait at the start barrier, run. */
+CPRT_THREAD_ENTRYPOINT tgen_thread_main(void *in_arg)
+{
+  tgen_t *tgen = (tgen_t *)in_arg;
+  tgen_t *parent = tgen->parent;
+  tgen_thread_t *thread = &parent->threads[tgen->thread_num];
+
+  if (thread->cpu >= 0) {
+    cprt_set_affinity((uint64_t)1 << thread->cpu);
+  }
+
+  (void)CPRT_ATOMIC_INC_VAL(&parent->threads_ready);
+  while (*(volatile long *)&parent->threads_go == 0) {
+  }
+
+  tgen_run(tgen);
+  CPRT_GETTICKS(thread->done_ticks);
+
+  return 0;
+}  /* tgen_thread_main */
+
+
+/* Start thread block "thread_num". It waits at the start barrier
+ * until the next join. */
+void tgen_run_thread(tgen_t *tgen, int thread_num)
+{
+  tgen_thread_t *thread;
+
+  CPRT_ASSERT(thread_num >= 0 && thread_num < TGEN_MAX_THREADS);
+  CPRT_ASSERT(tgen->threads != NULL && tgen->threads[thread_num].tgen != NULL);
+  thread = &tgen->threads[thread_num];
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "thread, %d %d\n", thread_num, thread->cpu);
+  }
+
+  if (thread->running) {
+    fprintf(stderr, "Error: thread %d already running\n", thread_num);
+    CPRT_ERR_EXIT;
+  }
+
+  thread->tgen->pc = 0;
+  if (thread->tgen->send_hist != NULL) {
+    tgen_hist_reset(thread->tgen->send_hist);  /* Per run of the thread. */
+  }
+  thread->start_msgs = thread->tgen->counters->msgs;
+  thread->start_bytes = thread->tgen->counters->bytes;
+  thread->running = 1;
+  tgen_run_prepare(thread->tgen);  /* Not after the start barrier. */
+  CPRT_THREAD_CREATE(thread->thread_id, tgen_thread_main, thread->tgen);
+}  /* tgen_run_thread */
+
+
+/* Return the number of threads started and not yet joined. */
+int tgen_threads_running(tgen_t *tgen)
+{
+  int num_running = 0;
+  int thread_num;
+
+  if (tgen->threads != NULL) {
+    for (thread_num = 0; thread_num < TGEN_MAX_THREADS; thread_num++) {
+      num_running += tgen->threads[thread_num].running;
+    }
+  }
+
+  return num_running;
+}  /* tgen_threads_running */
+
+
+/* Release the threads started since the last join from the start
+ * barrier, wait for them to finish, and combine their results. */
+void tgen_run_join(tgen_t *tgen)
+{
+  uint64_t go_ticks;
+  uint64_t total_msgs = 0;
+  uint64_t total_bytes = 0;
+  uint64_t max_ticks = 0;
+  int num_running = tgen_threads_running(tgen);
+  int thread_num;
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "join, %d\n", num_running);
+  }
+  if (num_running == 0) return;
+
+  /* Wait until every thread is pinned and spinning, then start them
+   * all at once. */
+  while (*(volatile long *)&tgen->threads_ready < num_running) {
+    CPRT_SLEEP_MS(1);
+  }
+  CPRT_GETTICKS(go_ticks);
+  (void)CPRT_ATOMIC_INC_VAL(&tgen->threads_go);
+
+  for (thread_num = 0; thread_num < TGEN_MAX_THREADS; thread_num++) {
+    tgen_thread_t *thread = &tgen->threads[thread_num];
+    uint64_t msgs;
+    uint64_t bytes;
+    uint64_t ticks;
+
+    if (! thread->running) continue;
+    CPRT_THREAD_JOIN(thread->thread_id);
+    thread->running = 0;
+
+    msgs = thread->tgen->counters->msgs - thread->start_msgs;
+    bytes = thread->tgen->counters->bytes - thread->start_bytes;
+    ticks = thread->done_ticks - go_ticks;
+    total_msgs += msgs;
+    total_bytes += bytes;
+    if (ticks > max_ticks) {
+      max_ticks = ticks;
+    }
+
+    if (tgen->flags & TGEN_FLAGS_SEND_HIST) {
+      tgen_hist_merge(tgen->send_hist, thread->tgen->send_hist);
+    }
+
+    if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+      printf("thread %d cpu %d, actual rate=%" PRIu64 ", actual msgs=%" PRIu64
+          ", actual bytes=%" PRIu64,
+          thread_num, thread->cpu, tgen_actual_rate(msgs, ticks), msgs, bytes);
+      tgen_send_hist_print(tgen, thread->tgen->send_hist);
+      printf("\n");
+    }
+  }
+  tgen->threads_ready = 0;
+  tgen->threads_go = 0;
+
+  tgen->joined_msgs += total_msgs;
+  tgen->joined_bytes += total_bytes;
+  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+    printf("join threads=%d, actual rate=%" PRIu64 ", actual msgs=%" PRIu64
+        ", actual bytes=%" PRIu64,
+        num_running, tgen_actual_rate(total_msgs, max_ticks), total_msgs, total_bytes);
+    /* All threads (and earlier steps) combined. */
+    tgen_send_hist_print(tgen, tgen->send_hist);
+    printf("\n");
+  }
+}  /* tgen_run_join */
+
+
+/* Wait until a wall-clock (CLOCK_REALTIME) time, so that processes
+ * (or hosts, given synchronized clocks) can start together. */
+void tgen_run_at(tgen_t *tgen, int mode, uint64_t time_usec)
+{
+  uint64_t start_ns;
+  uint64_t now_ns;
+
+  CPRT_ASSERT(mode == TGEN_AT_ABSOLUTE || mode == TGEN_AT_NEXT);
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "at, %d %" PRIu64 "\n", mode, time_usec);
+    return;
+  }
+
+  now_ns = cprt_realtime_ns();
+  if (mode == TGEN_AT_NEXT) {
+    uint64_t period_ns = time_usec * 1000;
+    start_ns = (now_ns / period_ns + 1) * period_ns;
+  }
+  else {
+    start_ns = time_usec * 1000;
+  }
+
+  /* Sleep most of the way on the CPRT_GETTIME clock, then spin on the
+   * wall clock. */
+  if (start_ns > now_ns + (uint64_t)TGEN_AT_SPIN_USEC * 1000) {
+    struct cprt_timespec wake_ts;
+    uint64_t wait_ns = start_ns - now_ns - (uint64_t)TGEN_AT_SPIN_USEC * 1000;
+
+    CPRT_GETTIME(&wake_ts);
+    wake_ts.tv_sec += (time_t)(wait_ns / 1000000000);
+    wake_ts.tv_nsec += (long)(wait_ns % 1000000000);
+    if (wake_ts.tv_nsec >= 1000000000) {
+      wake_ts.tv_sec++;
+      wake_ts.tv_nsec -= 1000000000;
+    }
+    cprt_sleep_until(&wake_ts);
+  }
+  do {
+    now_ns = cprt_realtime_ns();
+  } while (now_ns < start_ns);
+
+  tgen->start_skew_ns = (int64_t)(now_ns - start_ns);
+  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+    printf("at start_usec=%" PRIu64 ", skew_ns=%" PRId64 "\n",
+        start_ns / 1000, tgen->start_skew_ns);
+  }
+}  /* tgen_run_at */
+
+
+/* Wait until "num_procs" processes (or threads) have reached a sync
+ * with the same "name", then release them all. The barrier is a
+ * shared memory segment named "/tgen_<name>". Waiters left in it by a
+ * killed run (their first arrival is gone, or too old, or they wanted
+ * a different num_procs) are discarded by the next arrival. */
+void tgen_run_sync(tgen_t *tgen, char *name, int num_procs)
+{
+  char shm_name[TGEN_MAX_KEYWORD+7];
+  tgen_sync_shm_t *shm;
+  long generation;
+  uint64_t now_ns;
+  uint64_t timeout_ns = (uint64_t)TGEN_SYNC_TIMEOUT_USEC * 1000;
+
+  CPRT_ASSERT(strlen(name) <= TGEN_MAX_KEYWORD && num_procs >= 1);
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "sync, %s %d\n", name, num_procs);
+    return;
+  }
+
+  snprintf(shm_name, sizeof(shm_name), "/tgen_%s", name);
+  shm = (tgen_sync_shm_t *)cprt_shm_map(shm_name, sizeof(tgen_sync_shm_t));
+
+  now_ns = cprt_realtime_ns();
+  while (! CPRT_ATOMIC_CAS(&shm->lock, 0, 1)) {
+    if (cprt_realtime_ns() - now_ns > timeout_ns) {
+      fprintf(stderr, "Error: sync %s: segment stays locked; remove /dev/shm/tgen_%s\n", name, name);
+      CPRT_ERR_EXIT;
+    }
+  }
+  now_ns = cprt_realtime_ns();
+  if (shm->count > 0 && (shm->num_procs != num_procs
+      || now_ns - shm->first_ns > timeout_ns || ! cprt_pid_alive(shm->first_pid)))
+  {
+    fprintf(stderr, "Warning: sync %s: discarding %ld stale waiter(s)\n", name, shm->count);
+    shm->count = 0;
+  }
+  if (shm->count == 0) {
+    shm->num_procs = num_procs;
+    shm->first_pid = cprt_getpid();
+    shm->first_ns = now_ns;
+  }
+  generation = shm->generation;
+  if (++shm->count >= num_procs) {
+    /* Last to arrive. Unlink first so that the next sync with this
+     * name (e.g. in a loop) gets a fresh segment, then release. */
+    cprt_shm_unlink(shm_name);
+    shm->count = 0;
+    shm->release_ns = now_ns;
+    (void)CPRT_ATOMIC_INC_VAL(&shm->generation);
+    (void)CPRT_ATOMIC_DEC_VAL(&shm->lock);
+  }
+  else {
+    (void)CPRT_ATOMIC_DEC_VAL(&shm->lock);
+    while (*(volatile long *)&shm->generation == generation) {
+      if (cprt_realtime_ns() - now_ns > timeout_ns) {
+        fprintf(stderr, "Error: sync %s: timed out waiting for %d processes\n", name, num_procs);
+        cprt_shm_unlink(shm_name);
+        CPRT_ERR_EXIT;
+      }
+    }
+    now_ns = cprt_realtime_ns();
+  }
+
+  tgen->start_skew_ns = (int64_t)(now_ns - shm->release_ns);
+  cprt_shm_unmap(shm, sizeof(tgen_sync_shm_t));
+
+  if (tgen->flags & TGEN_FLAGS_PRINT_RATE) {
+    printf("sync name=%s procs=%d, skew_ns=%" PRId64 "\n",
+        name, num_procs, tgen->start_skew_ns);
+  }
+}  /* tgen_run_sync */
+
+
+/* Reporter thread state. The send loop never touches this; the reporter
+ * only reads the instances' counters. */
+struct tgen_report_s {
+  FILE *fp;
+  int format;  /* TGEN_REPORT_... */
+  uint64_t interval_ticks;
+  uint64_t start_ticks;
+  uint64_t prev_ticks;
+  long stop;  /* Set by tgen_report_stop(). */
+  CPRT_THREAD_T thread_id;
+  tgen_counters_t prev[TGEN_MAX_THREADS + 2];  /* Instances, then total. */
+};
+typedef struct tgen_report_s tgen_report_t;
+
+
+/* Copy an instance's counters. Each is a single aligned 64-bit load, so
+ * a value might be one update stale but is never torn. */
+void tgen_counters_read(tgen_counters_t *dst, tgen_counters_t *src)
+{
+  volatile tgen_counters_t *vsrc = (volatile tgen_counters_t *)src;
+
+  dst->msgs = vsrc->msgs;
+  dst->bytes = vsrc->bytes;
+  dst->catchup_bursts = vsrc->catchup_bursts;
+  dst->behind_ticks = vsrc->behind_ticks;
+}  /* tgen_counters_read */
+
+
+/* Write one row (or JSON object) for "label". Rates are since the
+ * previous sample. */
+void tgen_report_row(tgen_report_t *report, uint64_t elapsed_ms, char *label,
+    tgen_counters_t *cur, tgen_counters_t *prev, uint64_t ticks)
+{
+  uint64_t msgs_per_sec = tgen_actual_rate(cur->msgs - prev->msgs, ticks);
+  uint64_t bytes_per_sec = tgen_actual_rate(cur->bytes - prev->bytes, ticks);
+  uint64_t behind_ns = cprt_ticks_to_ns(cur->behind_ticks);
+
+  if (report->format == TGEN_REPORT_CSV) {
+    fprintf(report->fp, "%" PRIu64 ",%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+        ",%" PRIu64 ",%" PRIu64 "\n",
+        elapsed_ms, label, cur->msgs, cur->bytes, msgs_per_sec, bytes_per_sec,
+        cur->catchup_bursts, behind_ns);
+  }
+  else {
+    fprintf(report->fp, "{\"elapsed_ms\":%" PRIu64 ",\"thread\":\"%s\",\"msgs\":%" PRIu64
+        ",\"bytes\":%" PRIu64 ",\"msgs_per_sec\":%" PRIu64 ",\"bytes_per_sec\":%" PRIu64
+        ",\"catchup_bursts\":%" PRIu64 ",\"behind_ns\":%" PRIu64 "}\n",
+        elapsed_ms, label, cur->msgs, cur->bytes, msgs_per_sec, bytes_per_sec,
+        cur->catchup_bursts, behind_ns);
+  }
+}  /* tgen_report_row */
+
+
+/* Sample "tgen" and its thread blocks: one row each ("main" for a
+ * top-level "tgen"), then a "total" row. */
+void tgen_report_sample(tgen_t *tgen, tgen_report_t *report)
+{
+  tgen_counters_t cur;
+  tgen_counters_t total;
+  uint64_t cur_ticks;
+  uint64_t ticks;
+  uint64_t elapsed_ms;
+  char label[16];
+  int thread_num;
+
+  CPRT_GETTICKS(cur_ticks);
+  ticks = cur_ticks - report->prev_ticks;
+  elapsed_ms = cprt_ticks_to_ns(cur_ticks - report->start_ticks) / 1000000;
+
+  tgen_counters_read(&cur, tgen->counters);
+  total = cur;
+  if (tgen->thread_num >= 0) {
+    snprintf(label, sizeof(label), "%d", tgen->thread_num);
+  }
+  else {
+    strcpy(label, "main");
+  }
+  tgen_report_row(report, elapsed_ms, label, &cur, &report->prev[0], ticks);
+  report->prev[0] = cur;
+
+  if (tgen->threads != NULL) {
+    for (thread_num = 0; thread_num < TGEN_MAX_THREADS; thread_num++) {
+      tgen_t *child = tgen->threads[thread_num].tgen;
+      if (child == NULL) continue;
+
+      tgen_counters_read(&cur, child->counters);
+      total.msgs += cur.msgs;
+      total.bytes += cur.bytes;
+      total.catchup_bursts += cur.catchup_bursts;
+      total.behind_ticks += cur.behind_ticks;
+      snprintf(label, sizeof(label), "%d", thread_num);
+      tgen_report_row(report, elapsed_ms, label, &cur, &report->prev[thread_num + 1], ticks);
+      report->prev[thread_num + 1] = cur;
+    }
+  }
+
+  tgen_report_row(report, elapsed_ms, "total", &total, &report->prev[TGEN_MAX_THREADS + 1], ticks);
+  report->prev[TGEN_MAX_THREADS + 1] = total;
+  report->prev_ticks = cur_ticks;
+  fflush(report->fp);
+}  /* tgen_report_sample */
+
+
+/* Reporter thread: sample every interval (on an absolute schedule so it
+ * doesn't drift), sleeping in short chunks so that a stop is noticed
+ * promptly. */
+CPRT_THREAD_ENTRYPOINT tgen_report_main(void *in_arg)
+{
+  tgen_t *tgen = (tgen_t *)in_arg;
+  tgen_report_t *report = tgen->report;
+  uint64_t next_ticks = report->start_ticks;
+  uint64_t cur_ticks;
+
+  while (*(volatile long *)&report->stop == 0) {
+    next_ticks = tgen_ticks_add(next_ticks, report->interval_ticks);
+    CPRT_GETTICKS(cur_ticks);
+    while (cur_ticks < next_ticks && *(volatile long *)&report->stop == 0) {
+      uint64_t wait_ms = cprt_ticks_to_ns(next_ticks - cur_ticks) / 1000000;
+      if (wait_ms > TGEN_REPORT_CHUNK_MS) {
+        wait_ms = TGEN_REPORT_CHUNK_MS;
+      }
+      CPRT_SLEEP_MS((int)wait_ms + 1);
+      CPRT_GETTICKS(cur_ticks);
+    }
+    if (*(volatile long *)&report->stop == 0) {
+      tgen_report_sample(tgen, report);
+    }
+  }
+
+  return 0;
+}  /* tgen_report_main */
+
+
+void tgen_run_report(tgen_t *tgen, char *filename, int format, uint64_t interval_usec)
+{
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    if (format == 0) {
+      fprintf(stderr, "report, stop\n");
+    }
+    else {
+      fprintf(stderr, "report, %d %" PRIu64 " %s\n", format, interval_usec, filename);
+    }
+    return;
+  }
+
+  tgen_report_stop(tgen);
+  if (format != 0) {
+    tgen_report_start(tgen, filename, format, interval_usec);
+  }
+}  /* tgen_run_report */
+
+
+void tgen_run_set(tgen_t *tgen, int variable_index, int value)
+{
+  tgen->variables[variable_index] = value;
+  my_variable_change(tgen, variable_index + 'a', value);
+}  /* tgen_run_set */
+
+
+void tgen_run_loop(tgen_t *tgen, int variable_index, int label_index)
+{
+  if (tgen->script->labels[label_index] == -1) {
+    fprintf(stderr, "tgen_run_loop: unknown label: %c\n", ('a' + label_index));
+    CPRT_ERR_EXIT;
+  }
+  if (tgen->variables[variable_index] > 0) {
+    tgen->variables[variable_index] --;
+    my_variable_change(tgen, variable_index + 'a', tgen->variables[variable_index]);
+  }
+
+  if (tgen->variables[variable_index] > 0) {
+    tgen->pc = tgen->script->labels[label_index];
+  }
+}  /* tgen_run_loop */
+
+
+void tgen_run_delay(tgen_t *tgen, uint64_t duration_usec)
+{
+  uint64_t duration_ticks = tgen_usec_to_ticks(duration_usec);
+  uint64_t cur_ticks;
+  uint64_t start_ticks;
+
+  CPRT_GETTICKS(start_ticks);
+  tgen_hybrid_sleep(tgen, 0, duration_ticks);
+  do {  /* while */
+    CPRT_GETTICKS(cur_ticks);
+  } while (cur_ticks - start_ticks < duration_ticks);
+}  /* tgen_run_set */
+
+
+void tgen_run_catchup(tgen_t *tgen, int policy, int param)
+{
+  CPRT_ASSERT(policy == TGEN_CATCHUP_BURST || policy == TGEN_CATCHUP_SKIP
+      || policy == TGEN_CATCHUP_TOKEN);
+  CPRT_ASSERT(policy == TGEN_CATCHUP_SKIP || param >= 1);
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "catchup, %d %d\n", policy, param);
+  }
+
+  tgen->catchup_policy = policy;
+  tgen->catchup_param = param;
+}  /* tgen_run_catchup */
+
+
+void tgen_run_arrival(tgen_t *tgen, int dist, int param)
+{
+  CPRT_ASSERT(dist >= TGEN_ARRIVAL_EVEN && dist <= TGEN_ARRIVAL_PARETO);
+  CPRT_ASSERT(dist != TGEN_ARRIVAL_UNIFORM || (param >= 1 && param <= 100));
+  CPRT_ASSERT(dist != TGEN_ARRIVAL_PARETO || param > 100);
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "arrival, %d %d\n", dist, param);
+  }
+
+  tgen->arrival_dist = dist;
+  tgen->arrival_param = param;
+}  /* tgen_run_arrival */
+
+
+void tgen_run_size(tgen_t *tgen, tgen_sizes_t *sizes)
+{
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    if (sizes == NULL) {
+      fprintf(stderr, "size, fixed\n");
+    }
+    else {
+      fprintf(stderr, "size, %d %d %d %d\n",
+          sizes->kind, sizes->num_lens, sizes->min_len, sizes->max_len);
+    }
+  }
+
+  tgen->sizes = sizes;
+}  /* tgen_run_size */
+
+
+void tgen_run_payload(tgen_t *tgen, int mode, uint64_t stream)
+{
+  CPRT_ASSERT(mode == TGEN_PAYLOAD_NONE || mode == TGEN_PAYLOAD_PATTERN);
+
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "payload, %d %" PRIu64 "\n", mode, stream);
+  }
+  else if (mode != TGEN_PAYLOAD_NONE && tgen->send_buf_cb == NULL && tgen->send_bufs_cb == NULL) {
+    fprintf(stderr, "Error: payload pattern needs a buffer send callback (see tgen_send_buf_set() or tgen_send_bufs_set())\n");
+    CPRT_ERR_EXIT;
+  }
+
+  tgen->payload_mode = mode;
+  tgen->payload_stream = stream;
+}  /* tgen_run_payload */
+
+
+/* Turn stamping on ("on" = 1) for stream "stream", or off. The stream
+ * is the one "payload pattern" uses too (a receiver verifies the pattern
+ * with the header's stream). */
+void tgen_run_stamp(tgen_t *tgen, int on, uint64_t stream)
+{
+  if (tgen->flags & TGEN_FLAGS_TST1) {
+    fprintf(stderr, "stamp, %d %" PRIu64 "\n", on, stream);
+  }
+  else if (on && tgen->send_buf_cb == NULL && tgen->send_bufs_cb == NULL) {
+    fprintf(stderr, "Error: stamp needs a buffer send callback (see tgen_send_buf_set() or tgen_send_bufs_set())\n");
+    CPRT_ERR_EXIT;
+  }
+
+  tgen->stamp_on = on;
+  if (on) {
+    tgen->payload_stream = stream;
+  }
+}  /* tgen_run_stamp */
+
+
+void tgen_run_repl(tgen_t *tgen)
+{
+  char iline[TGEN_MAX_LINE+1];
+  tgen_step_t my_step;
+  tgen_lex_t lex;
+  int line_num = 1;
+
+  printf("repl? "); fflush(stdout);
+  while (fgets(iline, TGEN_MAX_LINE, stdin)) {
+    /* Errors are reported and the line skipped. */
+    tgen_lex_init(&lex, iline, iline + strlen(iline), line_num++);
+    while (lex.cur < lex.end) {
+      if (tgen_parse_step(tgen, &lex, &my_step) > 0) {
+        tgen_run1(tgen, &my_step);
+        if (my_step.opcode == TGEN_OPCODE_REPORT && my_step.str != NULL) {
+          free(my_step.str);
+        }
+      }
+      tgen_lex_next_stmt(&lex);
+    }
+    printf("repl? "); fflush(stdout);
+  }
+}  /* tgen_run_set */
+
+
+void tgen_run1(tgen_t *tgen, tgen_step_t *step)
+{
+  switch (step->opcode) {
+  case TGEN_OPCODE_SENDT: tgen_run_sendt(tgen, step->len, step->rate, step->duration_usec); break;
+  case TGEN_OPCODE_SENDC: tgen_run_sendc(tgen, step->len, step->rate, step->num_msgs); break;
+  case TGEN_OPCODE_SET: tgen_run_set(tgen, step->variable_index, step->value); break;
+  case TGEN_OPCODE_LOOP: tgen_run_loop(tgen, step->variable_index, step->label_index); break;
+  case TGEN_OPCODE_DELAY: tgen_run_delay(tgen, step->duration_usec); break;
+  case TGEN_OPCODE_REPL: tgen_run_repl(tgen); break;
+  case TGEN_OPCODE_CATCHUP: tgen_run_catchup(tgen, step->mode, step->value); break;
+  case TGEN_OPCODE_RAMP: tgen_run_ramp(tgen, step->len, step->rate, step->end_rate, step->duration_usec); break;
+  case TGEN_OPCODE_ARRIVAL: tgen_run_arrival(tgen, step->mode, step->value); break;
+  case TGEN_OPCODE_SIZE: tgen_run_size(tgen, step->sizes); break;
+  case TGEN_OPCODE_BURST: tgen_run_burst(tgen, step->len, step->num_msgs, step->period_usec, step->duration_usec); break;
+  case TGEN_OPCODE_THREAD: tgen_run_thread(tgen, step->value); break;
+  case TGEN_OPCODE_JOIN: tgen_run_join(tgen); break;
+  case TGEN_OPCODE_AT: tgen_run_at(tgen, step->mode, step->duration_usec); break;
+  case TGEN_OPCODE_SYNC: tgen_run_sync(tgen, step->name, step->value); break;
+  case TGEN_OPCODE_REPORT: tgen_run_report(tgen, step->str, step->mode, step->duration_usec); break;
+  case TGEN_OPCODE_PAYLOAD: tgen_run_payload(tgen, step->mode, step->value); break;
+  case TGEN_OPCODE_STAMP: tgen_run_stamp(tgen, step->mode, step->value); break;
+  default:
+    fprintf(stderr, "tgen_run1: unknown opcode: %d\n", step->opcode);
+    CPRT_ERR_EXIT;
+  }  /* switch */
+}  /* tgen_run1 */
+
+
+/* A script that had parse errors is missing those statements, so it is
+ * never run, even if the caller ignored the error count. */
+void tgen_parse_errors_check(tgen_t *tgen)
+{
+  if (tgen->parse_errors > 0) {
+    fprintf(stderr, "Error: not running a script with %d error(s)\n", tgen->parse_errors);
+    CPRT_ERR_EXIT;
+  }
+}  /* tgen_parse_errors_check */
+
+
+/* Check every step of the script, resolve each loop's label to the
+ * arena offset it jumps to, and end the script with an END record, so
+ * that none of it is done while running. tgen_run() calls this when the
+ * script has changed. */
+void tgen_compile(tgen_t *tgen)
+{
+  tgen_script_t *script = tgen->script;
+  tgen_rec_t *rec;
+  tgen_rec_t *end;
+
+  tgen_parse_errors_check(tgen);
+
+  tgen_script_reserve(script, sizeof(tgen_rec_t));  /* For the END. */
+  end = (tgen_rec_t *)(script->arena + script->size);
+
+  for (rec = (tgen_rec_t *)script->arena; rec < end; rec = TGEN_REC_NEXT(rec)) {
+    if (rec->opcode < 1 || rec->opcode > TGEN_OPCODE_MAX) {
+      fprintf(stderr, "tgen_compile: unknown opcode: %d\n", rec->opcode);
+      CPRT_ERR_EXIT;
+    }
+
+    switch (rec->opcode) {
+    case TGEN_OPCODE_LOOP:
+      if (script->labels[rec->mode] == -1) {
+        if (script->loop_where[rec->mode] != NULL) {
+          fprintf(stderr, "Error: loop to unknown label: %c%s", ('a' + rec->mode), script->loop_where[rec->mode]);
+          free(script->loop_where[rec->mode]);
+          script->loop_where[rec->mode] = NULL;  /* Report each label once. */
+        }
+        tgen->parse_errors++;
+        break;
+      }
+      rec->value = script->labels[rec->mode];
+      break;
+    case TGEN_OPCODE_THREAD:
+      if (tgen->threads == NULL || tgen->threads[rec->value].tgen == NULL) {
+        fprintf(stderr, "Error: thread %d is not defined\n", rec->value);
+        CPRT_ERR_EXIT;
+      }
+      break;
+    }
+  }
+  tgen_parse_errors_check(tgen);  /* Unknown labels. */
+
+  memset(end, 0, sizeof(tgen_rec_t));
+  end->opcode = TGEN_OPCODE_END;
+
+  tgen->code_steps = script->num_steps;
+}  /* tgen_compile */
+
+
+/* Execute the compiled script from tgen->pc, in place in the arena.
+ * With GCC or clang, each handler ends by jumping straight to the next
+ * record's handler, looked up by its opcode (token threading), so a
+ * step costs one indirect branch. Otherwise it is a switch in a loop.
+ * Sends, "set" and "loop" are decoded here; the rest are rare, and
+ * are unpacked for tgen_run1(), with tgen->pc at the next record. */
+#if defined(__GNUC__)
+#define TGEN_OP(name_) tgen_op_##name_
+#define TGEN_NEXT() goto *handlers[rec->opcode]
+#else
+#define TGEN_OP(name_) case TGEN_OPCODE_##name_
+#define TGEN_NEXT() continue
+#endif
+
+void tgen_exec(tgen_t *tgen)
+{
+  char *arena = tgen->script->arena;
+  tgen_rec_t *rec = (tgen_rec_t *)(arena + tgen->pc);
+  tgen_step_t step;
+  uint64_t *words;
+  int var;
+
+#if defined(__GNUC__)
+  static const void *handlers[TGEN_OPCODE_MAX + 1] = {
+    &&TGEN_OP(END), &&TGEN_OP(SENDT), &&TGEN_OP(SENDC), &&TGEN_OP(SET),
+    &&TGEN_OP(LOOP), &&TGEN_OP(OTHER), &&TGEN_OP(OTHER), &&TGEN_OP(OTHER),
+    &&TGEN_OP(OTHER), &&TGEN_OP(OTHER), &&TGEN_OP(OTHER), &&TGEN_OP(OTHER),
+    &&TGEN_OP(OTHER), &&TGEN_OP(OTHER), &&TGEN_OP(OTHER), &&TGEN_OP(OTHER),
+    &&TGEN_OP(OTHER), &&TGEN_OP(OTHER), &&TGEN_OP(OTHER)
+  };
+
+  TGEN_NEXT();
+#else
+  for (;;) {
+    switch (rec->opcode) {
+#endif
+
+  TGEN_OP(SENDT): words = TGEN_REC_WORDS(rec);
+    if (rec->words == 1) {
+      tgen_run_sendt(tgen, rec->value, words[0] & 0xffffffff, words[0] >> 32);
+    }
+    else {
+      tgen_run_sendt(tgen, rec->value, words[0], words[1]);
+    }
+    rec = TGEN_REC_NEXT(rec); TGEN_NEXT();
+  TGEN_OP(SENDC): words = TGEN_REC_WORDS(rec);
+    if (rec->words == 1) {
+      tgen_run_sendc(tgen, rec->value, words[0] & 0xffffffff, words[0] >> 32);
+    }
+    else {
+      tgen_run_sendc(tgen, rec->value, words[0], words[1]);
+    }
+    rec = TGEN_REC_NEXT(rec); TGEN_NEXT();
+  TGEN_OP(SET):
+    tgen_run_set(tgen, rec->variable_index, rec->value);
+    rec++; TGEN_NEXT();  /* No words. */
+  TGEN_OP(LOOP):
+    /* tgen_run_loop() without the label lookup. */
+    var = rec->variable_index;
+    if (tgen->variables[var] > 0) {
+      tgen->variables[var]--;
+      my_variable_change(tgen, var + 'a', tgen->variables[var]);
+    }
+    rec = (tgen->variables[var] > 0) ? (tgen_rec_t *)(arena + rec->value) : rec + 1;
+    TGEN_NEXT();
+#if defined(__GNUC__)
+  TGEN_OP(OTHER):
+#else
+  default:
+#endif
+    tgen_rec_step(rec, &step);
+    /* A "loop" typed at a "repl" prompt moves tgen->pc. */
+    tgen->pc = (int)((char *)TGEN_REC_NEXT(rec) - arena);
+    tgen_run1(tgen, &step);
+    rec = (tgen_rec_t *)(arena + tgen->pc); TGEN_NEXT();
+  TGEN_OP(END):
+#if defined(__GNUC__)
+  ;
+#else
+    break;
+    }  /* switch */
+    break;  /* Only END gets here. */
+  }  /* for */
+#endif
+
+  tgen->pc = (int)((char *)rec - arena);
+}  /* tgen_exec */
+
+
+/* Largest message len any step of the script can send. */
+int tgen_script_max_len(tgen_t *tgen)
+{
+  tgen_script_t *script = tgen->script;
+  tgen_rec_t *end = (tgen_rec_t *)(script->arena + script->size);
+  tgen_rec_t *rec;
+  int max_len = 0;
+
+  for (rec = (tgen_rec_t *)script->arena; rec < end; rec = TGEN_REC_NEXT(rec)) {
+    int len = 0;
+
+    switch (rec->opcode) {
+    case TGEN_OPCODE_SENDT:
+    case TGEN_OPCODE_SENDC:
+    case TGEN_OPCODE_RAMP:
+    case TGEN_OPCODE_BURST:
+      len = rec->value;
+      break;
+    case TGEN_OPCODE_SIZE:
+      if (TGEN_REC_WORDS(rec)[0] != 0) {
+        len = ((tgen_sizes_t *)(uintptr_t)TGEN_REC_WORDS(rec)[0])->max_len;
+      }
+      break;
+    }
+    if (len > max_len) {
+      max_len = len;
+    }
+  }
+
+  return max_len;
+}  /* tgen_script_max_len */
+
+
+/* Size and pre-fault the payload ring for the script's largest len,
+ * and let the buffers callback set up (a "count" 0 call). tgen_run_thread()
+ * calls this before starting the thread, so that a thread block doesn't
+ * do it after the start barrier. */
+void tgen_run_prepare(tgen_t *tgen)
+{
+  if ((tgen->send_buf_cb != NULL || tgen->send_bufs_cb != NULL)
+      && ! (tgen->flags & TGEN_FLAGS_TST1)) {
+    int max_len = tgen_script_max_len(tgen);
+    if (tgen->bufs == NULL || max_len > tgen->buf_size) {
+      tgen_bufs_alloc(tgen, max_len);
+    }
+  }
+  tgen_send_bufs_flush(tgen);
+}  /* tgen_run_prepare */
+
+
+void tgen_run(tgen_t *tgen)
+{
+  tgen_parse_errors_check(tgen);
+  if (tgen->parse_thread != NULL) {
+    fprintf(stderr, "Error: thread %d block has no closing '}'\n", tgen->parse_thread->thread_num);
+    CPRT_ERR_EXIT;
+  }
+
+  tgen_run_prepare(tgen);
+
+  if (tgen->code_steps != tgen->script->num_steps) {
+    tgen_compile(tgen);
+  }
+
+  tgen->state = TGEN_STATE_RUNNING;
+  if (tgen->pc < (int)tgen->script->size) {
+    tgen_exec(tgen);
+  }
+  tgen->state = TGEN_STATE_STOPPED;
+
+  tgen_send_bufs_flush(tgen);
+
+  /* Threads still running are joined at the end of the script. */
+  if (tgen_threads_running(tgen) > 0) {
+    tgen_run_join(tgen);
+  }
+  tgen_report_stop(tgen);
+}  /* tgen_run */
+
+
+/*
+ * APIs
+ */
+
+/* Allocate "size" bytes aligned to "align" (a power of 2). The pointer to free()
+ * is returned in "mem". */
+void *tgen_malloc_aligned(size_t size, size_t align, void **mem)
+{
+  uintptr_t addr;
+
+  CPRT_ENULL(*mem = malloc(size + align - 1));
+  addr = ((uintptr_t)*mem + align - 1) & ~(uintptr_t)(align - 1);
+
+  return (void *)addr;
+}  /* tgen_malloc_aligned */
+
+
+tgen_t *tgen_create(uint32_t flags, void *user_data)
+{
+  tgen_t *tgen;
+  tgen_script_t *script;
+  int i;
+
+  CPRT_INITTIME();  /* Calibrates the tick clock the first time. */
+
+  CPRT_ENULL(tgen = (tgen_t *)malloc(sizeof(tgen_t)));
+
+  CPRT_ENULL(script = (tgen_script_t *)malloc(sizeof(tgen_script_t)));
+  for (i = 0; i < 26; i++) {
+    script->labels[i] = -1;
+    script->loop_where[i] = NULL;
+  }
+  script->num_steps = 0;
+  script->size = 0;
+  script->max_size = TGEN_ARENA_INITIAL;
+  CPRT_ENULL(script->arena = (char *)malloc(script->max_size));
+
+  for (i = 0; i < 26; i++) {
+    tgen->variables[i] = 0;
+  }
+  tgen->flags = flags;
+  tgen->user_data = user_data;
+  tgen->send_batch_cb = NULL;
+  tgen->send_buf_cb = NULL;
+  tgen->send_bufs_cb = NULL;
+  tgen->send_bufs_data = NULL;
+  tgen->bufs = NULL;
+  tgen->bufs_mem = NULL;
+  tgen->buf_size = 0;
+  tgen->buf_stride = 0;
+  tgen->buf_index = 0;
+  tgen->payload_mode = TGEN_PAYLOAD_NONE;
+  tgen->payload_stream = 0;
+  tgen->payload_seq = 0;
+  tgen->stamp_on = 0;
+  tgen->stamp_base_ns = 0;
+  tgen->stamp_base_ticks = 0;
+  tgen->stamp_pace = NULL;
+  tgen->stamp_sched_ticks = 0;
+  tgen->stamp_send_ticks = 0;
+  tgen->sleep_threshold_ns = (uint64_t)TGEN_SLEEP_THRESHOLD_USEC * 1000;
+  tgen->sleep_spin_ns = (uint64_t)TGEN_SLEEP_SPIN_USEC * 1000;
+  tgen->slept_ns = 0;
+  tgen->catchup_policy = TGEN_CATCHUP_BURST;
+  tgen->catchup_param = TGEN_CATCHUP_BURST_DEFAULT;
+  tgen->arrival_dist = TGEN_ARRIVAL_EVEN;
+  tgen->arrival_param = 0;
+  tgen->gaps = NULL;
+  tgen->sizes = NULL;
+  tgen->sizes_list = NULL;
+  tgen->counters = (tgen_counters_t *)tgen_malloc_aligned(sizeof(tgen_counters_t), TGEN_CACHE_LINE, &tgen->counters_mem);
+  memset(tgen->counters, 0, sizeof(tgen_counters_t));
+  tgen->joined_msgs = 0;
+  tgen->joined_bytes = 0;
+  tgen->report = NULL;
+  tgen->thread_num = -1;
+  tgen->parent = NULL;
+  tgen->threads = NULL;
+  tgen->parse_thread = NULL;
+  tgen->parse_lines = 0;
+  tgen->parse_errors = 0;
+  tgen->threads_ready = 0;
+  tgen->threads_go = 0;
+  tgen->start_skew_ns = 0;
+  tgen->step_send_hist = NULL;
+  tgen->send_hist = NULL;
+  if (flags & TGEN_FLAGS_SEND_HIST) {
+    tgen->step_send_hist = tgen_hist_create();
+    tgen->send_hist = tgen_hist_create();
+  }
+  tgen->send_hist_sample = 1;
+  tgen->send_hist_countdown = 1;
+  tgen->step_gap_hist = NULL;
+  if (flags & TGEN_FLAGS_GAP_HIST) {
+    tgen->step_gap_hist = tgen_hist_create();
+  }
+  tgen->gap_prev_ticks = 0;
+  tgen->gap_prev_valid = 0;
+  tgen->gaps_over_2x = 0;
+  tgen->gaps_over_10x = 0;
+  tgen_seed_set(tgen, 1);
+  tgen->pc = 0;
+  tgen->script = script;
+  tgen->code_steps = -1;
+  tgen->state = TGEN_STATE_STOPPED;
+
+  return tgen;
+}  /* tgen_create */
+
+
+void tgen_delete(tgen_t *tgen)
+{
+  tgen_rec_t *rec;
+  tgen_rec_t *end;
+  int i;
+
+  tgen_report_stop(tgen);
+  if (tgen->parse_thread != NULL && tgen->parse_thread->thread_num < 0) {
+    tgen_delete(tgen->parse_thread);  /* Unclosed block of a bad header. */
+  }
+  if (tgen->threads != NULL) {
+    int thread_num;
+
+    if (tgen_threads_running(tgen) > 0) {
+      tgen_run_join(tgen);
+    }
+    for (thread_num = 0; thread_num < TGEN_MAX_THREADS; thread_num++) {
+      if (tgen->threads[thread_num].tgen != NULL) {
+        tgen_delete(tgen->threads[thread_num].tgen);
+      }
+    }
+    free(tgen->threads);
+  }
+  if (tgen->gaps != NULL) {
+    free(tgen->gaps);
+  }
+  if (tgen->send_hist != NULL) {
+    tgen_hist_delete(tgen->step_send_hist);
+    tgen_hist_delete(tgen->send_hist);
+  }
+  if (tgen->step_gap_hist != NULL) {
+    tgen_hist_delete(tgen->step_gap_hist);
+  }
+  while (tgen->sizes_list != NULL) {
+    tgen_sizes_t *sizes = tgen->sizes_list;
+    tgen->sizes_list = sizes->next;
+    if (sizes->num_lens > 0) {
+      free(sizes->lens);
+      free(sizes->cutoffs);
+      free(sizes->aliases);
+    }
+    free(sizes);
+  }
+  end = (tgen_rec_t *)(tgen->script->arena + tgen->script->size);
+  for (rec = (tgen_rec_t *)tgen->script->arena; rec < end; rec = TGEN_REC_NEXT(rec)) {
+    if (rec->opcode == TGEN_OPCODE_REPORT && TGEN_REC_WORDS(rec)[1] != 0) {
+      free((char *)(uintptr_t)TGEN_REC_WORDS(rec)[1]);
+    }
+  }
+  for (i = 0; i < 26; i++) {
+    free(tgen->script->loop_where[i]);
+  }
+  free(tgen->script->arena);
+  free(tgen->script);
+  if (tgen->bufs_mem != NULL) {
+    free(tgen->bufs_mem);
+  }
+  free(tgen->counters_mem);
+  free(tgen);
+}  /* tgen_delete */
+
+
+void *tgen_user_data_get(tgen_t *tgen)
+{
+  return tgen->user_data;
+}  /* tgen_user_data_get */
+
+
+void tgen_send_batch_set(tgen_t *tgen, tgen_send_batch_cb_t send_batch_cb)
+{
+  tgen->send_batch_cb = send_batch_cb;
+}  /* tgen_send_batch_set */
+
+
+/* Have tgen send each message by calling "send_buf_cb" with one of its
+ * own payload buffers instead of my_send() (and instead of the batch
+ * callback). The application sends directly from the buffer. */
+void tgen_send_buf_set(tgen_t *tgen, tgen_send_buf_cb_t send_buf_cb)
+{
+  tgen->send_buf_cb = send_buf_cb;
+}  /* tgen_send_buf_set */
+
+
+/* Have tgen send by calling "send_bufs_cb" with all of the messages due
+ * at once (up to TGEN_SEND_BUFS_MAX per call), each in one of its own
+ * payload buffers, instead of any of the callbacks above or my_send().
+ * Thread blocks share "cb_data" but call from their own threads. */
+void tgen_send_bufs_set(tgen_t *tgen, tgen_send_bufs_cb_t send_bufs_cb, void *cb_data)
+{
+  tgen->send_bufs_cb = send_bufs_cb;
+  tgen->send_bufs_data = cb_data;
+}  /* tgen_send_bufs_set */
+
+
+/* (Re)allocate the payload buffer ring for lens up to "max_len". Each
+ * buffer starts on a cache line, the ring on a page, and every page is
+ * written here so that the send loop never takes a page fault. tgen_run()
+ * calls this with the script's largest len. */
+void tgen_bufs_alloc(tgen_t *tgen, int max_len)
+{
+  size_t total;
+
+  CPRT_ASSERT(max_len >= 0);
+  if (tgen->bufs_mem != NULL) {
+    free(tgen->bufs_mem);
+  }
+
+  tgen->buf_size = max_len;
+  tgen->buf_stride = (max_len + TGEN_CACHE_LINE - 1) & ~(TGEN_CACHE_LINE - 1);
+  if (tgen->buf_stride == 0) {
+    tgen->buf_stride = TGEN_CACHE_LINE;
+  }
+  total = (size_t)tgen->buf_stride * TGEN_BUF_RING;
+  tgen->bufs = (char *)tgen_malloc_aligned(total, TGEN_PAGE_SIZE, &tgen->bufs_mem);
+  memset(tgen->bufs, 0, total);
+  tgen->buf_index = 0;
+}  /* tgen_bufs_alloc */
+
+
+/* During the buffer send callback, the seq the payload was filled for.
+ * Counts every message sent with the callback. */
+uint64_t tgen_payload_seq_get(tgen_t *tgen)
+{
+  return tgen->payload_seq;
+}  /* tgen_payload_seq_get */
+
+
+/* Only used with TGEN_FLAGS_HYBRID_SLEEP. Waits longer than
+ * "threshold_usec" sleep until "spin_usec" before the deadline. */
+void tgen_hybrid_sleep_set(tgen_t *tgen, int threshold_usec, int spin_usec)
+{
+  CPRT_ASSERT(threshold_usec >= spin_usec && spin_usec >= 0);
+  tgen->sleep_threshold_ns = (uint64_t)threshold_usec * 1000;
+  tgen->sleep_spin_ns = (uint64_t)spin_usec * 1000;
+}  /* tgen_hybrid_sleep_set */
+
+
+/* Seed the random number generator used for inter-arrival gaps.
+ * The same seed gives the same sequence of gaps. */
+void tgen_seed_set(tgen_t *tgen, uint64_t seed)
+{
+  int i;
+
+  /* Expand the seed with splitmix64 so the state is never all zero. */
+  for (i = 0; i < 2; i++) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    tgen->rng[i] = z ^ (z >> 31);
+  }
+}  /* tgen_seed_set */
+
+
+/* Total time spent sleeping (instead of busy looping) by this instance. */
+uint64_t tgen_slept_ns_get(tgen_t *tgen)
+{
+  return tgen->slept_ns;
+}  /* tgen_slept_ns_get */
+
+
+/* Allocate a size distribution owned by "tgen" (freed by tgen_delete). */
+tgen_sizes_t *tgen_sizes_alloc(tgen_t *tgen, int kind, int num_lens)
+{
+  tgen_sizes_t *sizes;
+
+  CPRT_ENULL(sizes = (tgen_sizes_t *)malloc(sizeof(tgen_sizes_t)));
+  sizes->kind = kind;
+  sizes->num_lens = num_lens;
+  sizes->lens = NULL;
+  sizes->cutoffs = NULL;
+  sizes->aliases = NULL;
+  if (num_lens > 0) {
+    CPRT_ENULL(sizes->lens = (int *)malloc(num_lens * sizeof(int)));
+    CPRT_ENULL(sizes->cutoffs = (uint64_t *)malloc(num_lens * sizeof(uint64_t)));
+    CPRT_ENULL(sizes->aliases = (int *)malloc(num_lens * sizeof(int)));
+  }
+
+  sizes->next = tgen->sizes_list;
+  tgen->sizes_list = sizes;
+
+  return sizes;
+}  /* tgen_sizes_alloc */
+
+
+/* Message lens from "min_len" to "max_len" inclusive, equally likely. */
+tgen_sizes_t *tgen_sizes_uniform_create(tgen_t *tgen, int min_len, int max_len)
+{
+  tgen_sizes_t *sizes;
+
+  if (min_len < 0 || min_len > max_len) {
+    fprintf(stderr, "Error: size uniform min len must not exceed max len\n");
+    CPRT_ERR_EXIT;
+  }
+
+  sizes = tgen_sizes_alloc(tgen, TGEN_SIZES_UNIFORM, 0);
+  sizes->min_len = min_len;
+  sizes->max_len = max_len;
+
+  return sizes;
+}  /* tgen_sizes_uniform_create */
+
+
+/* Message len lens[i] with probability weights[i] / sum(weights).
+ * Builds the alias table with Vose's method. */
+tgen_sizes_t *tgen_sizes_table_create(tgen_t *tgen, int num_lens, int *lens, uint64_t *weights)
+{
+  tgen_sizes_t *sizes;
+  double *scaled;
+  int *small;
+  int *large;
+  int num_small = 0;
+  int num_large = 0;
+  double total = 0.0;
+  int i;
+
+  CPRT_ASSERT(num_lens > 0);
+  for (i = 0; i < num_lens; i++) {
+    total += (double)weights[i];
+  }
+  if (total == 0.0) {
+    fprintf(stderr, "Error: size weights must not all be zero\n");
+    CPRT_ERR_EXIT;
+  }
+
+  sizes = tgen_sizes_alloc(tgen, TGEN_SIZES_TABLE, num_lens);
+  sizes->min_len = lens[0];
+  sizes->max_len = lens[0];
+  CPRT_ENULL(scaled = (double *)malloc(num_lens * sizeof(double)));
+  CPRT_ENULL(small = (int *)malloc(num_lens * sizeof(int)));
+  CPRT_ENULL(large = (int *)malloc(num_lens * sizeof(int)));
+
+  /* Scale so the average slot probability is 1. */
+  for (i = 0; i < num_lens; i++) {
+    CPRT_ASSERT(lens[i] >= 0);
+    sizes->lens[i] = lens[i];
+    if (lens[i] < sizes->min_len) sizes->min_len = lens[i];
+    if (lens[i] > sizes->max_len) sizes->max_len = lens[i];
+
+    scaled[i] = (double)weights[i] * (double)num_lens / total;
+    if (scaled[i] < 1.0) {
+      small[num_small++] = i;
+    }
+    else {
+      large[num_large++] = i;
+    }
+  }
+
+  /* Fill each under-full slot from an over-full one. */
+  while (num_small > 0 && num_large > 0) {
+    int s = small[--num_small];
+    int l = large[--num_large];
+
+    sizes->cutoffs[s] = (uint64_t)(scaled[s] * 4294967296.0);
+    sizes->aliases[s] = l;
+    scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+    if (scaled[l] < 1.0) {
+      small[num_small++] = l;
+    }
+    else {
+      large[num_large++] = l;
+    }
+  }
+
+  /* Whatever is left is full (give or take rounding error). */
+  while (num_large > 0) {
+    int l = large[--num_large];
+    sizes->cutoffs[l] = (uint64_t)1 << 32;
+    sizes->aliases[l] = l;
+  }
+  while (num_small > 0) {
+    int s = small[--num_small];
+    sizes->cutoffs[s] = (uint64_t)1 << 32;
+    sizes->aliases[s] = s;
+  }
+
+  free(scaled);
+  free(small);
+  free(large);
+
+  return sizes;
+}  /* tgen_sizes_table_create */
+
+
+/* Load an empirical size histogram. Each line of the file has a len in
+ * bytes and a weight (e.g. a count from a packet capture). Blank lines
+ * and lines starting with '#' are ignored. Reports a bad file (with the
+ * file's line number) and returns NULL instead of exiting, so the script
+ * parser can add its own location. */
+tgen_sizes_t *tgen_sizes_file_create(tgen_t *tgen, char *filename)
+{
+  char iline[TGEN_MAX_LINE+1];
+  tgen_sizes_t *sizes = NULL;
+  FILE *fp;
+  int max_lens = 64;
+  int num_lens = 0;
+  int *lens;
+  uint64_t *weights;
+  uint64_t total = 0;
+  int line_num = 0;
+  int bad = 0;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: could not open size file '%s': %s\n", filename, strerror(errno));
+    return NULL;
+  }
+
+  CPRT_ENULL(lens = (int *)malloc(max_lens * sizeof(int)));
+  CPRT_ENULL(weights = (uint64_t *)malloc(max_lens * sizeof(uint64_t)));
+  while (fgets(iline, sizeof(iline), fp)) {
+    uint64_t len;
+    int null_ofs = 0;
+
+    line_num++;
+    (void)sscanf(iline, " %n", &null_ofs);
+    if (iline[null_ofs] == '\0' || iline[null_ofs] == '#') continue;
+
+    if (num_lens == max_lens) {
+      max_lens *= 2;
+      CPRT_ENULL(lens = (int *)realloc(lens, max_lens * sizeof(int)));
+      CPRT_ENULL(weights = (uint64_t *)realloc(weights, max_lens * sizeof(uint64_t)));
+    }
+    null_ofs = 0;
+    (void)sscanf(iline, " %18" SCNu64 " %18" SCNu64 " %n",
+        &len, &weights[num_lens], &null_ofs);
+    if (null_ofs == 0 || (iline[null_ofs] != '\0' && iline[null_ofs] != '#')) {
+      fprintf(stderr, "Error: size file '%s' line %d: expected '<len> <weight>'\n",
+          filename, line_num);
+      bad = 1;
+      break;
+    }
+    if (len > 0x7fffffff) {
+      fprintf(stderr, "Error: size file '%s' line %d: len too large\n", filename, line_num);
+      bad = 1;
+      break;
+    }
+    lens[num_lens] = (int)len;
+    total |= weights[num_lens];
+    num_lens++;
+  }
+  fclose(fp);
+
+  if (! bad && num_lens == 0) {
+    fprintf(stderr, "Error: size file '%s' has no sizes\n", filename);
+    bad = 1;
+  }
+  else if (! bad && total == 0) {
+    fprintf(stderr, "Error: size file '%s' weights must not all be zero\n", filename);
+    bad = 1;
+  }
+  if (! bad) {
+    sizes = tgen_sizes_table_create(tgen, num_lens, lens, weights);
+  }
+  free(lens);
+  free(weights);
+
+  return sizes;
+}  /* tgen_sizes_file_create */
+
+
+/* Total bytes passed to my_send() (or the batch callback) so far. */
+uint64_t tgen_bytes_sent_get(tgen_t *tgen)
+{
+  return tgen->counters->bytes + tgen->joined_bytes;
+}  /* tgen_bytes_sent_get */
+
+
+uint64_t tgen_msgs_sent_get(tgen_t *tgen)
+{
+  return tgen->counters->msgs + tgen->joined_msgs;
+}  /* tgen_msgs_sent_get */
+
+
+/* Start a reporter thread that writes "tgen"'s counters (and its thread
+ * blocks') to "filename" every "interval_usec", as CSV or JSON lines.
+ * Replaces any reporter already running. */
+void tgen_report_start(tgen_t *tgen, char *filename, int format, uint64_t interval_usec)
+{
+  tgen_report_t *report;
+
+  CPRT_ASSERT(format == TGEN_REPORT_CSV || format == TGEN_REPORT_JSON);
+  tgen_report_stop(tgen);
+
+  CPRT_ENULL(report = (tgen_report_t *)malloc(sizeof(tgen_report_t)));
+  memset(report, 0, sizeof(tgen_report_t));
+  report->fp = fopen(filename, "w");
+  if (report->fp == NULL) {
+    fprintf(stderr, "Error: could not open report file '%s'\n", filename);
+    CPRT_ERR_EXIT;
+  }
+  report->format = format;
+  report->interval_ticks = tgen_usec_to_ticks(interval_usec);
+  if (report->interval_ticks == 0) {
+    report->interval_ticks = 1;
+  }
+  report->stop = 0;
+  CPRT_GETTICKS(report->start_ticks);
+  report->prev_ticks = report->start_ticks;
+  /* Rates in the first sample are from the start of reporting. */
+  tgen_counters_read(&report->prev[0], tgen->counters);
+  report->prev[TGEN_MAX_THREADS + 1] = report->prev[0];
+  if (tgen->threads != NULL) {
+    int thread_num;
+    for (thread_num = 0; thread_num < TGEN_MAX_THREADS; thread_num++) {
+      tgen_t *child = tgen->threads[thread_num].tgen;
+      if (child == NULL) continue;
+      tgen_counters_read(&report->prev[thread_num + 1], child->counters);
+      report->prev[TGEN_MAX_THREADS + 1].msgs += report->prev[thread_num + 1].msgs;
+      report->prev[TGEN_MAX_THREADS + 1].bytes += report->prev[thread_num + 1].bytes;
+    }
+  }
+
+  if (format == TGEN_REPORT_CSV) {
+    fprintf(report->fp, "elapsed_ms,thread,msgs,bytes,msgs_per_sec,bytes_per_sec,catchup_bursts,behind_ns\n");
+  }
+
+  tgen->report = report;
+  CPRT_THREAD_CREATE(report->thread_id, tgen_report_main, tgen);
+}  /* tgen_report_start */
+
+
+/* Stop the reporter thread, if any, after writing a final sample. */
+void tgen_report_stop(tgen_t *tgen)
+{
+  tgen_report_t *report = tgen->report;
+
+  if (report == NULL) return;
+
+  (void)CPRT_ATOMIC_INC_VAL(&report->stop);
+  CPRT_THREAD_JOIN(report->thread_id);
+  tgen_report_sample(tgen, report);
+
+  fclose(report->fp);
+  free(report);
+  tgen->report = NULL;
+}  /* tgen_report_stop */
+
+
+/* The instance's own counters (not including thread blocks). */
+tgen_counters_t *tgen_counters_get(tgen_t *tgen)
+{
+  return tgen->counters;
+}  /* tgen_counters_get */
+
+
+/* Define thread block "thread_num", pinned to "cpu" (-1 for not
+ * pinned). Returns its instance, to which steps are added with
+ * tgen_add_step(). It shares the parent's flags, user_data, and
+ * callbacks, and is run by tgen_run_thread(). */
+tgen_t *tgen_thread_create(tgen_t *tgen, int thread_num, int cpu)
+{
+  tgen_t *child;
+  int i;
+
+  if (thread_num < 0 || thread_num >= TGEN_MAX_THREADS) {
+    fprintf(stderr, "Error: thread number must be 0 to %d\n", TGEN_MAX_THREADS - 1);
+    CPRT_ERR_EXIT;
+  }
+  if (cpu < -1 || cpu > 63) {
+    fprintf(stderr, "Error: thread cpu must be 0 to 63\n");
+    CPRT_ERR_EXIT;
+  }
+  if (tgen->threads == NULL) {
+    CPRT_ENULL(tgen->threads = (tgen_thread_t *)malloc(TGEN_MAX_THREADS * sizeof(tgen_thread_t)));
+    for (i = 0; i < TGEN_MAX_THREADS; i++) {
+      tgen->threads[i].tgen = NULL;
+      tgen->threads[i].running = 0;
+    }
+  }
+  if (tgen->threads[thread_num].tgen != NULL) {
+    fprintf(stderr, "Error: thread %d already defined\n", thread_num);
+    CPRT_ERR_EXIT;
+  }
+
+  child = tgen_create(tgen->flags, tgen->user_data);
+  child->send_batch_cb = tgen->send_batch_cb;
+  child->send_buf_cb = tgen->send_buf_cb;
+  child->send_bufs_cb = tgen->send_bufs_cb;
+  child->send_bufs_data = tgen->send_bufs_data;
+  child->sleep_threshold_ns = tgen->sleep_threshold_ns;
+  child->sleep_spin_ns = tgen->sleep_spin_ns;
+  child->send_hist_sample = tgen->send_hist_sample;
+  child->send_hist_countdown = tgen->send_hist_sample;
+  tgen_seed_set(child, tgen->rng[0] + thread_num + 1);
+  child->thread_num = thread_num;
+  child->parent = tgen;
+
+  tgen->threads[thread_num].tgen = child;
+  tgen->threads[thread_num].cpu = cpu;
+
+  return child;
+}  /* tgen_thread_create */
+
+
+/* Thread block number, or -1 for a top-level instance. Lets my_send()
+ * tell the threads apart. */
+int tgen_thread_num_get(tgen_t *tgen)
+{
+  return tgen->thread_num;
+}  /* tgen_thread_num_get */
+
+
+/* Start skew measured by the last "at" (time after the requested start)
+ * or "sync" (time after the last process arrived). */
+int64_t tgen_start_skew_ns_get(tgen_t *tgen)
+{
+  return tgen->start_skew_ns;
+}  /* tgen_start_skew_ns_get */
+
+
+/* Only used with TGEN_FLAGS_SEND_HIST. Time every "sample_every"th
+ * my_send() call (1, the default, times them all). */
+void tgen_send_hist_set(tgen_t *tgen, int sample_every)
+{
+  CPRT_ASSERT(sample_every >= 1);
+  tgen->send_hist_sample = sample_every;
+  tgen->send_hist_countdown = sample_every;
+}  /* tgen_send_hist_set */
+
+
+/* TGEN_FLAGS_SEND_HIST: my_send() call times (ns) over all steps so
+ * far, including joined threads. NULL without the flag. */
+tgen_hist_t *tgen_send_hist_get(tgen_t *tgen)
+{
+  return tgen->send_hist;
+}  /* tgen_send_hist_get */
+
+
+/* TGEN_FLAGS_SEND_HIST: my_send() call times (ns) for the most recent
+ * send step. NULL without the flag. */
+tgen_hist_t *tgen_step_send_hist_get(tgen_t *tgen)
+{
+  return tgen->step_send_hist;
+}  /* tgen_step_send_hist_get */
+
+
+/* TGEN_FLAGS_GAP_HIST: gaps (ns) between sends for the most recent
+ * sendt, sendc, or ramp. NULL without the flag. */
+tgen_hist_t *tgen_step_gap_hist_get(tgen_t *tgen)
+{
+  return tgen->step_gap_hist;
+}  /* tgen_step_gap_hist_get */
+
+
+/* TGEN_FLAGS_GAP_HIST: number of gaps in the most recent sendt, sendc,
+ * or ramp that were more than "multiple" (2 or 10) times the target. */
+uint64_t tgen_step_gaps_over_get(tgen_t *tgen, int multiple)
+{
+  CPRT_ASSERT(multiple == 2 || multiple == 10);
+  return (multiple == 2) ? tgen->gaps_over_2x : tgen->gaps_over_10x;
+}  /* tgen_step_gaps_over_get */
+
+
+int tgen_variable_get(tgen_t *tgen, char var_id)
+{
+  CPRT_ASSERT(var_id >= 'a' && var_id <= 'z');
+  return tgen->variables[var_id - 'a'];
+}  /* tgen_variable_get */
+
+
+void tgen_variable_set(tgen_t *tgen, char var_id, int value)
+{
+  CPRT_ASSERT(var_id >= 'a' && var_id <= 'z');
+  tgen->variables[var_id - 'a'] = value;
+  my_variable_change(tgen, var_id, value);
+}  /* tgen_variable_set */
+
+
+/* Add the instruction(s) in "iline". Errors are reported on stderr with
+ * their line and column (counting lines over all the calls), and the
+ * statement is skipped. Returns the number of errors, 0 for success. */
+int tgen_add_step(tgen_t *tgen, char *iline)
+{
+  return tgen_parse_text(tgen, iline, iline + strlen(iline));
+}  /* tgen_add_step */
+
+
+/* Add a script of instructions separated by newlines or ';'. Returns the
+ * number of errors, as for tgen_add_step(). */
+int tgen_add_multi_steps(tgen_t *tgen, char *iline)
+{
+  return tgen_parse_text(tgen, iline, iline + strlen(iline));
 }  /* tgen_add_multi_steps */
+
+
+/* Add the script in file "filename". It is parsed where it's mapped
+ * (not copied), with no limit on line length. Errors are reported with
+ * the file name and line. Returns the number of errors, as for
+ * tgen_add_step(). */
+int tgen_add_script_file(tgen_t *tgen, char *filename)
+{
+  int errors;
+
+  errors = tgen_parse_file(tgen, filename, 0);
+  if (errors < 0) {
+    fprintf(stderr, "Error: could not read script file '%s': %s\n", filename, strerror(errno));
+    errors = 1;
+  }
+  tgen->parse_errors += errors;
+
+  return errors;
+}  /* tgen_add_script_file */
+
+
+/* Bytes of memory the script's steps take (not counting size tables and
+ * file names they point to). */
+size_t tgen_script_bytes_get(tgen_t *tgen)
+{
+  return tgen->script->size;
+}  /* tgen_script_bytes_get */
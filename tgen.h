@@ -15,6 +15,8 @@
 #define TGEN_H
 
 #include "cprt.h"
+#include "tgen_hist.h"
+#include "tgen_payload.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,6 +25,7 @@ extern "C" {
 
 #define TGEN_MAX_LINE 255
 #define TGEN_MAX_KEYWORD 15
+#define TGEN_MAX_INCLUDE_DEPTH 16  /* Files including files. */
 
 
 /* Valid opcodes for steps. */
@@ -32,42 +35,307 @@ extern "C" {
 #define TGEN_OPCODE_LOOP 4
 #define TGEN_OPCODE_DELAY 5
 #define TGEN_OPCODE_REPL 6
+#define TGEN_OPCODE_CATCHUP 7
+#define TGEN_OPCODE_RAMP 8
+#define TGEN_OPCODE_ARRIVAL 9
+#define TGEN_OPCODE_SIZE 10
+#define TGEN_OPCODE_BURST 11
+#define TGEN_OPCODE_THREAD 12
+#define TGEN_OPCODE_JOIN 13
+#define TGEN_OPCODE_AT 14
+#define TGEN_OPCODE_SYNC 15
+#define TGEN_OPCODE_REPORT 16
+#define TGEN_OPCODE_PAYLOAD 17
+#define TGEN_OPCODE_STAMP 18
+#define TGEN_OPCODE_MAX 18
+/* Only in compiled scripts (see tgen_compile()): the end of the script. */
+#define TGEN_OPCODE_END 0
 
+/* Thread numbers for "thread" blocks are 0 .. TGEN_MAX_THREADS-1. */
+#define TGEN_MAX_THREADS 64
+
+/* Kinds of message size distribution (see tgen_sizes_t). */
+#define TGEN_SIZES_UNIFORM 1  /* Any len from min_len to max_len. */
+#define TGEN_SIZES_TABLE 2  /* Weighted list of lens, sampled by alias table. */
+
+/* Message size distribution. Weighted lists use Walker's alias method:
+ * one random number picks a slot, and its low 32 bits decide between
+ * the slot's own len and its alias, so sampling is O(1) regardless of
+ * the number of lens. */
+struct tgen_sizes_s {
+  int kind;  /* TGEN_SIZES_... */
+  int num_lens;
+  int *lens;
+  uint64_t *cutoffs;  /* Keep lens[i] if random 32 bits < cutoffs[i]. */
+  int *aliases;  /* Otherwise use lens[aliases[i]]. */
+  int min_len;
+  int max_len;
+  struct tgen_sizes_s *next;  /* All tables owned by a tgen_t. */
+};
+typedef struct tgen_sizes_s tgen_sizes_t;
+
+/* A parsed step, with a field for every instruction's operands. Only
+ * the parser and tgen_run1() use this form; the script stores each step
+ * as a tgen_rec_t. */
 struct tgen_step_s {
-  int index;
   int opcode;
+  int mode;
   int len;
-  int rate;
-  int duration_usec;
-  int num_msgs;
+  uint64_t rate;
+  uint64_t end_rate;
+  uint64_t duration_usec;
+  uint64_t num_msgs;
+  uint64_t period_usec;
+  char name[TGEN_MAX_KEYWORD+1];
+  char *str;  /* Malloced; e.g. the "report" file name. */
   int variable_index;
   int value;
   int label_index;
+  tgen_sizes_t *sizes;
 };
 typedef struct tgen_step_s tgen_step_t;
 
-struct tgen_script_s {
-  int labels[26];
-  int num_steps;
-  int max_steps;
-  tgen_step_t *steps;
+/* A stored step: this 8-byte header followed by "words" 8-byte operand
+ * words, laid out per opcode (see tgen_script_append()). A send whose
+ * rate and count (or duration) both fit in 32 bits packs them into one
+ * word, so most send steps take 16 bytes. Records are back to back in
+ * the script's arena and are executed in place. */
+struct tgen_rec_s {
+  uint8_t opcode;
+  uint8_t words;
+  uint8_t mode;  /* Or LOOP's label index. */
+  uint8_t variable_index;
+  int32_t value;  /* Or the len of a send; LOOP's target once compiled. */
 };
+typedef struct tgen_rec_s tgen_rec_t;
+
+#define TGEN_REC_WORDS(rec_) ((uint64_t *)((rec_) + 1))
+#define TGEN_REC_NEXT(rec_) ((tgen_rec_t *)(TGEN_REC_WORDS(rec_) + (rec_)->words))
 
+#define TGEN_ARENA_INITIAL 1024  /* Bytes; doubled as needed. */
+#define TGEN_ARENA_MAX 0x7fffffff  /* Offsets are ints. */
 
+struct tgen_script_s {
+  int labels[26];  /* Arena offsets, -1 for not defined. */
+  char *loop_where[26];  /* Source of the first loop to each label, for errors. */
+  int num_steps;
+  size_t size;  /* Arena bytes used. */
+  size_t max_size;
+  char *arena;  /* Records; 8-byte aligned. */
+};
 typedef struct tgen_script_s tgen_script_t;
+
 #define TGEN_FLAGS_TST1 0x00000001  /* Set during first stage of selftest. */
 #define TGEN_FLAGS_PRINT_RATE 0x00000002  /* Print the actual achieved send rate. */
+#define TGEN_FLAGS_HYBRID_SLEEP 0x00000004  /* Sleep through long waits, spin the end. */
+#define TGEN_FLAGS_SEND_HIST 0x00000008  /* Histogram of my_send() call times. */
+#define TGEN_FLAGS_GAP_HIST 0x00000010  /* Histogram of gaps between sends. */
+
+/* Defaults for TGEN_FLAGS_HYBRID_SLEEP; see tgen_hybrid_sleep_set(). */
+#define TGEN_SLEEP_THRESHOLD_USEC 200
+#define TGEN_SLEEP_SPIN_USEC 60
 
 #define TGEN_STATE_STOPPED 0
 #define TGEN_STATE_RUNNING 1
 
+/* Catch-up policies for when the sender falls behind schedule. */
+#define TGEN_CATCHUP_BURST 1  /* Send up to "param" overdue msgs back-to-back. */
+#define TGEN_CATCHUP_SKIP 2  /* Drop missed slots, keep the original phase. */
+#define TGEN_CATCHUP_TOKEN 3  /* Token bucket, up to "param" msgs deep. */
+#define TGEN_CATCHUP_BURST_DEFAULT 20
+
+/* Inter-arrival distributions for send instructions. The mean gap
+ * always matches the requested rate. */
+#define TGEN_ARRIVAL_EVEN 1  /* Evenly spaced (default). */
+#define TGEN_ARRIVAL_POISSON 2  /* Exponential gaps. */
+#define TGEN_ARRIVAL_UNIFORM 3  /* Mean +/- "param" percent, uniform. */
+#define TGEN_ARRIVAL_PARETO 4  /* Pareto, shape alpha = "param" / 100. */
+
+/* Random gaps are generated this many at a time. */
+#define TGEN_GAP_BLOCK 1024
+/* A random gap is at most this many mean gaps (bounds the Pareto tail). */
+#define TGEN_GAP_MAX_MEANS 1000000
+
+/* Ramp changes the rate this many times over its duration, and reports
+ * the achieved rate for this many equal slices. */
+#define TGEN_RAMP_UPDATES 1000
+#define TGEN_RAMP_SLICES 10
+
+/* Modes for the "at" instruction. */
+#define TGEN_AT_ABSOLUTE 1  /* Wall-clock time, usec since the Unix epoch. */
+#define TGEN_AT_NEXT 2  /* Next wall-clock multiple of a period. */
+
+/* "at" sleeps until this long before the start time, then spins. */
+#define TGEN_AT_SPIN_USEC 1000
+
+/* A "sync" gives up (and removes the segment) after waiting this long.
+ * A segment with waiters older than this is left over from a killed run. */
+#define TGEN_SYNC_TIMEOUT_USEC 60000000
+
+/* Shared memory for the "sync" instruction's cross-process barrier. */
+struct tgen_sync_shm_s {
+  long lock;  /* Held while a process arrives. */
+  long count;  /* Processes waiting. */
+  long generation;  /* Incremented on each release. */
+  long num_procs;  /* What the waiting processes are waiting for. */
+  long first_pid;  /* First of them to arrive. */
+  uint64_t first_ns;  /* CLOCK_REALTIME when it arrived. */
+  uint64_t release_ns;  /* CLOCK_REALTIME of the last release. */
+};
+typedef struct tgen_sync_shm_s tgen_sync_shm_t;
+
+/* Running counters, updated by the sending thread with plain stores and
+ * read by the reporter thread. Padded to a cache line so that the
+ * reporter (and other instances' counters) never share a line with the
+ * send loop. */
+#define TGEN_CACHE_LINE 64
+struct tgen_counters_s {
+  uint64_t msgs;
+  uint64_t bytes;
+  uint64_t catchup_bursts;  /* Times more than one msg was due at once. */
+  uint64_t behind_ticks;  /* Sum of how late each send was. */
+  uint64_t pad[TGEN_CACHE_LINE / sizeof(uint64_t) - 4];
+};
+typedef struct tgen_counters_s tgen_counters_t;
+
+/* Payload buffers: a ring of TGEN_BUF_RING (a power of 2), each big
+ * enough for the largest len in the script. See tgen_send_buf_set(). */
+#define TGEN_BUF_RING 64
+#define TGEN_PAGE_SIZE 4096
+/* Most messages per tgen_send_bufs_cb_t call (less than TGEN_BUF_RING,
+ * so the buffers of one call are all distinct). */
+#define TGEN_SEND_BUFS_MAX 32
+
+/* Payload contents (see tgen_payload.h). */
+#define TGEN_PAYLOAD_NONE 0  /* Left to the application. */
+#define TGEN_PAYLOAD_PATTERN 1  /* Each message filled for (stream, seq). */
+
+/* Output formats for the reporter thread. */
+#define TGEN_REPORT_CSV 1
+#define TGEN_REPORT_JSON 2  /* One JSON object per line. */
+
+/* The reporter sleeps in chunks no longer than this so it stops promptly. */
+#define TGEN_REPORT_CHUNK_MS 10
+
+struct tgen_report_s;
+
+/* Pacing state. The deadline and the interval between messages are in
+ * ticks, with a 32-bit binary fraction so that there is no rounding
+ * drift and no division while sending. */
+struct tgen_pace_s {
+  uint64_t deadline;  /* Ticks when next msg is due. */
+  uint64_t deadline_frac;  /* Fraction of a tick, units of 2^-32. */
+  uint64_t interval;
+  uint64_t interval_frac;
+  int catchup_policy;  /* TGEN_CATCHUP_... */
+  uint64_t catchup_param;
+  uint64_t window;  /* Token bucket: max ticks deadline may lag. */
+  int arrival_dist;  /* TGEN_ARRIVAL_... */
+  int arrival_param;
+  uint64_t *gaps;  /* Precomputed random gaps (not used for even). */
+  int gap_index;
+  double gap_carry;  /* Fraction of a tick left over from rounding. */
+  uint64_t *rng;  /* tgen_t's xorshift128+ state. */
+  uint64_t sched;  /* See tgen_pace_sched_next(). */
+  uint64_t sched_frac;
+  int sched_gap_index;
+};
+typedef struct tgen_pace_s tgen_pace_t;
+
+struct tgen_s;
+
+/* Optional application callback to send "count" messages of "len" bytes
+ * each in a single call. See tgen_send_batch_set(). */
+typedef void (*tgen_send_batch_cb_t)(struct tgen_s *tgen, int len, int count);
+
+/* Optional application callback to send one message of "len" bytes
+ * from "buf", one of tgen's payload buffers. See tgen_send_buf_set(). */
+typedef void (*tgen_send_buf_cb_t)(struct tgen_s *tgen, char *buf, int len);
+
+/* Optional callback to send "count" messages in one call, message i
+ * being lens[i] bytes in bufs[i] (tgen's payload buffers). "cb_data" is
+ * what was passed to tgen_send_bufs_set(). Used by send backends (e.g.
+ * tgen_udp.c). A buffer may still be in use when the callback returns,
+ * as long as it is done before tgen fills it again (TGEN_BUF_RING -
+ * TGEN_SEND_BUFS_MAX messages later). A call with "count" 0 means
+ * finish with all of the buffers and be ready to send: the run is about
+ * to start (for a thread block, before its thread is created), the ring
+ * is about to be reallocated, or the run is ending. */
+typedef void (*tgen_send_bufs_cb_t)(struct tgen_s *tgen, void *cb_data, char **bufs, int *lens, int count);
+
+/* A "thread" block: a child tgen_t that runs its own steps on its own
+ * (optionally pinned) thread. Owned by the top-level instance. */
+struct tgen_thread_s {
+  struct tgen_s *tgen;  /* NULL if this thread number is not defined. */
+  int cpu;  /* -1 for not pinned. */
+  int running;
+  CPRT_THREAD_T thread_id;
+  uint64_t start_msgs;  /* Child's counters when the thread was started. */
+  uint64_t start_bytes;
+  uint64_t done_ticks;  /* When the child finished its steps. */
+};
+typedef struct tgen_thread_s tgen_thread_t;
+
 struct tgen_s {
   uint32_t flags;
   void *user_data;
+  tgen_send_batch_cb_t send_batch_cb;  /* NULL means use my_send(). */
+  tgen_send_buf_cb_t send_buf_cb;  /* Non-NULL replaces my_send() and batches. */
+  tgen_send_bufs_cb_t send_bufs_cb;  /* Non-NULL replaces all of the above. */
+  void *send_bufs_data;
+  char *bufs;  /* TGEN_BUF_RING payload buffers, "buf_stride" apart. */
+  void *bufs_mem;  /* Unaligned allocation of "bufs". */
+  int buf_size;  /* Largest len the buffers hold. */
+  int buf_stride;
+  int buf_index;  /* Next buffer to use. */
+  int payload_mode;  /* TGEN_PAYLOAD_... */
+  uint64_t payload_stream;
+  uint64_t payload_seq;  /* Seq of the next message filled. */
+  int stamp_on;  /* Write a tgen_stamp_t header into each message. */
+  uint64_t stamp_base_ns;  /* Wall clock at stamp_base_ticks. */
+  uint64_t stamp_base_ticks;
+  tgen_pace_t *stamp_pace;  /* Scheduled times of the send loop's msgs. */
+  uint64_t stamp_sched_ticks;  /* Scheduled time when stamp_pace is NULL. */
+  uint64_t stamp_send_ticks;  /* Set by the send loop for the next msgs. */
+  uint64_t sleep_threshold_ns;  /* Waits longer than this sleep. */
+  uint64_t sleep_spin_ns;  /* Wake this long before the deadline and spin. */
+  uint64_t slept_ns;  /* Total time slept instead of spinning. */
+  int catchup_policy;  /* TGEN_CATCHUP_... */
+  int catchup_param;
+  int arrival_dist;  /* TGEN_ARRIVAL_... */
+  int arrival_param;
+  uint64_t rng[2];  /* xorshift128+ state. */
+  uint64_t *gaps;  /* TGEN_GAP_BLOCK random gaps, allocated when needed. */
+  tgen_sizes_t *sizes;  /* Current size distribution, NULL for fixed len. */
+  tgen_sizes_t *sizes_list;  /* Every size table created, for tgen_delete(). */
+  tgen_counters_t *counters;  /* Own sends, over the life of the instance. */
+  void *counters_mem;  /* Unaligned allocation of "counters". */
+  uint64_t joined_msgs;  /* Sent by joined thread blocks. */
+  uint64_t joined_bytes;
+  struct tgen_report_s *report;  /* Reporter thread, NULL if not running. */
+  int thread_num;  /* -1 for a top-level instance. */
+  struct tgen_s *parent;  /* Top-level instance of a thread block. */
+  tgen_thread_t *threads;  /* TGEN_MAX_THREADS, allocated when needed. */
+  struct tgen_s *parse_thread;  /* Thread block being parsed, if any. */
+  int parse_lines;  /* Script lines added so far, for error locations. */
+  int parse_errors;  /* A script with any is not run. */
+  long threads_ready;  /* Start barrier: threads pinned and waiting. */
+  long threads_go;  /* Start barrier: set to release the threads. */
+  int64_t start_skew_ns;  /* Measured by the last "at" or "sync". */
+  tgen_hist_t *step_send_hist;  /* TGEN_FLAGS_SEND_HIST: current send step. */
+  tgen_hist_t *send_hist;  /* Merged over all steps (and joined threads). */
+  int send_hist_sample;  /* Time every Nth call. */
+  int send_hist_countdown;
+  tgen_hist_t *step_gap_hist;  /* TGEN_FLAGS_GAP_HIST: current send step. */
+  uint64_t gap_prev_ticks;  /* Time of the previous send in the step. */
+  int gap_prev_valid;
+  uint64_t gaps_over_2x;  /* Gaps more than 2x the target, this step. */
+  uint64_t gaps_over_10x;
   int variables[26];
-  int pc;
+  int pc;  /* Arena offset of the next step. */
   int state;  /* TGEN_STATE_... */
   tgen_script_t *script;
+  int code_steps;  /* Steps in the script when it was compiled, -1 for never. */
 };
 typedef struct tgen_s tgen_t;
 
@@ -75,19 +343,63 @@ typedef struct tgen_s tgen_t;
 tgen_t *tgen_create(uint32_t flags, void *user_data);
 void tgen_delete(tgen_t *tgen);
 void *tgen_user_data_get(tgen_t *tgen);
+void tgen_send_batch_set(tgen_t *tgen, tgen_send_batch_cb_t send_batch_cb);
+void tgen_send_buf_set(tgen_t *tgen, tgen_send_buf_cb_t send_buf_cb);
+void tgen_send_bufs_set(tgen_t *tgen, tgen_send_bufs_cb_t send_bufs_cb, void *cb_data);
+void tgen_bufs_alloc(tgen_t *tgen, int max_len);
+uint64_t tgen_payload_seq_get(tgen_t *tgen);
+void tgen_hybrid_sleep_set(tgen_t *tgen, int threshold_usec, int spin_usec);
+uint64_t tgen_slept_ns_get(tgen_t *tgen);
+void tgen_seed_set(tgen_t *tgen, uint64_t seed);
+tgen_sizes_t *tgen_sizes_table_create(tgen_t *tgen, int num_lens, int *lens, uint64_t *weights);
+tgen_sizes_t *tgen_sizes_uniform_create(tgen_t *tgen, int min_len, int max_len);
+tgen_sizes_t *tgen_sizes_file_create(tgen_t *tgen, char *filename);
+int tgen_sizes_sample(tgen_sizes_t *sizes, uint64_t *rng);
+uint64_t tgen_bytes_sent_get(tgen_t *tgen);
+uint64_t tgen_msgs_sent_get(tgen_t *tgen);
+tgen_counters_t *tgen_counters_get(tgen_t *tgen);
+void tgen_report_start(tgen_t *tgen, char *filename, int format, uint64_t interval_usec);
+void tgen_report_stop(tgen_t *tgen);
+tgen_t *tgen_thread_create(tgen_t *tgen, int thread_num, int cpu);
+int tgen_thread_num_get(tgen_t *tgen);
+int64_t tgen_start_skew_ns_get(tgen_t *tgen);
+void tgen_send_hist_set(tgen_t *tgen, int sample_every);
+tgen_hist_t *tgen_send_hist_get(tgen_t *tgen);
+tgen_hist_t *tgen_step_send_hist_get(tgen_t *tgen);
+tgen_hist_t *tgen_step_gap_hist_get(tgen_t *tgen);
+uint64_t tgen_step_gaps_over_get(tgen_t *tgen, int multiple);
+void tgen_pace_init(tgen_t *tgen, tgen_pace_t *pace, uint64_t rate, uint64_t start_ticks);
+uint64_t tgen_pace_due(tgen_pace_t *pace, uint64_t cur_ticks, uint64_t max_due);
+uint64_t tgen_pace_sched_next(tgen_pace_t *pace);
+void tgen_pace_rate_set(tgen_pace_t *pace, uint64_t rate);
 int tgen_variable_get(tgen_t *tgen, char var_id);
 void tgen_variable_set(tgen_t *tgen, char var_id, int value);
-void tgen_add_step(tgen_t *tgen, char *iline);
-void tgen_add_multi_steps(tgen_t *tgen, char *iline);
+int tgen_add_step(tgen_t *tgen, char *iline);
+int tgen_add_multi_steps(tgen_t *tgen, char *iline);
+int tgen_add_script_file(tgen_t *tgen, char *filename);
+size_t tgen_script_bytes_get(tgen_t *tgen);
+void tgen_compile(tgen_t *tgen);
 void tgen_run(tgen_t *tgen);
 void tgen_run1(tgen_t *tgen, tgen_step_t *step);
 
 /* Functions that implement instructions. */
-void tgen_run_sendt(tgen_t *tgen, int len, int rate, int duration_usec);
-void tgen_run_sendc(tgen_t *tgen, int len, int rate, int duration_usec);
+void tgen_run_sendt(tgen_t *tgen, int len, uint64_t rate, uint64_t duration_usec);
+void tgen_run_sendc(tgen_t *tgen, int len, uint64_t rate, uint64_t num_msgs);
 void tgen_run_set(tgen_t *tgen, int variable_index, int value);
-void tgen_run_delay(tgen_t *tgen, int duration_usec);
+void tgen_run_delay(tgen_t *tgen, uint64_t duration_usec);
 void tgen_run_repl(tgen_t *tgen);
+void tgen_run_catchup(tgen_t *tgen, int policy, int param);
+void tgen_run_ramp(tgen_t *tgen, int len, uint64_t start_rate, uint64_t end_rate, uint64_t duration_usec);
+void tgen_run_arrival(tgen_t *tgen, int dist, int param);
+void tgen_run_size(tgen_t *tgen, tgen_sizes_t *sizes);
+void tgen_run_burst(tgen_t *tgen, int len, uint64_t burst_msgs, uint64_t period_usec, uint64_t duration_usec);
+void tgen_run_thread(tgen_t *tgen, int thread_num);
+void tgen_run_join(tgen_t *tgen);
+void tgen_run_at(tgen_t *tgen, int mode, uint64_t time_usec);
+void tgen_run_sync(tgen_t *tgen, char *name, int num_procs);
+void tgen_run_report(tgen_t *tgen, char *filename, int format, uint64_t interval_usec);
+void tgen_run_payload(tgen_t *tgen, int mode, uint64_t stream);
+void tgen_run_stamp(tgen_t *tgen, int on, uint64_t stream);
 
 /* Functions the application must provide. */
 void my_send(tgen_t *tgen, int len);
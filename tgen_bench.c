@@ -0,0 +1,482 @@
+/* tgen_bench.c - Pacing accuracy and overhead benchmark for tgen.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+/* Sends to a null sink at each (size, rate) in a sweep and prints a CSV
+ * row per point: achieved vs requested rate, how far the gaps between
+ * sends were from the target, and (unpaced only) CPU cycles per message.
+ * Rate "max" asks for more than the loop can do, giving the maximum
+ * unpaced rate.
+ * Run it before and after a change to the pacing loop, the clock, or
+ * the dispatcher, on the same hardware. "-m dispatch" instead times the
+ * script interpreter on tight loops of short steps, "-m parse" times
+ * loading a long script from a string and from a file, and "-m replay"
+ * runs a long script of distinct steps, reporting its memory and cache
+ * misses per step. */
+
+#include <stdio.h>
+#include <string.h>
+#include "cprt.h"  /* See https://github.com/fordsfords/cprt */
+#include "tgen.h"
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+#define BENCH_MAX_POINTS 64
+#define BENCH_RATE_MAX 0xffffffff  /* Pacing interval rounds to 0 ticks. */
+
+/* Options */
+int o_cpu = -1;
+int o_duration_ms = 1000;
+int o_flags = 0;
+char *o_mode = "sweep";
+uint64_t o_num = 1000000;
+int o_payload = 0;
+char *o_rates = "1,10,100,1000,10000,100000,1000000,10000000,max";
+char *o_sizes = "1,64,1024,16384,65536";
+
+void usage(int exit_status)
+{
+  printf("Usage: tgen_bench [-h] [-c cpu] [-d duration_ms] [-f flags] [-m mode] [-n num] [-p] [-r rates] [-s sizes]\n");
+  exit(exit_status);
+}  /* usage */
+
+void get_my_options(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = cprt_getopt(argc, argv, "hc:d:f:m:n:pr:s:")) != EOF) {
+    switch (opt) {
+      case 'h': usage(0);
+      case 'c': CPRT_ATOI(cprt_optarg, o_cpu); break;
+      case 'd': CPRT_ATOI(cprt_optarg, o_duration_ms); break;
+      case 'f': CPRT_ATOI(cprt_optarg, o_flags); break;
+      case 'm': o_mode = CPRT_STRDUP(cprt_optarg); break;
+      case 'n': CPRT_ATOI(cprt_optarg, o_num); break;
+      case 'p': o_payload = 1; break;
+      case 'r': o_rates = CPRT_STRDUP(cprt_optarg); break;
+      case 's': o_sizes = CPRT_STRDUP(cprt_optarg); break;
+      default: usage(1);
+    }  /* switch */
+  }  /* while */
+
+  if (o_duration_ms < 1) {
+    fprintf(stderr, "Error: duration must be at least 1 ms\n");
+    usage(1);
+  }
+  if (strcmp(o_mode, "sweep") != 0 && strcmp(o_mode, "dispatch") != 0
+      && strcmp(o_mode, "parse") != 0 && strcmp(o_mode, "replay") != 0) {
+    fprintf(stderr, "Error: unknown mode '%s'\n", o_mode);
+    usage(1);
+  }
+  if (o_num < 1) {
+    fprintf(stderr, "Error: num must be at least 1\n");
+    usage(1);
+  }
+}  /* get_my_options */
+
+
+/* The null sink. */
+void my_send(tgen_t *tgen, int len)
+{
+}  /* my_send */
+
+
+void my_variable_change(tgen_t *tgen, char var_id, int value)
+{
+}  /* my_variable_change */
+
+
+/* With -p: payload buffers are filled, then dropped. */
+void my_send_buf(tgen_t *tgen, char *buf, int len)
+{
+}  /* my_send_buf */
+
+
+/* Parse comma-separated "list" into "values" ("max" is BENCH_RATE_MAX).
+ * Returns the number of values. */
+int parse_list(char *list, uint64_t *values)
+{
+  char *copy = CPRT_STRDUP(list);
+  char *saveptr;
+  char *item;
+  int num = 0;
+
+  for (item = CPRT_STRTOK(copy, ",", &saveptr); item != NULL; item = CPRT_STRTOK(NULL, ",", &saveptr)) {
+    if (num == BENCH_MAX_POINTS) {
+      fprintf(stderr, "Error: more than %d values in '%s'\n", BENCH_MAX_POINTS, list);
+      exit(1);
+    }
+    if (strcmp(item, "max") == 0) {
+      values[num] = BENCH_RATE_MAX;
+    }
+    else {
+      char *end;
+      values[num] = strtoull(item, &end, 10);
+      if (*end != '\0' || values[num] == 0) {
+        fprintf(stderr, "Error: invalid value '%s' in '%s'\n", item, list);
+        exit(1);
+      }
+    }
+    num++;
+  }
+  free(copy);
+
+  return num;
+}  /* parse_list */
+
+
+/* Cycles for unpaced_cycles_per_msg: the TSC where there is one, else ns. */
+uint64_t bench_cycles()
+{
+#if defined(CPRT_HAVE_TSC)
+  return CPRT_RDTSC();
+#else
+  uint64_t ticks;
+  CPRT_GETTICKS(ticks);
+  return cprt_ticks_to_ns(ticks);
+#endif
+}  /* bench_cycles */
+
+
+/* Run one point and print its row. Paced points send a fixed count
+ * (at least 2, for one gap), so a low rate doesn't have to wait out the
+ * duration for its last message; "max" sends for the duration. Cycles
+ * per message are only meaningful for "max" (a paced point's are mostly
+ * waiting), so they are "na" for the others. */
+void bench_point(tgen_t *tgen, int len, uint64_t rate)
+{
+  tgen_hist_t *gaps = tgen_step_gap_hist_get(tgen);
+  uint64_t start_msgs = tgen_msgs_sent_get(tgen);
+  uint64_t start_ticks, end_ticks;
+  uint64_t start_cycles, end_cycles;
+  uint64_t msgs;
+  uint64_t elapsed_ns;
+  double achieved;
+  int64_t target_ns;
+
+  if (rate == BENCH_RATE_MAX) {
+    start_cycles = bench_cycles();
+    CPRT_GETTICKS(start_ticks);
+    tgen_run_sendt(tgen, len, rate, (uint64_t)o_duration_ms * 1000);
+  }
+  else {
+    uint64_t num_msgs = rate * (uint64_t)o_duration_ms / 1000;
+    if (num_msgs < 2) {
+      num_msgs = 2;
+    }
+    start_cycles = bench_cycles();
+    CPRT_GETTICKS(start_ticks);
+    tgen_run_sendc(tgen, len, rate, num_msgs);
+  }
+  CPRT_GETTICKS(end_ticks);
+  end_cycles = bench_cycles();
+
+  msgs = tgen_msgs_sent_get(tgen) - start_msgs;
+  elapsed_ns = cprt_ticks_to_ns(end_ticks - start_ticks);
+  /* A paced count ends with its last send, so N msgs span N-1 gaps. */
+  achieved = (double)((rate == BENCH_RATE_MAX) ? msgs : msgs - 1);
+  achieved = (elapsed_ns > 0) ? achieved * 1e9 / (double)elapsed_ns : 0.0;
+  target_ns = (rate == BENCH_RATE_MAX) ? 0 : (int64_t)(1000000000 / rate);
+
+  /* Gap error is a gap percentile minus the target gap. */
+  printf("%d,", len);
+  if (rate == BENCH_RATE_MAX) {
+    printf("max,");
+  }
+  else {
+    printf("%" PRIu64 ",", rate);
+  }
+  printf("%" PRIu64 ",%" PRIu64 ",%.0f,%.2f,%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64
+      ",%" PRIu64 ",",
+      msgs, elapsed_ns / 1000, achieved,
+      (rate == BENCH_RATE_MAX) ? 0.0 : (achieved - (double)rate) * 100.0 / (double)rate,
+      target_ns,
+      (int64_t)tgen_hist_percentile(gaps, 50.0) - target_ns,
+      (int64_t)tgen_hist_percentile(gaps, 99.0) - target_ns,
+      (int64_t)tgen_hist_percentile(gaps, 99.9) - target_ns,
+      (int64_t)gaps->max - target_ns,
+      tgen_step_gaps_over_get(tgen, 2));
+  if (rate == BENCH_RATE_MAX) {
+    printf("%.1f\n", (msgs > 0) ? (double)(end_cycles - start_cycles) / (double)msgs : 0.0);
+  }
+  else {
+    printf("na\n");
+  }
+  fflush(stdout);
+}  /* bench_point */
+
+
+/* Time "script", which does "o_num" iterations of a "steps"-step loop,
+ * and print a row for it. */
+void bench_dispatch_script(char *name, char *script, int steps)
+{
+  tgen_t *tgen = tgen_create(o_flags, NULL);
+  uint64_t start_ticks, end_ticks;
+  uint64_t elapsed_ns;
+
+  CPRT_ASSERT(tgen_add_multi_steps(tgen, script) == 0);
+  tgen_compile(tgen);  /* Not part of the time. */
+
+  CPRT_GETTICKS(start_ticks);
+  tgen_run(tgen);
+  CPRT_GETTICKS(end_ticks);
+
+  elapsed_ns = cprt_ticks_to_ns(end_ticks - start_ticks);
+  printf("%s,%" PRIu64 ",%" PRIu64 ",%.2f\n", name, o_num * steps, elapsed_ns / 1000,
+      (double)elapsed_ns / (double)(o_num * steps));
+  fflush(stdout);
+
+  tgen_delete(tgen);
+}  /* bench_dispatch_script */
+
+
+/* Time loading "script" (as a string, or as file "filename") and print
+ * a row for it. */
+void bench_parse_script(char *name, char *script, uint64_t bytes, char *filename)
+{
+  tgen_t *tgen = tgen_create(o_flags, NULL);
+  uint64_t start_ticks, end_ticks;
+  uint64_t elapsed_ns;
+
+  CPRT_GETTICKS(start_ticks);
+  if (filename != NULL) {
+    CPRT_ASSERT(tgen_add_script_file(tgen, filename) == 0);
+  }
+  else {
+    CPRT_ASSERT(tgen_add_multi_steps(tgen, script) == 0);
+  }
+  CPRT_GETTICKS(end_ticks);
+
+  elapsed_ns = cprt_ticks_to_ns(end_ticks - start_ticks);
+  printf("%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.2f\n", name, o_num, bytes,
+      elapsed_ns / 1000, (double)elapsed_ns / (double)o_num);
+  fflush(stdout);
+
+  tgen_delete(tgen);
+}  /* bench_parse_script */
+
+
+/* Script load time: "o_num" lines, cycling through typical
+ * instructions (with comments and blank lines), from a string and from
+ * a file (written to the current directory, then removed). */
+void bench_parse()
+{
+  char *lines[] = {
+    "sendt 700 bytes 50 kpersec 3 sec",
+    "  sendc 700 bytes 2 persec 10 msgs  # With a comment.",
+    "set i 3",
+    "label a",
+    "ramp 1400 bytes 1 kpersec 100 kpersec 2 sec",
+    "",
+    "catchup token 64",
+    "arrival uniform 50",
+    "burst 1000 bytes 2 kmsgs every 5 msec for 2 min",
+    "# A comment line.",
+    "delay 200 msec",
+    "loop a i"
+  };
+  int num_lines = sizeof(lines) / sizeof(lines[0]);
+  char *filename = "tgen_bench.tmp";
+  size_t script_size = 0;
+  char *script;
+  char *p;
+  FILE *fp;
+  uint64_t i;
+
+  for (i = 0; i < (uint64_t)num_lines; i++) {
+    script_size += strlen(lines[i]) + 1;
+  }
+  script_size = script_size * (o_num / num_lines + 1) + 1;
+  CPRT_ENULL(script = (char *)malloc(script_size));
+  p = script;
+  for (i = 0; i < o_num; i++) {
+    p += sprintf(p, "%s\n", lines[i % num_lines]);
+  }
+
+  CPRT_ENULL(fp = fopen(filename, "w"));
+  CPRT_ASSERT(fwrite(script, 1, p - script, fp) == (size_t)(p - script));
+  CPRT_EOK0(fclose(fp));
+
+  printf("test,lines,bytes,duration_usec,ns_per_line\n");
+  bench_parse_script("parse", script, p - script, NULL);
+  bench_parse_script("parse_file", script, p - script, filename);
+
+  CPRT_EM1(remove(filename));
+  free(script);
+}  /* bench_parse */
+
+
+/* Open a counter of this thread's hardware cache misses (disabled).
+ * Returns -1 where there is none (not Linux, a VM without a PMU, or
+ * kernel.perf_event_paranoid too high). */
+int bench_misses_open()
+{
+#if defined(__linux__)
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}  /* bench_misses_open */
+
+
+/* Run a script of "o_num" distinct one-message sends at "rate" and
+ * print a row for it. */
+void bench_replay_script(char *name, uint64_t rate)
+{
+  tgen_t *tgen = tgen_create(o_flags, NULL);
+  uint64_t start_ticks, end_ticks;
+  uint64_t elapsed_ns;
+  uint64_t misses = 0;
+  size_t bytes;
+  char *script;
+  char *p;
+  int fd;
+  uint64_t i;
+
+  /* Vary the len so that no two neighboring steps are the same. */
+  CPRT_ENULL(script = (char *)malloc(o_num * 64 + 1));
+  p = script;
+  for (i = 0; i < o_num; i++) {
+    p += sprintf(p, "sendc %d bytes %" PRIu64 " persec 1 msgs\n", (int)(1 + (i * 37) % 1400), rate);
+  }
+  CPRT_ASSERT(tgen_add_multi_steps(tgen, script) == 0);
+  free(script);
+  tgen_compile(tgen);  /* Not part of the time. */
+  bytes = tgen_script_bytes_get(tgen);
+
+  fd = bench_misses_open();
+#if defined(__linux__)
+  if (fd >= 0) {
+    CPRT_EM1(ioctl(fd, PERF_EVENT_IOC_RESET, 0));
+    CPRT_EM1(ioctl(fd, PERF_EVENT_IOC_ENABLE, 0));
+  }
+#endif
+  CPRT_GETTICKS(start_ticks);
+  tgen_run(tgen);
+  CPRT_GETTICKS(end_ticks);
+#if defined(__linux__)
+  if (fd >= 0) {
+    CPRT_EM1(ioctl(fd, PERF_EVENT_IOC_DISABLE, 0));
+    CPRT_ASSERT(read(fd, &misses, sizeof(misses)) == sizeof(misses));
+    CPRT_EM1(close(fd));
+  }
+#endif
+
+  elapsed_ns = cprt_ticks_to_ns(end_ticks - start_ticks);
+  printf("%s,%" PRIu64 ",%" PRIu64 ",%.2f,%" PRIu64 ",%.2f,", name, o_num, (uint64_t)bytes,
+      (double)bytes / (double)o_num, elapsed_ns / 1000, (double)elapsed_ns / (double)o_num);
+  if (fd >= 0) {
+    printf("%.3f\n", (double)misses / (double)o_num);
+  }
+  else {
+    printf("na\n");
+  }
+  fflush(stdout);
+
+  tgen_delete(tgen);
+}  /* bench_replay_script */
+
+
+/* Step storage: a long replay-style script, with rates that pack into
+ * 16-byte steps and rates that need 24. Both are unreachable, so the
+ * time is the interpreter's and the sends'. */
+void bench_replay()
+{
+  printf("test,steps,script_bytes,bytes_per_step,duration_usec,ns_per_step,cache_misses_per_step\n");
+  bench_replay_script("replay", 4000000000);
+  bench_replay_script("replay_wide", 5000000000);
+}  /* bench_replay */
+
+
+/* Per-step interpreter cost: a loop of "set" (nearly free, so it's
+ * mostly dispatch) and a loop of one-message sends at an unreachable
+ * rate (what interleaving scripts do). */
+void bench_dispatch()
+{
+  char script[TGEN_MAX_LINE+1];
+
+  printf("test,steps,duration_usec,ns_per_step\n");
+
+  snprintf(script, sizeof(script), "set i %" PRIu64 "; label a; set j 1; loop a i", o_num);
+  bench_dispatch_script("set_loop", script, 2);
+
+  snprintf(script, sizeof(script),
+      "set i %" PRIu64 "; label a; sendc 1 bytes 4000 mpersec 1 msgs; loop a i", o_num);
+  bench_dispatch_script("sendc_loop", script, 2);
+}  /* bench_dispatch */
+
+
+int main(int argc, char **argv)
+{
+  uint64_t rates[BENCH_MAX_POINTS];
+  uint64_t sizes[BENCH_MAX_POINTS];
+  int num_rates;
+  int num_sizes;
+  tgen_t *tgen;
+  int s, r;
+
+  get_my_options(argc, argv);
+  num_rates = parse_list(o_rates, rates);
+  num_sizes = parse_list(o_sizes, sizes);
+
+  if (o_cpu >= 0) {
+    cprt_set_affinity((uint64_t)1 << o_cpu);
+  }
+
+  if (strcmp(o_mode, "dispatch") == 0) {
+    bench_dispatch();
+    return 0;
+  }
+  if (strcmp(o_mode, "parse") == 0) {
+    bench_parse();
+    return 0;
+  }
+  if (strcmp(o_mode, "replay") == 0) {
+    bench_replay();
+    return 0;
+  }
+
+  tgen = tgen_create(o_flags | TGEN_FLAGS_GAP_HIST, NULL);
+  if (o_payload) {
+    tgen_send_buf_set(tgen, my_send_buf);
+    tgen_run_payload(tgen, TGEN_PAYLOAD_PATTERN, 1);
+  }
+
+  printf("size,rate,msgs,duration_usec,achieved_rate,rate_error_pct,gap_target_ns,"
+      "gap_err_p50_ns,gap_err_p99_ns,gap_err_p999_ns,gap_err_max_ns,gaps_over_2x,unpaced_cycles_per_msg\n");
+  for (s = 0; s < num_sizes; s++) {
+    if (o_payload) {
+      tgen_bufs_alloc(tgen, (int)sizes[s]);
+    }
+    for (r = 0; r < num_rates; r++) {
+      bench_point(tgen, (int)sizes[s], rates[r]);
+    }
+  }
+
+  tgen_delete(tgen);
+
+  return 0;
+}  /* main */
@@ -0,0 +1,158 @@
+/* tgen_hist.c - Log-bucketed latency histograms.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cprt.h"  /* See https://github.com/fordsfords/cprt */
+#include "tgen_hist.h"
+
+#if defined(_WIN32)
+#include <intrin.h>
+#endif
+
+
+/* Return the bucket for "value". Only a shift and a count-leading-zeros,
+ * so it is cheap enough to call per message. */
+uint64_t tgen_hist_bucket_index(uint64_t value)
+{
+  int msb;
+
+  if (value < 2 * TGEN_HIST_SUB_COUNT) {
+    return value;
+  }
+
+#if defined(_WIN32)
+  {
+    unsigned long bit;
+    _BitScanReverse64(&bit, value);
+    msb = (int)bit;
+  }
+#else
+  msb = 63 - __builtin_clzll(value);
+#endif
+
+  /* (value >> shift) is from TGEN_HIST_SUB_COUNT to 2*TGEN_HIST_SUB_COUNT-1. */
+  return (uint64_t)(msb - TGEN_HIST_SUB_BITS) * TGEN_HIST_SUB_COUNT
+      + (value >> (msb - TGEN_HIST_SUB_BITS));
+}  /* tgen_hist_bucket_index */
+
+
+/* Return the largest value that goes in bucket "index". */
+uint64_t tgen_hist_bucket_high(uint64_t index)
+{
+  uint64_t shift;
+  uint64_t mantissa;
+
+  if (index < 2 * TGEN_HIST_SUB_COUNT) {
+    return index;
+  }
+
+  shift = index / TGEN_HIST_SUB_COUNT - 1;
+  mantissa = index - shift * TGEN_HIST_SUB_COUNT;
+  return ((mantissa + 1) << shift) - 1;
+}  /* tgen_hist_bucket_high */
+
+
+tgen_hist_t *tgen_hist_create()
+{
+  tgen_hist_t *hist;
+
+  CPRT_ENULL(hist = (tgen_hist_t *)malloc(sizeof(tgen_hist_t)));
+  tgen_hist_reset(hist);
+
+  return hist;
+}  /* tgen_hist_create */
+
+
+void tgen_hist_delete(tgen_hist_t *hist)
+{
+  free(hist);
+}  /* tgen_hist_delete */
+
+
+void tgen_hist_reset(tgen_hist_t *hist)
+{
+  memset(hist, 0, sizeof(tgen_hist_t));
+  hist->min = (uint64_t)-1;
+}  /* tgen_hist_reset */
+
+
+void tgen_hist_record(tgen_hist_t *hist, uint64_t value)
+{
+  hist->buckets[tgen_hist_bucket_index(value)]++;
+  hist->count++;
+  hist->sum += value;
+  if (value < hist->min) hist->min = value;
+  if (value > hist->max) hist->max = value;
+}  /* tgen_hist_record */
+
+
+/* Record "num" occurrences of "value". */
+void tgen_hist_record_n(tgen_hist_t *hist, uint64_t value, uint64_t num)
+{
+  if (num == 0) return;
+
+  hist->buckets[tgen_hist_bucket_index(value)] += num;
+  hist->count += num;
+  hist->sum += value * num;
+  if (value < hist->min) hist->min = value;
+  if (value > hist->max) hist->max = value;
+}  /* tgen_hist_record_n */
+
+
+/* Add "src_hist" into "dst_hist" (e.g. to combine threads or steps). */
+void tgen_hist_merge(tgen_hist_t *dst_hist, tgen_hist_t *src_hist)
+{
+  int i;
+
+  if (src_hist->count == 0) return;
+
+  for (i = 0; i < TGEN_HIST_BUCKETS; i++) {
+    dst_hist->buckets[i] += src_hist->buckets[i];
+  }
+  dst_hist->count += src_hist->count;
+  dst_hist->sum += src_hist->sum;
+  if (src_hist->min < dst_hist->min) dst_hist->min = src_hist->min;
+  if (src_hist->max > dst_hist->max) dst_hist->max = src_hist->max;
+}  /* tgen_hist_merge */
+
+
+/* Return the value at "percentile" (0-100). The result is the top of
+ * the bucket it falls in (but never more than the max), so it errs on
+ * the high side. Returns 0 for an empty histogram. */
+uint64_t tgen_hist_percentile(tgen_hist_t *hist, double percentile)
+{
+  uint64_t target;
+  uint64_t seen = 0;
+  int i;
+
+  if (hist->count == 0) return 0;
+
+  target = (uint64_t)((double)hist->count * percentile / 100.0);
+  if ((double)target < (double)hist->count * percentile / 100.0) {
+    target++;  /* Round up. */
+  }
+  if (target < 1) {
+    target = 1;
+  }
+
+  for (i = 0; i < TGEN_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= target) {
+      uint64_t high = tgen_hist_bucket_high(i);
+      return (high < hist->max) ? high : hist->max;
+    }
+  }
+
+  return hist->max;
+}  /* tgen_hist_percentile */
@@ -0,0 +1,55 @@
+/* tgen_hist.h - Include file for log-bucketed latency histograms.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+#ifndef TGEN_HIST_H
+#define TGEN_HIST_H
+
+#include "cprt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* HDR-style buckets: values below 2*TGEN_HIST_SUB_COUNT are exact.
+ * Above that, each power of 2 is split into TGEN_HIST_SUB_COUNT
+ * equal buckets, so any value is within about 3% (1/32). */
+#define TGEN_HIST_SUB_BITS 5
+#define TGEN_HIST_SUB_COUNT (1 << TGEN_HIST_SUB_BITS)
+#define TGEN_HIST_BUCKETS ((64 - TGEN_HIST_SUB_BITS + 1) * TGEN_HIST_SUB_COUNT)
+
+struct tgen_hist_s {
+  uint64_t count;
+  uint64_t min;
+  uint64_t max;
+  uint64_t sum;
+  uint64_t buckets[TGEN_HIST_BUCKETS];
+};
+typedef struct tgen_hist_s tgen_hist_t;
+
+
+tgen_hist_t *tgen_hist_create();
+void tgen_hist_delete(tgen_hist_t *hist);
+void tgen_hist_reset(tgen_hist_t *hist);
+void tgen_hist_record(tgen_hist_t *hist, uint64_t value);
+void tgen_hist_record_n(tgen_hist_t *hist, uint64_t value, uint64_t num);
+void tgen_hist_merge(tgen_hist_t *dst_hist, tgen_hist_t *src_hist);
+uint64_t tgen_hist_percentile(tgen_hist_t *hist, double percentile);
+uint64_t tgen_hist_bucket_index(uint64_t value);
+uint64_t tgen_hist_bucket_high(uint64_t index);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* TGEN_HIST_H */
@@ -0,0 +1,311 @@
+/* tgen_payload.c - Verifiable message payloads.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cprt.h"  /* See https://github.com/fordsfords/cprt */
+#include "tgen_payload.h"
+
+/* SSE2 is part of x86-64, so it is always there. AVX2 is compiled in
+ * with a target attribute (GCC and clang) and used if the CPU has it. */
+#if defined(__x86_64__) || defined(_M_X64)
+#define TGEN_PAYLOAD_HAVE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define TGEN_PAYLOAD_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TGEN_PAYLOAD_LE64(_w) __builtin_bswap64(_w)
+#else
+#define TGEN_PAYLOAD_LE64(_w) (_w)
+#endif
+
+
+/* -1 until the first call detects the CPU. */
+static int tgen_payload_simd = -1;
+
+
+/* Base word for (stream, seq): splitmix64's finalizer, so that nearby
+ * seqs (and streams) give unrelated contents. */
+uint64_t tgen_payload_base(uint64_t stream, uint64_t seq)
+{
+  uint64_t z = (stream * TGEN_PAYLOAD_INC) ^ (seq + TGEN_PAYLOAD_INC);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}  /* tgen_payload_base */
+
+
+/* Fill words "first_word" up to "len" bytes, one word at a time. Also
+ * does the partial word at the end for the SIMD versions. */
+static void tgen_payload_fill_scalar(char *buf, int len, uint64_t base, int first_word)
+{
+  uint64_t word = base + (uint64_t)first_word * TGEN_PAYLOAD_INC;
+  int ofs = first_word * 8;
+
+  while (ofs + 8 <= len) {
+    uint64_t le_word = TGEN_PAYLOAD_LE64(word);
+    memcpy(&buf[ofs], &le_word, 8);
+    word += TGEN_PAYLOAD_INC;
+    ofs += 8;
+  }
+  if (ofs < len) {
+    uint64_t le_word = TGEN_PAYLOAD_LE64(word);
+    memcpy(&buf[ofs], &le_word, len - ofs);
+  }
+}  /* tgen_payload_fill_scalar */
+
+
+/* Returns the offset of the first bad byte at or after word "first_word",
+ * or -1. */
+static int tgen_payload_verify_scalar(const char *buf, int len, uint64_t base, int first_word)
+{
+  uint64_t word = base + (uint64_t)first_word * TGEN_PAYLOAD_INC;
+  int ofs = first_word * 8;
+
+  while (ofs < len) {
+    uint64_t le_word = TGEN_PAYLOAD_LE64(word);
+    uint64_t got_word = 0;
+    int num_bytes = (len - ofs < 8) ? len - ofs : 8;
+
+    memcpy(&got_word, &buf[ofs], num_bytes);
+    if (num_bytes < 8) {
+      memset(((char *)&le_word) + num_bytes, 0, 8 - num_bytes);
+    }
+    if (got_word != le_word) {
+      int i;
+      for (i = 0; buf[ofs + i] == ((char *)&le_word)[i]; i++) {
+      }
+      return ofs + i;
+    }
+    word += TGEN_PAYLOAD_INC;
+    ofs += 8;
+  }
+
+  return -1;
+}  /* tgen_payload_verify_scalar */
+
+
+#if defined(TGEN_PAYLOAD_HAVE_SSE2)
+/* 2 words per store. */
+static void tgen_payload_fill_sse2(char *buf, int len, uint64_t base)
+{
+  __m128i v = _mm_set_epi64x((long long)(base + TGEN_PAYLOAD_INC), (long long)base);
+  __m128i inc = _mm_set1_epi64x((long long)(2 * TGEN_PAYLOAD_INC));
+  int num_words = len / 8;
+  int i;
+
+  for (i = 0; i + 2 <= num_words; i += 2) {
+    _mm_storeu_si128((__m128i *)&buf[i * 8], v);
+    v = _mm_add_epi64(v, inc);
+  }
+  tgen_payload_fill_scalar(buf, len, base, i);
+}  /* tgen_payload_fill_sse2 */
+
+
+static int tgen_payload_verify_sse2(const char *buf, int len, uint64_t base)
+{
+  __m128i v = _mm_set_epi64x((long long)(base + TGEN_PAYLOAD_INC), (long long)base);
+  __m128i inc = _mm_set1_epi64x((long long)(2 * TGEN_PAYLOAD_INC));
+  int num_words = len / 8;
+  int i;
+
+  for (i = 0; i + 2 <= num_words; i += 2) {
+    __m128i got = _mm_loadu_si128((const __m128i *)&buf[i * 8]);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(got, v)) != 0xffff) {
+      return tgen_payload_verify_scalar(buf, len, base, i);
+    }
+    v = _mm_add_epi64(v, inc);
+  }
+  return tgen_payload_verify_scalar(buf, len, base, i);
+}  /* tgen_payload_verify_sse2 */
+#endif  /* TGEN_PAYLOAD_HAVE_SSE2 */
+
+
+#if defined(TGEN_PAYLOAD_HAVE_AVX2)
+/* 8 words per iteration (two 4-word stores). */
+__attribute__((target("avx2")))
+static void tgen_payload_fill_avx2(char *buf, int len, uint64_t base)
+{
+  __m256i v0 = _mm256_set_epi64x((long long)(base + 3 * TGEN_PAYLOAD_INC),
+      (long long)(base + 2 * TGEN_PAYLOAD_INC), (long long)(base + TGEN_PAYLOAD_INC), (long long)base);
+  __m256i v1 = _mm256_add_epi64(v0, _mm256_set1_epi64x((long long)(4 * TGEN_PAYLOAD_INC)));
+  __m256i inc = _mm256_set1_epi64x((long long)(8 * TGEN_PAYLOAD_INC));
+  int num_words = len / 8;
+  int i;
+
+  for (i = 0; i + 8 <= num_words; i += 8) {
+    _mm256_storeu_si256((__m256i *)&buf[i * 8], v0);
+    _mm256_storeu_si256((__m256i *)&buf[i * 8 + 32], v1);
+    v0 = _mm256_add_epi64(v0, inc);
+    v1 = _mm256_add_epi64(v1, inc);
+  }
+  tgen_payload_fill_scalar(buf, len, base, i);
+}  /* tgen_payload_fill_avx2 */
+
+
+__attribute__((target("avx2")))
+static int tgen_payload_verify_avx2(const char *buf, int len, uint64_t base)
+{
+  __m256i v0 = _mm256_set_epi64x((long long)(base + 3 * TGEN_PAYLOAD_INC),
+      (long long)(base + 2 * TGEN_PAYLOAD_INC), (long long)(base + TGEN_PAYLOAD_INC), (long long)base);
+  __m256i v1 = _mm256_add_epi64(v0, _mm256_set1_epi64x((long long)(4 * TGEN_PAYLOAD_INC)));
+  __m256i inc = _mm256_set1_epi64x((long long)(8 * TGEN_PAYLOAD_INC));
+  int num_words = len / 8;
+  int i;
+
+  for (i = 0; i + 8 <= num_words; i += 8) {
+    /* XOR against the expected words; any set bit is a mismatch. */
+    __m256i diff = _mm256_or_si256(
+        _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&buf[i * 8]), v0),
+        _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&buf[i * 8 + 32]), v1));
+    if (! _mm256_testz_si256(diff, diff)) {
+      return tgen_payload_verify_scalar(buf, len, base, i);
+    }
+    v0 = _mm256_add_epi64(v0, inc);
+    v1 = _mm256_add_epi64(v1, inc);
+  }
+  return tgen_payload_verify_scalar(buf, len, base, i);
+}  /* tgen_payload_verify_avx2 */
+#endif  /* TGEN_PAYLOAD_HAVE_AVX2 */
+
+
+/* Best implementation this build and CPU support. */
+static int tgen_payload_simd_detect()
+{
+#if defined(TGEN_PAYLOAD_HAVE_AVX2)
+  if (__builtin_cpu_supports("avx2")) {
+    return TGEN_PAYLOAD_SIMD_AVX2;
+  }
+#endif
+#if defined(TGEN_PAYLOAD_HAVE_SSE2)
+  return TGEN_PAYLOAD_SIMD_SSE2;
+#else
+  return TGEN_PAYLOAD_SIMD_SCALAR;
+#endif
+}  /* tgen_payload_simd_detect */
+
+
+/* The implementation in use (TGEN_PAYLOAD_SIMD_...). */
+int tgen_payload_simd_get()
+{
+  if (tgen_payload_simd == -1) {
+    tgen_payload_simd = tgen_payload_simd_detect();
+  }
+  return tgen_payload_simd;
+}  /* tgen_payload_simd_get */
+
+
+/* Use implementation "simd" (e.g. to compare them), or the best
+ * available if it isn't supported. Returns the one chosen. All of them
+ * produce the same bytes. */
+int tgen_payload_simd_set(int simd)
+{
+  int best = tgen_payload_simd_detect();
+
+  tgen_payload_simd = (simd >= TGEN_PAYLOAD_SIMD_SCALAR && simd <= best) ? simd : best;
+  return tgen_payload_simd;
+}  /* tgen_payload_simd_set */
+
+
+/* Write the "len" byte payload for (stream, seq) to "buf". */
+void tgen_payload_fill(char *buf, int len, uint64_t stream, uint64_t seq)
+{
+  uint64_t base = tgen_payload_base(stream, seq);
+
+  switch (tgen_payload_simd_get()) {
+#if defined(TGEN_PAYLOAD_HAVE_AVX2)
+  case TGEN_PAYLOAD_SIMD_AVX2: tgen_payload_fill_avx2(buf, len, base); break;
+#endif
+#if defined(TGEN_PAYLOAD_HAVE_SSE2)
+  case TGEN_PAYLOAD_SIMD_SSE2: tgen_payload_fill_sse2(buf, len, base); break;
+#endif
+  default: tgen_payload_fill_scalar(buf, len, base, 0);
+  }  /* switch */
+}  /* tgen_payload_fill */
+
+
+/* Check that "buf" holds the "len" byte payload for (stream, seq).
+ * Returns -1 if it does, otherwise the offset of the first wrong byte. */
+int tgen_payload_verify(const char *buf, int len, uint64_t stream, uint64_t seq)
+{
+  uint64_t base = tgen_payload_base(stream, seq);
+
+  switch (tgen_payload_simd_get()) {
+#if defined(TGEN_PAYLOAD_HAVE_AVX2)
+  case TGEN_PAYLOAD_SIMD_AVX2: return tgen_payload_verify_avx2(buf, len, base);
+#endif
+#if defined(TGEN_PAYLOAD_HAVE_SSE2)
+  case TGEN_PAYLOAD_SIMD_SSE2: return tgen_payload_verify_sse2(buf, len, base);
+#endif
+  default: return tgen_payload_verify_scalar(buf, len, base, 0);
+  }  /* switch */
+}  /* tgen_payload_verify */
+
+
+/* Store "value" as "num_bytes" little-endian bytes. */
+static void tgen_stamp_put(char *buf, uint64_t value, int num_bytes)
+{
+  int i;
+
+  for (i = 0; i < num_bytes; i++) {
+    buf[i] = (char)(value >> (i * 8));
+  }
+}  /* tgen_stamp_put */
+
+
+static uint64_t tgen_stamp_get(const char *buf, int num_bytes)
+{
+  uint64_t value = 0;
+  int i;
+
+  for (i = num_bytes - 1; i >= 0; i--) {
+    value = (value << 8) | (unsigned char)buf[i];
+  }
+  return value;
+}  /* tgen_stamp_get */
+
+
+/* Write the stamp header to the start of "buf". If "len" is shorter
+ * than TGEN_STAMP_SIZE, only the first "len" bytes are written. */
+void tgen_stamp_write(char *buf, int len, tgen_stamp_t *stamp)
+{
+  char hdr[TGEN_STAMP_SIZE];
+
+  tgen_stamp_put(&hdr[0], TGEN_STAMP_MAGIC, 4);
+  tgen_stamp_put(&hdr[4], stamp->stream, 4);
+  tgen_stamp_put(&hdr[8], stamp->seq, 8);
+  tgen_stamp_put(&hdr[16], stamp->sched_ns, 8);
+  tgen_stamp_put(&hdr[24], stamp->send_ns, 8);
+  memcpy(buf, hdr, (len < TGEN_STAMP_SIZE) ? len : TGEN_STAMP_SIZE);
+}  /* tgen_stamp_write */
+
+
+/* Parse the stamp header at the start of "buf". Returns 0 if the message
+ * is too short or doesn't start with the magic number. */
+int tgen_stamp_read(const char *buf, int len, tgen_stamp_t *stamp)
+{
+  if (len < TGEN_STAMP_SIZE || tgen_stamp_get(&buf[0], 4) != TGEN_STAMP_MAGIC) {
+    return 0;
+  }
+
+  stamp->stream = (uint32_t)tgen_stamp_get(&buf[4], 4);
+  stamp->seq = tgen_stamp_get(&buf[8], 8);
+  stamp->sched_ns = tgen_stamp_get(&buf[16], 8);
+  stamp->send_ns = tgen_stamp_get(&buf[24], 8);
+  return 1;
+}  /* tgen_stamp_read */
@@ -0,0 +1,67 @@
+/* tgen_payload.h - Include file for verifiable message payloads.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+#ifndef TGEN_PAYLOAD_H
+#define TGEN_PAYLOAD_H
+
+#include "cprt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* The payload for (stream, seq) is a sequence of 64-bit little-endian
+ * words: word i is base + i * TGEN_PAYLOAD_INC, where base is a hash of
+ * stream and seq. A message that is not a whole number of words ends
+ * with the first bytes of the next word. */
+#define TGEN_PAYLOAD_INC 0x9e3779b97f4a7c15ull
+
+/* Implementations, in order of preference. */
+#define TGEN_PAYLOAD_SIMD_SCALAR 0
+#define TGEN_PAYLOAD_SIMD_SSE2 1
+#define TGEN_PAYLOAD_SIMD_AVX2 2
+
+/* Stamp header, written at the start of the payload when stamping is
+ * on. On the wire it is TGEN_STAMP_SIZE bytes, all fields little-endian:
+ *   0  uint32 magic (TGEN_STAMP_MAGIC, the bytes "TGN1")
+ *   4  uint32 stream
+ *   8  uint64 seq
+ *  16  uint64 sched_ns  (when the message was due)
+ *  24  uint64 send_ns  (when the send loop sent it)
+ * Times are ns since the Unix epoch (CLOCK_REALTIME), so a receiver on
+ * another host needs synchronized clocks (e.g. PTP) for latency. */
+#define TGEN_STAMP_SIZE 32
+#define TGEN_STAMP_MAGIC 0x314e4754
+
+struct tgen_stamp_s {
+  uint32_t stream;
+  uint64_t seq;
+  uint64_t sched_ns;
+  uint64_t send_ns;
+};
+typedef struct tgen_stamp_s tgen_stamp_t;
+
+uint64_t tgen_payload_base(uint64_t stream, uint64_t seq);
+void tgen_payload_fill(char *buf, int len, uint64_t stream, uint64_t seq);
+int tgen_payload_verify(const char *buf, int len, uint64_t stream, uint64_t seq);
+int tgen_payload_simd_get();
+int tgen_payload_simd_set(int simd);
+void tgen_stamp_write(char *buf, int len, tgen_stamp_t *stamp);
+int tgen_stamp_read(const char *buf, int len, tgen_stamp_t *stamp);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* TGEN_PAYLOAD_H */
@@ -0,0 +1,368 @@
+/* tgen_recv.c - Reference receiver for tgen traffic.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+/* Receives UDP datagrams in batches with recvmmsg() and, for messages
+ * with a tgen stamp header (see tgen_payload.h), tracks sequence gaps,
+ * duplicates, and reordering per stream and one-way latency. Linux only. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "cprt.h"  /* See https://github.com/fordsfords/cprt */
+#include "tgen_hist.h"
+#include "tgen_payload.h"
+
+
+#define TGEN_RECV_MAX_BATCH 1024
+#define TGEN_RECV_MAX_LEN 65536
+#define TGEN_RECV_MAX_STREAMS 256
+/* Duplicates and late arrivals are told apart within this many seqs
+ * of the highest seen (a power of 2). */
+#define TGEN_RECV_WINDOW 4096
+#define TGEN_RECV_POLL_MS 100  /* How often to check for idle/duration. */
+
+
+struct recv_stream_s {
+  uint32_t stream;
+  uint64_t highest_seq;  /* Highest seq seen. */
+  uint64_t msgs;
+  uint64_t lost;  /* Seqs skipped over and not (yet) seen. */
+  uint64_t dups;
+  uint64_t reordered;  /* Arrived after a higher seq. */
+  uint64_t too_old;  /* Behind the window; dup or late can't be told. */
+  uint64_t bad_payload;
+  uint64_t seen[TGEN_RECV_WINDOW / 64];  /* Bit per seq, by seq % window. */
+};
+typedef struct recv_stream_s recv_stream_t;
+
+
+/* Options */
+char *o_addr = "0.0.0.0";
+int o_batch = 64;
+int o_cpu = -1;
+int o_duration_sec = 0;
+int o_idle_ms = 1000;
+uint64_t o_num_msgs = 0;
+int o_port = -1;
+int o_verify = 0;
+
+void usage(int exit_status)
+{
+  printf("Usage: tgen_recv [-h] [-a addr] [-b batch] [-c cpu] [-d duration_sec] [-i idle_ms] [-n num_msgs] [-v] -p port\n");
+  exit(exit_status);
+}  /* usage */
+
+void get_my_options(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = cprt_getopt(argc, argv, "ha:b:c:d:i:n:p:v")) != EOF) {
+    switch (opt) {
+      case 'h': usage(0);
+      case 'a': o_addr = CPRT_STRDUP(cprt_optarg); break;
+      case 'b': CPRT_ATOI(cprt_optarg, o_batch); break;
+      case 'c': CPRT_ATOI(cprt_optarg, o_cpu); break;
+      case 'd': CPRT_ATOI(cprt_optarg, o_duration_sec); break;
+      case 'i': CPRT_ATOI(cprt_optarg, o_idle_ms); break;
+      case 'n': CPRT_ATOI(cprt_optarg, o_num_msgs); break;
+      case 'p': CPRT_ATOI(cprt_optarg, o_port); break;
+      case 'v': o_verify = 1; break;
+      default: usage(1);
+    }  /* switch */
+  }  /* while */
+
+  if (o_port < 0 || o_port > 65535) {
+    fprintf(stderr, "Port ('-p port') is required.\n");
+    usage(1);
+  }
+  if (o_batch < 1 || o_batch > TGEN_RECV_MAX_BATCH) {
+    fprintf(stderr, "Error: batch must be 1 to %d\n", TGEN_RECV_MAX_BATCH);
+    usage(1);
+  }
+}  /* get_my_options */
+
+
+recv_stream_t *streams[TGEN_RECV_MAX_STREAMS];
+int num_streams = 0;
+
+recv_stream_t *stream_find(uint32_t stream)
+{
+  recv_stream_t *rs;
+  int i;
+
+  for (i = 0; i < num_streams; i++) {
+    if (streams[i]->stream == stream) return streams[i];
+  }
+  if (num_streams == TGEN_RECV_MAX_STREAMS) {
+    return NULL;
+  }
+
+  CPRT_ENULL(rs = (recv_stream_t *)malloc(sizeof(recv_stream_t)));
+  memset(rs, 0, sizeof(recv_stream_t));
+  rs->stream = stream;
+  streams[num_streams++] = rs;
+  return rs;
+}  /* stream_find */
+
+
+#define SEEN_BIT(_rs, _seq) ((_rs)->seen[((_seq) % TGEN_RECV_WINDOW) / 64] & (1ull << ((_seq) % 64)))
+#define SEEN_SET(_rs, _seq) ((_rs)->seen[((_seq) % TGEN_RECV_WINDOW) / 64] |= (1ull << ((_seq) % 64)))
+#define SEEN_CLR(_rs, _seq) ((_rs)->seen[((_seq) % TGEN_RECV_WINDOW) / 64] &= ~(1ull << ((_seq) % 64)))
+
+/* Account for "seq" arriving on "rs". */
+void stream_seq(recv_stream_t *rs, uint64_t seq)
+{
+  rs->msgs++;
+
+  if (rs->msgs == 1) {
+    /* Seqs before the first one received are not counted as lost
+     * (the receiver may have started late). */
+    rs->highest_seq = seq;
+    SEEN_SET(rs, seq);
+  }
+  else if (seq > rs->highest_seq) {
+    uint64_t skipped = seq - rs->highest_seq - 1;
+    uint64_t s;
+
+    rs->lost += skipped;
+    if (skipped >= TGEN_RECV_WINDOW) {
+      memset(rs->seen, 0, sizeof(rs->seen));
+    }
+    else {
+      for (s = rs->highest_seq + 1; s < seq; s++) {
+        SEEN_CLR(rs, s);
+      }
+    }
+    rs->highest_seq = seq;
+    SEEN_SET(rs, seq);
+  }
+  else if (rs->highest_seq - seq >= TGEN_RECV_WINDOW) {
+    rs->too_old++;
+  }
+  else if (SEEN_BIT(rs, seq)) {
+    rs->dups++;
+  }
+  else {
+    /* A seq counted as lost turned up late. */
+    rs->reordered++;
+    rs->lost--;
+    SEEN_SET(rs, seq);
+  }
+}  /* stream_seq */
+
+
+void hist_print(char *name, tgen_hist_t *hist)
+{
+  printf("%s count=%" PRIu64 " p50=%" PRIu64 " p99=%" PRIu64 " p99.9=%" PRIu64 " max=%" PRIu64 "\n",
+      name, hist->count,
+      tgen_hist_percentile(hist, 50.0), tgen_hist_percentile(hist, 99.0),
+      tgen_hist_percentile(hist, 99.9), hist->max);
+}  /* hist_print */
+
+
+/* Receive time of "msg": the kernel's time stamp if there is one,
+ * otherwise "batch_ns" (read once per batch). */
+uint64_t msg_recv_ns(struct msghdr *msg, uint64_t batch_ns)
+{
+  struct cmsghdr *cmsg;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      struct timespec ts;
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+  }
+  return batch_ns;
+}  /* msg_recv_ns */
+
+
+int main(int argc, char **argv)
+{
+  struct mmsghdr *msgs;
+  struct iovec *iovs;
+  char *bufs;
+  char *ctls;
+  size_t ctl_size = CMSG_SPACE(sizeof(struct timespec));
+  struct sockaddr_in sin;
+  struct timeval tv;
+  tgen_hist_t *latency_hist;
+  tgen_hist_t *sched_hist;
+  uint64_t total_msgs = 0;
+  uint64_t total_bytes = 0;
+  uint64_t unstamped = 0;
+  uint64_t negative = 0;
+  uint64_t first_ns = 0;
+  uint64_t last_ns = 0;
+  uint64_t start_ns;
+  uint64_t now_ns;
+  int on = 1;
+  int rcvbuf = 8 * 1024 * 1024;
+  int sock;
+  int i;
+
+  get_my_options(argc, argv);
+
+  if (o_cpu >= 0) {
+    cprt_set_affinity((uint64_t)1 << o_cpu);
+  }
+
+  CPRT_EM1(sock = socket(AF_INET, SOCK_DGRAM, 0));
+  CPRT_EM1(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)));
+  CPRT_EM1(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)));
+  /* Best effort; the kernel caps it at net.core.rmem_max. */
+  (void)setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  tv.tv_sec = 0;
+  tv.tv_usec = TGEN_RECV_POLL_MS * 1000;
+  CPRT_EM1(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons((uint16_t)o_port);
+  if (inet_pton(AF_INET, o_addr, &sin.sin_addr) != 1) {
+    fprintf(stderr, "Error: invalid address '%s'\n", o_addr);
+    exit(1);
+  }
+  CPRT_EM1(bind(sock, (struct sockaddr *)&sin, sizeof(sin)));
+
+  CPRT_ENULL(msgs = (struct mmsghdr *)malloc(o_batch * sizeof(struct mmsghdr)));
+  CPRT_ENULL(iovs = (struct iovec *)malloc(o_batch * sizeof(struct iovec)));
+  CPRT_ENULL(bufs = (char *)malloc((size_t)o_batch * TGEN_RECV_MAX_LEN));
+  CPRT_ENULL(ctls = (char *)malloc(o_batch * ctl_size));
+  latency_hist = tgen_hist_create();
+  sched_hist = tgen_hist_create();
+
+  printf("tgen_recv: port %d, batch %d, cpu %d\n", o_port, o_batch, o_cpu);
+  fflush(stdout);
+
+  for (i = 0; i < o_batch; i++) {
+    iovs[i].iov_base = &bufs[(size_t)i * TGEN_RECV_MAX_LEN];
+    iovs[i].iov_len = TGEN_RECV_MAX_LEN;
+    memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = &ctls[i * ctl_size];
+    msgs[i].msg_hdr.msg_controllen = ctl_size;
+  }
+
+  start_ns = cprt_realtime_ns();
+  while (1) {
+    int num_rcvd;
+
+    num_rcvd = recvmmsg(sock, msgs, o_batch, MSG_WAITFORONE, NULL);
+    now_ns = cprt_realtime_ns();
+    if (num_rcvd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        CPRT_EM1(num_rcvd);
+      }
+      num_rcvd = 0;
+    }
+
+    for (i = 0; i < num_rcvd; i++) {
+      char *buf = (char *)iovs[i].iov_base;
+      int len = (int)msgs[i].msg_len;
+      uint64_t recv_ns = msg_recv_ns(&msgs[i].msg_hdr, now_ns);
+      tgen_stamp_t stamp;
+      recv_stream_t *rs;
+
+      total_msgs++;
+      total_bytes += len;
+      if (first_ns == 0) {
+        first_ns = recv_ns;
+      }
+      last_ns = recv_ns;
+
+      if (! tgen_stamp_read(buf, len, &stamp)
+          || (rs = stream_find(stamp.stream)) == NULL) {
+        unstamped++;
+        continue;
+      }
+      stream_seq(rs, stamp.seq);
+
+      /* Clocks on different hosts can disagree; count, don't record. */
+      if (recv_ns >= stamp.send_ns) {
+        tgen_hist_record(latency_hist, recv_ns - stamp.send_ns);
+        tgen_hist_record(sched_hist, recv_ns - stamp.sched_ns);
+      }
+      else {
+        negative++;
+      }
+
+      if (o_verify && len > TGEN_STAMP_SIZE
+          && tgen_payload_verify(&buf[TGEN_STAMP_SIZE], len - TGEN_STAMP_SIZE,
+              stamp.stream, stamp.seq) != -1) {
+        rs->bad_payload++;
+      }
+    }
+    /* The kernel shortens these to what it filled in. */
+    for (i = 0; i < num_rcvd; i++) {
+      msgs[i].msg_hdr.msg_controllen = ctl_size;
+    }
+
+    if (o_num_msgs > 0 && total_msgs >= o_num_msgs) break;
+    if (o_duration_sec > 0 && now_ns - start_ns >= (uint64_t)o_duration_sec * 1000000000) break;
+    if (o_idle_ms > 0 && total_msgs > 0 && num_rcvd == 0
+        && now_ns - last_ns >= (uint64_t)o_idle_ms * 1000000) break;
+  }  /* while 1 */
+
+  {
+    uint64_t usec = (last_ns - first_ns) / 1000;
+    uint64_t lost = 0, dups = 0, reordered = 0, too_old = 0, bad_payload = 0;
+
+    for (i = 0; i < num_streams; i++) {
+      lost += streams[i]->lost;
+      dups += streams[i]->dups;
+      reordered += streams[i]->reordered;
+      too_old += streams[i]->too_old;
+      bad_payload += streams[i]->bad_payload;
+    }
+    if (usec == 0) {
+      usec = 1;
+    }
+    printf("recv msgs=%" PRIu64 " bytes=%" PRIu64 " duration_usec=%" PRIu64
+        ", rate=%" PRIu64 ", bytes_per_sec=%" PRIu64
+        ", streams=%d, lost=%" PRIu64 ", dups=%" PRIu64 ", reordered=%" PRIu64
+        ", too_old=%" PRIu64 ", bad_payload=%" PRIu64 ", unstamped=%" PRIu64
+        ", negative_latency=%" PRIu64 "\n",
+        total_msgs, total_bytes, (last_ns - first_ns) / 1000,
+        (uint64_t)((double)total_msgs * 1000000.0 / (double)usec),
+        (uint64_t)((double)total_bytes * 1000000.0 / (double)usec),
+        num_streams, lost, dups, reordered, too_old, bad_payload, unstamped, negative);
+    for (i = 0; i < num_streams; i++) {
+      recv_stream_t *rs = streams[i];
+      printf("stream %u msgs=%" PRIu64 " highest_seq=%" PRIu64 ", lost=%" PRIu64
+          ", dups=%" PRIu64 ", reordered=%" PRIu64 ", too_old=%" PRIu64
+          ", bad_payload=%" PRIu64 "\n",
+          rs->stream, rs->msgs, rs->highest_seq, rs->lost, rs->dups,
+          rs->reordered, rs->too_old, rs->bad_payload);
+    }
+    hist_print("latency_ns", latency_hist);
+    hist_print("sched_latency_ns", sched_hist);
+  }
+
+  for (i = 0; i < num_streams; i++) {
+    free(streams[i]);
+  }
+  tgen_hist_delete(latency_hist);
+  tgen_hist_delete(sched_hist);
+  free(ctls);
+  free(bufs);
+  free(iovs);
+  free(msgs);
+  close(sock);
+
+  return 0;
+}  /* main */
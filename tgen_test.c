@@ -15,6 +15,11 @@
 #include <string.h>
 #include "cprt.h"
 #include "tgen.h"
+#include "tgen_payload.h"
+#if defined(__linux__)
+#include "tgen_udp.h"
+#include "tgen_uring.h"
+#endif
 
 
 struct my_data_s {
@@ -24,13 +29,19 @@ typedef struct my_data_s my_data_t;
 
 
 /* Options */
+int o_batch = 0;
+int o_bufs = 0;
 int o_flags = 0;
+char *o_script_file = NULL;
 char *o_script_str = NULL;
 int o_test_num = -1;
+char *o_udp_dest = NULL;
+char *o_uring_dest = NULL;
+int o_uring_sqpoll = 0;
 
 void usage(int exit_status)
 {
-  printf("Usage: tgen_test [-h] [-s script_string] [-t test_num]\n");
+  printf("Usage: tgen_test [-h] [-b] [-p] [-f flags] [-s script_string] [-F script_file] [-t test_num] [-u addr:port] [-r addr:port] [-q]\n");
   exit(exit_status);
 }  /* usage */
 
@@ -38,12 +49,18 @@ void get_my_options(int argc, char **argv)
 {
   int opt;
 
-  while ((opt = cprt_getopt(argc, argv, "hf:s:t:")) != EOF) {
+  while ((opt = cprt_getopt(argc, argv, "hbpqf:r:s:t:u:F:")) != EOF) {
     switch (opt) {
       case 'h': usage(0);
+      case 'b': o_batch = 1; break;
+      case 'p': o_bufs = 1; break;
+      case 'q': o_uring_sqpoll = 1; break;
       case 'f': CPRT_ATOI(cprt_optarg, o_flags); break;
+      case 'F': o_script_file = CPRT_STRDUP(cprt_optarg); break;
+      case 'r': o_uring_dest = CPRT_STRDUP(cprt_optarg); break;
       case 's': o_script_str = CPRT_STRDUP(cprt_optarg); break;
       case 't': CPRT_ATOI(cprt_optarg, o_test_num); break;
+      case 'u': o_udp_dest = CPRT_STRDUP(cprt_optarg); break;
       default: usage(1);
     }  /* switch */
   }  /* while */
@@ -66,6 +83,48 @@ void my_send(tgen_t *tgen, int len)
 }  /* my_send */
 
 
+void my_send_batch(tgen_t *tgen, int len, int count)
+{
+  my_data_t *my_data = (my_data_t *)tgen_user_data_get(tgen);
+  CPRT_ASSERT(my_data->test_int == 314159);
+  CPRT_ASSERT(count > 1);
+  fprintf(stderr, "send batch %d %d\n", len, count);
+}  /* my_send_batch */
+
+
+void my_send_buf(tgen_t *tgen, char *buf, int len)
+{
+  static char *prev_buf = NULL;
+  my_data_t *my_data = (my_data_t *)tgen_user_data_get(tgen);
+  CPRT_ASSERT(my_data->test_int == 314159);
+  CPRT_ASSERT(((uintptr_t)buf % TGEN_CACHE_LINE) == 0);
+  CPRT_ASSERT(buf != prev_buf);
+  prev_buf = buf;
+  if (tgen->stamp_on) {
+    tgen_stamp_t stamp;
+    CPRT_ASSERT(tgen_stamp_read(buf, len, &stamp) == (len >= TGEN_STAMP_SIZE));
+    if (len >= TGEN_STAMP_SIZE) {
+      CPRT_ASSERT(stamp.stream == tgen->payload_stream && stamp.seq == tgen_payload_seq_get(tgen));
+      CPRT_ASSERT(stamp.send_ns >= stamp.sched_ns);
+      fprintf(stderr, "stamp %u %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+          stamp.stream, stamp.seq, stamp.sched_ns, stamp.send_ns);
+    }
+    if (tgen->payload_mode == TGEN_PAYLOAD_PATTERN && len > TGEN_STAMP_SIZE) {
+      CPRT_ASSERT(tgen_payload_verify(&buf[TGEN_STAMP_SIZE], len - TGEN_STAMP_SIZE,
+          tgen->payload_stream, tgen_payload_seq_get(tgen)) == -1);
+    }
+  }
+  else if (tgen->payload_mode == TGEN_PAYLOAD_PATTERN) {
+    CPRT_ASSERT(tgen_payload_verify(buf, len, tgen->payload_stream, tgen_payload_seq_get(tgen)) == -1);
+    fprintf(stderr, "payload %d %d\n", (int)tgen->payload_stream, (int)tgen_payload_seq_get(tgen));
+  }
+  if (len > 0) {
+    buf[len - 1] = 1;  /* Must be writable out to len. */
+  }
+  fprintf(stderr, "send buf %d\n", len);
+}  /* my_send_buf */
+
+
 void my_variable_change(tgen_t *tgen, char var_id, int value)
 {
   CPRT_ASSERT(value == tgen_variable_get(tgen, var_id));
@@ -79,16 +138,61 @@ void test0()
 {
   my_data_t my_data;
   tgen_t *tgen;
+#if defined(__linux__)
+  tgen_udp_t *udp = NULL;
+  tgen_uring_t *uring = NULL;
+#endif
 
-  CPRT_ASSERT(o_script_str != NULL);
+  CPRT_ASSERT(o_script_str != NULL || o_script_file != NULL);
 
   my_data.test_int = 314159;
   tgen = tgen_create(o_flags, &my_data);
+  if (o_batch) {
+    tgen_send_batch_set(tgen, my_send_batch);
+  }
+  if (o_bufs) {
+    tgen_send_buf_set(tgen, my_send_buf);
+  }
+#if defined(__linux__)
+  if (o_udp_dest != NULL) {
+    char *colon = strchr(o_udp_dest, ':');
+    int port;
+    CPRT_ASSERT(colon != NULL);
+    *colon = '\0';
+    CPRT_ATOI(colon + 1, port);
+    udp = tgen_udp_create(tgen, o_udp_dest, port);
+  }
+  if (o_uring_dest != NULL) {
+    char *colon = strchr(o_uring_dest, ':');
+    int port;
+    CPRT_ASSERT(colon != NULL);
+    *colon = '\0';
+    CPRT_ATOI(colon + 1, port);
+    uring = tgen_uring_create(tgen, o_uring_dest, port, o_uring_sqpoll ? TGEN_URING_SQPOLL : 0);
+  }
+#endif
 
-  tgen_add_multi_steps(tgen, o_script_str);
+  /* The string, if any, comes before the file. Errors are left for
+   * tgen_run() to refuse. */
+  if (o_script_str != NULL) {
+    (void)tgen_add_multi_steps(tgen, o_script_str);
+  }
+  if (o_script_file != NULL) {
+    (void)tgen_add_script_file(tgen, o_script_file);
+  }
 
   tgen_run(tgen);
 
+#if defined(__linux__)
+  if (udp != NULL) {
+    tgen_udp_print(udp);
+    tgen_udp_delete(udp);
+  }
+  if (uring != NULL) {
+    tgen_uring_print(uring);
+    tgen_uring_delete(uring);
+  }
+#endif
   tgen_delete(tgen);
 }  /* test0 */
 
@@ -96,18 +200,24 @@ void test0()
 void test1()
 {
   tgen_t *tgen;
-  int initial_max_steps;
-  int i;
+  size_t initial_max_size;
+  size_t i;
 
   tgen = tgen_create(o_flags, NULL);
 
-  initial_max_steps = tgen->script->max_steps;
-  for (i = 0; i < initial_max_steps; i++) {
-    tgen_add_step(tgen, "sendc 1 bytes 999999 mpersec 1 msgs");
+  /* Rate and count both fit in 32 bits: 16-byte records. */
+  initial_max_size = tgen->script->max_size;
+  for (i = 0; i < initial_max_size / 16; i++) {
+    tgen_add_step(tgen, "sendc 1 bytes 999 kpersec 1 msgs");
   }
-  CPRT_ASSERT(initial_max_steps == tgen->script->max_steps);
+  CPRT_ASSERT(initial_max_size == tgen->script->size);
+  CPRT_ASSERT(initial_max_size == tgen->script->max_size);
+  tgen_add_step(tgen, "sendc 1 bytes 999 kpersec 1 msgs");
+  CPRT_ASSERT(2 * initial_max_size == tgen->script->max_size);
+  /* The rate doesn't: 24 bytes. */
   tgen_add_step(tgen, "sendc 1 bytes 999999 mpersec 1 msgs");
-  CPRT_ASSERT(2 * initial_max_steps == tgen->script->max_steps);
+  CPRT_ASSERT(initial_max_size + 16 + 24 == tgen->script->size);
+  CPRT_ASSERT((int)(initial_max_size / 16) + 2 == tgen->script->num_steps);
 
   tgen_delete(tgen);
 }  /* test1 */
@@ -123,7 +233,9 @@ void test2()
   my_data.test_int = 314159;
   tgen = tgen_create(o_flags, &my_data);
 
-  tgen_add_multi_steps(tgen, o_script_str);
+  if (tgen_add_multi_steps(tgen, o_script_str) > 0) {
+    exit(1);  /* Errors already reported. */
+  }
 
   tgen_run(tgen);
 
@@ -158,6 +270,197 @@ void test3()
 }  /* test3 */
 
 
+/* Check histogram bucketing and percentiles. */
+void test4()
+{
+  tgen_hist_t *hist1;
+  tgen_hist_t *hist2;
+  uint64_t value;
+  uint64_t p50;
+
+  /* Each value lands in a bucket whose top is within 1/32 above it. */
+  for (value = 0; value < 100000000; value = value * 17 / 16 + 1) {
+    uint64_t high = tgen_hist_bucket_high(tgen_hist_bucket_index(value));
+    CPRT_ASSERT(high >= value);
+    CPRT_ASSERT(high - value <= value / TGEN_HIST_SUB_COUNT);
+  }
+  CPRT_ASSERT(tgen_hist_bucket_index((uint64_t)-1) == TGEN_HIST_BUCKETS - 1);
+  CPRT_ASSERT(tgen_hist_bucket_high(TGEN_HIST_BUCKETS - 1) == (uint64_t)-1);
+
+  hist1 = tgen_hist_create();
+  hist2 = tgen_hist_create();
+  CPRT_ASSERT(tgen_hist_percentile(hist1, 50.0) == 0);
+  for (value = 1; value <= 1000; value++) {
+    tgen_hist_record(hist1, value);
+  }
+  p50 = tgen_hist_percentile(hist1, 50.0);
+  CPRT_ASSERT(p50 >= 500 && p50 <= 500 + 500 / TGEN_HIST_SUB_COUNT);
+  CPRT_ASSERT(tgen_hist_percentile(hist1, 100.0) == 1000);
+  CPRT_ASSERT(hist1->min == 1 && hist1->max == 1000);
+
+  tgen_hist_record(hist2, 5000);
+  tgen_hist_merge(hist2, hist1);
+  CPRT_ASSERT(hist2->count == 1001 && hist2->max == 5000 && hist2->min == 1);
+  CPRT_ASSERT(tgen_hist_percentile(hist2, 99.9) <= 1000 + 1000 / TGEN_HIST_SUB_COUNT);
+  CPRT_ASSERT(tgen_hist_percentile(hist2, 100.0) == 5000);
+
+  tgen_hist_delete(hist1);
+  tgen_hist_delete(hist2);
+}  /* test4 */
+
+
+/* Check that every payload implementation writes the same bytes, and
+ * that verify finds the first bad byte. */
+void test5()
+{
+  char *expect_buf;
+  char *buf;
+  int best;
+  int simd;
+  int len;
+
+  CPRT_ENULL(expect_buf = (char *)malloc(70000));
+  CPRT_ENULL(buf = (char *)malloc(70001));
+  best = tgen_payload_simd_set(TGEN_PAYLOAD_SIMD_AVX2);
+
+  for (len = 0; len <= 70000; len += (len < 300) ? 1 : 997) {
+    tgen_payload_simd_set(TGEN_PAYLOAD_SIMD_SCALAR);
+    tgen_payload_fill(expect_buf, len, 7, 1000 + len);
+    if (len >= 16) {
+      uint64_t base = tgen_payload_base(7, 1000 + len);
+      uint64_t word1 = base + TGEN_PAYLOAD_INC;
+      CPRT_ASSERT((unsigned char)expect_buf[0] == (base & 0xff));
+      CPRT_ASSERT((unsigned char)expect_buf[15] == (word1 >> 56));
+    }
+
+    for (simd = TGEN_PAYLOAD_SIMD_SCALAR; simd <= best; simd++) {
+      CPRT_ASSERT(tgen_payload_simd_set(simd) == simd);
+      /* Unaligned, to be sure the SIMD versions don't need alignment. */
+      memset(buf, 0x5a, 70001);
+      tgen_payload_fill(&buf[1], len, 7, 1000 + len);
+      CPRT_ASSERT(memcmp(&buf[1], expect_buf, len) == 0);
+      CPRT_ASSERT(tgen_payload_verify(&buf[1], len, 7, 1000 + len) == -1);
+      CPRT_ASSERT(len < 8 || tgen_payload_verify(&buf[1], len, 8, 1000 + len) != -1);
+      CPRT_ASSERT(len < 8 || tgen_payload_verify(&buf[1], len, 7, 1001 + len) != -1);
+      if (len > 0) {
+        buf[1 + len - 1] ^= 0x10;
+        CPRT_ASSERT(tgen_payload_verify(&buf[1], len, 7, 1000 + len) == len - 1);
+        buf[1 + len / 2] ^= 0x01;
+        CPRT_ASSERT(tgen_payload_verify(&buf[1], len, 7, 1000 + len) == len / 2);
+      }
+    }
+  }
+  printf("payload simd=%d\n", best);
+
+  free(expect_buf);
+  free(buf);
+}  /* test5 */
+
+
+/* Check the "skip" catch-up policy after stalls: one message is due,
+ * the next deadline is within an interval, and the phase is kept. */
+void test6()
+{
+  tgen_t *tgen;
+  tgen_pace_t pace;
+  uint64_t interval_fx;
+  uint64_t since_fx;
+  uint64_t start = 1000;
+  uint64_t cur_ticks;
+
+  tgen = tgen_create(o_flags, NULL);
+  tgen_run_catchup(tgen, TGEN_CATCHUP_SKIP, 0);
+
+  /* A quarter second behind at 3 Mmsgs/sec (a fractional interval). */
+  tgen_pace_init(tgen, &pace, 3000000, start);
+  cur_ticks = start + cprt_ticks_per_sec / 4;
+  CPRT_ASSERT(tgen_pace_due(&pace, cur_ticks, (uint64_t)-1) == 1);
+  CPRT_ASSERT(pace.deadline > cur_ticks - 1);
+  CPRT_ASSERT(pace.deadline <= cur_ticks + pace.interval + 1);
+  interval_fx = (pace.interval << 32) + pace.interval_frac;
+  since_fx = ((pace.deadline - start) << 32) + pace.deadline_frac;
+  CPRT_ASSERT(since_fx % interval_fx == 0);
+
+  /* An hour behind at a rate whose interval is under a tick on most
+   * clocks, which is billions of slots. */
+  tgen_pace_init(tgen, &pace, 0xffffffff, start);
+  cur_ticks = start + cprt_ticks_per_sec * 3600;
+  CPRT_ASSERT(tgen_pace_due(&pace, cur_ticks, (uint64_t)-1) == 1);
+  CPRT_ASSERT(pace.deadline > cur_ticks - 1);
+  CPRT_ASSERT(pace.deadline <= cur_ticks + pace.interval + 1);
+
+  tgen_delete(tgen);
+}  /* test6 */
+
+
+/* Random gaps: the Pareto tail is capped, and the skip policy sends an
+ * overdue msg and then waits one drawn gap. */
+void test7()
+{
+  tgen_t *tgen;
+  tgen_pace_t pace;
+  uint64_t zero_rng[2] = {0, 0};  /* Every uniform sample is the smallest. */
+  uint64_t start = 1000;
+  uint64_t cur_ticks;
+  double mean;
+
+  tgen = tgen_create(o_flags, NULL);
+
+  tgen_run_arrival(tgen, TGEN_ARRIVAL_PARETO, 101);
+  tgen_pace_init(tgen, &pace, 1, start);
+  pace.rng = zero_rng;
+  mean = (double)pace.interval;
+  CPRT_ASSERT(tgen_pace_due(&pace, start, (uint64_t)-1) == 1);
+  CPRT_ASSERT(pace.deadline - start <= (uint64_t)(mean * TGEN_GAP_MAX_MEANS) + 1);
+  CPRT_ASSERT(pace.deadline - start >= (uint64_t)(mean * TGEN_GAP_MAX_MEANS) - 1);
+
+  tgen_run_catchup(tgen, TGEN_CATCHUP_SKIP, 0);
+  tgen_run_arrival(tgen, TGEN_ARRIVAL_POISSON, 0);
+  tgen_pace_init(tgen, &pace, 1000000, start);
+  cur_ticks = start + cprt_ticks_per_sec * 3600;
+  CPRT_ASSERT(tgen_pace_due(&pace, cur_ticks, (uint64_t)-1) == 1);
+  CPRT_ASSERT(pace.deadline == cur_ticks + pace.gaps[pace.gap_index - 1]);
+
+  tgen_delete(tgen);
+}  /* test7 */
+
+
+/* The scheduled times of a catch-up's msgs are the pacing deadlines,
+ * with fractional intervals and with random gaps. */
+void test8()
+{
+  tgen_t *tgen;
+  tgen_pace_t pace;
+  uint64_t start = 1000;
+  uint64_t prev;
+  uint64_t sched;
+  uint64_t num_due;
+  uint64_t i;
+  int dist;
+
+  tgen = tgen_create(o_flags, NULL);
+  tgen_run_catchup(tgen, TGEN_CATCHUP_BURST, 100000);
+
+  for (dist = TGEN_ARRIVAL_EVEN; dist <= TGEN_ARRIVAL_POISSON; dist++) {
+    tgen_run_arrival(tgen, dist, 0);
+    tgen_pace_init(tgen, &pace, 3000000, start);
+    num_due = tgen_pace_due(&pace, start + cprt_ticks_per_sec / 1000, (uint64_t)-1);
+    CPRT_ASSERT(num_due > 1);
+    CPRT_ASSERT(tgen_pace_sched_next(&pace) == start);
+    prev = start;
+    for (i = 1; i < num_due; i++) {
+      sched = tgen_pace_sched_next(&pace);
+      CPRT_ASSERT(sched >= prev);
+      prev = sched;
+    }
+    /* The last msg's successor is the next deadline. */
+    CPRT_ASSERT(pace.sched == pace.deadline && pace.sched_frac == pace.deadline_frac);
+  }
+
+  tgen_delete(tgen);
+}  /* test8 */
+
+
 int main(int argc, char **argv)
 {
   get_my_options(argc, argv);
@@ -167,6 +470,11 @@ int main(int argc, char **argv)
     case 1: test1(); break;
     case 2: test2(); break;
     case 3: test3(); break;
+    case 4: test4(); break;
+    case 5: test5(); break;
+    case 6: test6(); break;
+    case 7: test7(); break;
+    case 8: test8(); break;
 
     default: fprintf(stderr, "unknown test %d\n", o_test_num); exit(1);
   }
@@ -0,0 +1,192 @@
+/* tgen_udp.c - Built-in UDP send backend.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+/* Sends tgen's messages as UDP datagrams to one destination. All of the
+ * messages due in a pacing iteration go out in a single sendmmsg() call
+ * (see tgen_send_bufs_set()). Linux only. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "cprt.h"  /* See https://github.com/fordsfords/cprt */
+#include "tgen.h"
+#include "tgen_udp.h"
+
+
+/* One per sending thread, so the pre-built headers are never shared. */
+struct tgen_udp_slot_s {
+  struct mmsghdr msgs[TGEN_SEND_BUFS_MAX];
+  struct iovec iovs[TGEN_SEND_BUFS_MAX];
+  uint64_t msgs_sent;  /* Taken by sendmmsg(). */
+  uint64_t syscalls;
+  uint64_t errors;  /* Messages dropped on a send error. */
+};
+typedef struct tgen_udp_slot_s tgen_udp_slot_t;
+
+
+tgen_udp_slot_t *tgen_udp_slot_create()
+{
+  tgen_udp_slot_t *slot;
+  int i;
+
+  /* Own cache lines; each is written by a different thread. */
+  CPRT_EOK0(errno = posix_memalign((void **)&slot, TGEN_CACHE_LINE, sizeof(tgen_udp_slot_t)));
+  memset(slot, 0, sizeof(tgen_udp_slot_t));
+  for (i = 0; i < TGEN_SEND_BUFS_MAX; i++) {
+    slot->msgs[i].msg_hdr.msg_iov = &slot->iovs[i];
+    slot->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  return slot;
+}  /* tgen_udp_slot_create */
+
+
+/* The tgen_send_bufs_cb_t: one sendmmsg() for all "count" messages,
+ * unless the kernel takes only part of them. A "count" 0 call (before
+ * the run) sets up the thread's slot. */
+void tgen_udp_send(tgen_t *tgen, void *cb_data, char **bufs, int *lens, int count)
+{
+  tgen_udp_t *udp = (tgen_udp_t *)cb_data;
+  tgen_udp_slot_t *slot = udp->slots[tgen_thread_num_get(tgen) + 1];
+  int done = 0;
+  int i;
+
+  if (slot == NULL) {
+    slot = tgen_udp_slot_create();
+    udp->slots[tgen_thread_num_get(tgen) + 1] = slot;
+  }
+  if (count == 0) {
+    return;  /* Nothing outstanding; sendmmsg() is synchronous. */
+  }
+
+  for (i = 0; i < count; i++) {
+    slot->iovs[i].iov_base = bufs[i];
+    slot->iovs[i].iov_len = lens[i];
+  }
+
+  while (done < count) {
+    int sent = sendmmsg(udp->sock, &slot->msgs[done], count - done, 0);
+    slot->syscalls++;
+    if (sent >= 0) {
+      done += sent;
+      slot->msgs_sent += sent;
+    }
+    else if (errno == ECONNREFUSED || errno == ENOBUFS || errno == EAGAIN
+        || errno == EHOSTUNREACH || errno == ENETUNREACH) {
+      /* Transient (e.g. nobody listening on loopback); drop this one. */
+      slot->errors++;
+      done++;
+    }
+    else if (errno != EINTR) {
+      fprintf(stderr, "Error: sendmmsg: %s\n", strerror(errno));
+      CPRT_ERR_EXIT;
+    }
+  }
+}  /* tgen_udp_send */
+
+
+/* Send "tgen"'s messages (and its thread blocks', if they are defined
+ * after this call) to IPv4 "addr" and "port". */
+tgen_udp_t *tgen_udp_create(tgen_t *tgen, char *addr, int port)
+{
+  tgen_udp_t *udp;
+  struct sockaddr_in sin;
+  int sndbuf = 8 * 1024 * 1024;
+
+  CPRT_ENULL(udp = (tgen_udp_t *)malloc(sizeof(tgen_udp_t)));
+  memset(udp, 0, sizeof(tgen_udp_t));
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons((uint16_t)port);
+  if (port < 0 || port > 65535 || inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+    fprintf(stderr, "Error: invalid udp destination '%s' port %d\n", addr, port);
+    CPRT_ERR_EXIT;
+  }
+
+  CPRT_EM1(udp->sock = socket(AF_INET, SOCK_DGRAM, 0));
+  /* Best effort; the kernel caps it at net.core.wmem_max. */
+  (void)setsockopt(udp->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  /* Connected, so the pre-built headers need no address. */
+  CPRT_EM1(connect(udp->sock, (struct sockaddr *)&sin, sizeof(sin)));
+
+  tgen_send_bufs_set(tgen, tgen_udp_send, udp);
+
+  return udp;
+}  /* tgen_udp_create */
+
+
+void tgen_udp_delete(tgen_udp_t *udp)
+{
+  int i;
+
+  for (i = 0; i < TGEN_UDP_SLOTS; i++) {
+    if (udp->slots[i] != NULL) {
+      free(udp->slots[i]);
+    }
+  }
+  CPRT_EM1(close(udp->sock));
+  free(udp);
+}  /* tgen_udp_delete */
+
+
+/* The totals below are over all threads; read them after tgen_run(). */
+uint64_t tgen_udp_msgs_get(tgen_udp_t *udp)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < TGEN_UDP_SLOTS; i++) {
+    if (udp->slots[i] != NULL) total += udp->slots[i]->msgs_sent;
+  }
+  return total;
+}  /* tgen_udp_msgs_get */
+
+
+uint64_t tgen_udp_syscalls_get(tgen_udp_t *udp)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < TGEN_UDP_SLOTS; i++) {
+    if (udp->slots[i] != NULL) total += udp->slots[i]->syscalls;
+  }
+  return total;
+}  /* tgen_udp_syscalls_get */
+
+
+uint64_t tgen_udp_errors_get(tgen_udp_t *udp)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < TGEN_UDP_SLOTS; i++) {
+    if (udp->slots[i] != NULL) total += udp->slots[i]->errors;
+  }
+  return total;
+}  /* tgen_udp_errors_get */
+
+
+void tgen_udp_print(tgen_udp_t *udp)
+{
+  uint64_t msgs = tgen_udp_msgs_get(udp);
+  uint64_t syscalls = tgen_udp_syscalls_get(udp);
+
+  printf("udp msgs=%" PRIu64 ", syscalls=%" PRIu64 ", syscalls_per_msg=%.4f, errors=%" PRIu64 "\n",
+      msgs, syscalls, (msgs > 0) ? (double)syscalls / (double)msgs : 0.0,
+      tgen_udp_errors_get(udp));
+}  /* tgen_udp_print */
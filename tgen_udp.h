@@ -0,0 +1,48 @@
+/* tgen_udp.h - Include file for the built-in UDP send backend.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+#ifndef TGEN_UDP_H
+#define TGEN_UDP_H
+
+#include "cprt.h"
+#include "tgen.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Per sending thread: the top-level instance and each thread block. */
+#define TGEN_UDP_SLOTS (TGEN_MAX_THREADS + 1)
+
+struct tgen_udp_slot_s;
+
+struct tgen_udp_s {
+  int sock;  /* Connected to the destination. */
+  struct tgen_udp_slot_s *slots[TGEN_UDP_SLOTS];  /* Allocated before the run. */
+};
+typedef struct tgen_udp_s tgen_udp_t;
+
+
+tgen_udp_t *tgen_udp_create(tgen_t *tgen, char *addr, int port);
+void tgen_udp_delete(tgen_udp_t *udp);
+uint64_t tgen_udp_msgs_get(tgen_udp_t *udp);
+uint64_t tgen_udp_syscalls_get(tgen_udp_t *udp);
+uint64_t tgen_udp_errors_get(tgen_udp_t *udp);
+void tgen_udp_print(tgen_udp_t *udp);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* TGEN_UDP_H */
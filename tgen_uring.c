@@ -0,0 +1,383 @@
+/* tgen_uring.c - io_uring send backend.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+/* Sends tgen's messages as UDP datagrams to one destination through an
+ * io_uring per sending thread. The send loop only queues a send for each
+ * message due (straight from tgen's payload buffers) and picks up
+ * whatever sends have completed; it waits only if the sends still in
+ * flight are about to hold up the payload ring. With TGEN_URING_SQPOLL,
+ * a kernel thread takes the submissions, so the send loop normally makes
+ * no syscalls at all. Uses the raw syscalls (no liburing). Linux only. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include "cprt.h"  /* See https://github.com/fordsfords/cprt */
+#include "tgen.h"
+#include "tgen_hist.h"
+#include "tgen_uring.h"
+
+
+/* Sends in flight are limited so that tgen never refills a buffer that
+ * the kernel has not finished with. */
+#define TGEN_URING_MAX_FLIGHT (TGEN_BUF_RING - TGEN_SEND_BUFS_MAX)
+
+
+/* One per sending thread; only that thread touches it while running. */
+struct tgen_uring_slot_s {
+  int fd;
+  int sqpoll;
+  void *sq_ptr;
+  size_t sq_len;
+  void *cq_ptr;
+  size_t cq_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_flags;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  uint64_t submitted;  /* Sends queued; each one's user_data is its count. */
+  uint64_t oldest;  /* Oldest send not completed. */
+  char done[TGEN_BUF_RING];  /* Completed out of order, by user_data. */
+  uint64_t submit_ticks[TGEN_BUF_RING];
+  uint64_t msgs_sent;  /* Sends completed, including errors. */
+  uint64_t syscalls;
+  uint64_t errors;  /* Sends that completed with an error (message dropped). */
+  tgen_hist_t *latency_hist;  /* Submission to completion, ns. */
+};
+typedef struct tgen_uring_slot_s tgen_uring_slot_t;
+
+
+int tgen_uring_enter(tgen_uring_slot_t *slot, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  int rtn;
+
+  slot->syscalls++;
+  rtn = (int)syscall(__NR_io_uring_enter, slot->fd, to_submit, min_complete, flags, NULL, 0);
+  if (rtn == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+    fprintf(stderr, "Error: io_uring_enter: %s\n", strerror(errno));
+    CPRT_ERR_EXIT;
+  }
+
+  return rtn;
+}  /* tgen_uring_enter */
+
+
+tgen_uring_slot_t *tgen_uring_slot_create(tgen_uring_t *uring)
+{
+  tgen_uring_slot_t *slot;
+  struct io_uring_params params;
+
+  CPRT_EOK0(errno = posix_memalign((void **)&slot, TGEN_CACHE_LINE, sizeof(tgen_uring_slot_t)));
+  memset(slot, 0, sizeof(tgen_uring_slot_t));
+  slot->latency_hist = tgen_hist_create();
+
+  memset(&params, 0, sizeof(params));
+  if (uring->flags & TGEN_URING_SQPOLL) {
+    slot->sqpoll = 1;
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = TGEN_URING_SQPOLL_IDLE_MS;
+  }
+  slot->fd = (int)syscall(__NR_io_uring_setup, TGEN_BUF_RING, &params);
+  if (slot->fd == -1) {
+    fprintf(stderr, "Error: io_uring_setup: %s\n", strerror(errno));
+    CPRT_ERR_EXIT;
+  }
+
+  slot->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  slot->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  slot->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  slot->sq_ptr = mmap(NULL, slot->sq_len, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, slot->fd, IORING_OFF_SQ_RING);
+  slot->cq_ptr = mmap(NULL, slot->cq_len, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, slot->fd, IORING_OFF_CQ_RING);
+  slot->sqes = (struct io_uring_sqe *)mmap(NULL, slot->sqes_len, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, slot->fd, IORING_OFF_SQES);
+  if (slot->sq_ptr == MAP_FAILED || slot->cq_ptr == MAP_FAILED || slot->sqes == MAP_FAILED) {
+    fprintf(stderr, "Error: io_uring mmap: %s\n", strerror(errno));
+    CPRT_ERR_EXIT;
+  }
+
+  slot->sq_head = (unsigned *)((char *)slot->sq_ptr + params.sq_off.head);
+  slot->sq_tail = (unsigned *)((char *)slot->sq_ptr + params.sq_off.tail);
+  slot->sq_mask = (unsigned *)((char *)slot->sq_ptr + params.sq_off.ring_mask);
+  slot->sq_flags = (unsigned *)((char *)slot->sq_ptr + params.sq_off.flags);
+  slot->sq_array = (unsigned *)((char *)slot->sq_ptr + params.sq_off.array);
+  slot->cq_head = (unsigned *)((char *)slot->cq_ptr + params.cq_off.head);
+  slot->cq_tail = (unsigned *)((char *)slot->cq_ptr + params.cq_off.tail);
+  slot->cq_mask = (unsigned *)((char *)slot->cq_ptr + params.cq_off.ring_mask);
+  slot->cqes = (struct io_uring_cqe *)((char *)slot->cq_ptr + params.cq_off.cqes);
+
+  return slot;
+}  /* tgen_uring_slot_create */
+
+
+void tgen_uring_slot_delete(tgen_uring_slot_t *slot)
+{
+  CPRT_EM1(munmap(slot->sqes, slot->sqes_len));
+  CPRT_EM1(munmap(slot->cq_ptr, slot->cq_len));
+  CPRT_EM1(munmap(slot->sq_ptr, slot->sq_len));
+  CPRT_EM1(close(slot->fd));
+  tgen_hist_delete(slot->latency_hist);
+  free(slot);
+}  /* tgen_uring_slot_delete */
+
+
+/* Pick up completed sends without blocking. The latency is measured to
+ * when the completion is seen, so it includes up to one pacing interval. */
+void tgen_uring_reap(tgen_uring_slot_t *slot)
+{
+  unsigned head = *slot->cq_head;  /* Only this thread writes it. */
+  unsigned tail = __atomic_load_n(slot->cq_tail, __ATOMIC_ACQUIRE);
+  uint64_t now_ticks;
+
+  if (head == tail) return;
+
+  CPRT_GETTICKS(now_ticks);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &slot->cqes[head & *slot->cq_mask];
+    uint64_t index = cqe->user_data % TGEN_BUF_RING;
+
+    if (cqe->res < 0) {
+      slot->errors++;  /* E.g. -ECONNREFUSED with nobody listening. */
+    }
+    slot->msgs_sent++;
+    tgen_hist_record(slot->latency_hist,
+        cprt_ticks_to_ns(now_ticks - slot->submit_ticks[index]));
+    slot->done[index] = 1;
+    head++;
+  }
+  __atomic_store_n(slot->cq_head, head, __ATOMIC_RELEASE);
+
+  while (slot->oldest < slot->submitted && slot->done[slot->oldest % TGEN_BUF_RING]) {
+    slot->done[slot->oldest % TGEN_BUF_RING] = 0;
+    slot->oldest++;
+  }
+}  /* tgen_uring_reap */
+
+
+/* Hand queued sends to the kernel and optionally wait for "min_complete"
+ * completions. With SQPOLL, the kernel thread takes them on its own, so
+ * there is a syscall only to wake it up or to wait. */
+void tgen_uring_submit(tgen_uring_slot_t *slot, unsigned min_complete)
+{
+  unsigned flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+  unsigned to_submit;
+
+  if (slot->sqpoll) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);  /* Tail store before flags load. */
+    if (__atomic_load_n(slot->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    if (flags != 0) {
+      (void)tgen_uring_enter(slot, 0, min_complete, flags);
+    }
+  }
+  else {
+    /* Includes any left over from a submit the kernel cut short. */
+    to_submit = *slot->sq_tail - __atomic_load_n(slot->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit > 0 || min_complete > 0) {
+      (void)tgen_uring_enter(slot, to_submit, min_complete, flags);
+    }
+  }
+}  /* tgen_uring_submit */
+
+
+/* Block until no more than "max_flight" sends are in flight. */
+void tgen_uring_wait(tgen_uring_slot_t *slot, uint64_t max_flight)
+{
+  tgen_uring_reap(slot);
+  while (slot->submitted - slot->oldest > max_flight) {
+    tgen_uring_submit(slot, 1);
+    tgen_uring_reap(slot);
+  }
+}  /* tgen_uring_wait */
+
+
+/* The tgen_send_bufs_cb_t: queue a send per message and submit them
+ * (with SQPOLL, only wake the kernel thread if it went idle). A "count"
+ * 0 call waits for all sends to complete, and before the run sets up
+ * the thread's ring. */
+void tgen_uring_send(tgen_t *tgen, void *cb_data, char **bufs, int *lens, int count)
+{
+  tgen_uring_t *uring = (tgen_uring_t *)cb_data;
+  tgen_uring_slot_t *slot = uring->slots[tgen_thread_num_get(tgen) + 1];
+  uint64_t now_ticks;
+  unsigned tail;
+  int i;
+
+  if (slot == NULL) {
+    slot = tgen_uring_slot_create(uring);
+    uring->slots[tgen_thread_num_get(tgen) + 1] = slot;
+  }
+
+  if (count == 0) {
+    tgen_uring_wait(slot, 0);
+    return;
+  }
+
+  tgen_uring_reap(slot);
+
+  CPRT_GETTICKS(now_ticks);
+  tail = *slot->sq_tail;  /* Only this thread writes it. */
+  for (i = 0; i < count; i++) {
+    unsigned sq_index = tail & *slot->sq_mask;
+    struct io_uring_sqe *sqe = &slot->sqes[sq_index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = uring->sock;
+    sqe->addr = (uint64_t)(uintptr_t)bufs[i];
+    sqe->len = lens[i];
+    sqe->user_data = slot->submitted;
+    slot->submit_ticks[slot->submitted % TGEN_BUF_RING] = now_ticks;
+    slot->sq_array[sq_index] = sq_index;
+    slot->submitted++;
+    tail++;
+  }
+  __atomic_store_n(slot->sq_tail, tail, __ATOMIC_RELEASE);
+  tgen_uring_submit(slot, 0);
+
+  if (slot->submitted - slot->oldest > TGEN_URING_MAX_FLIGHT) {
+    tgen_uring_wait(slot, TGEN_URING_MAX_FLIGHT);
+  }
+}  /* tgen_uring_send */
+
+
+/* Send "tgen"'s messages (and its thread blocks', if they are defined
+ * after this call) to IPv4 "addr" and "port". The top-level instance's
+ * ring is set up here; a thread block's before its thread starts. */
+tgen_uring_t *tgen_uring_create(tgen_t *tgen, char *addr, int port, int flags)
+{
+  tgen_uring_t *uring;
+  struct sockaddr_in sin;
+  int sndbuf = 8 * 1024 * 1024;
+
+  CPRT_ENULL(uring = (tgen_uring_t *)malloc(sizeof(tgen_uring_t)));
+  memset(uring, 0, sizeof(tgen_uring_t));
+  uring->flags = flags;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons((uint16_t)port);
+  if (port < 0 || port > 65535 || inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+    fprintf(stderr, "Error: invalid uring destination '%s' port %d\n", addr, port);
+    CPRT_ERR_EXIT;
+  }
+
+  CPRT_EM1(uring->sock = socket(AF_INET, SOCK_DGRAM, 0));
+  /* Best effort; the kernel caps it at net.core.wmem_max. */
+  (void)setsockopt(uring->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  CPRT_EM1(connect(uring->sock, (struct sockaddr *)&sin, sizeof(sin)));
+
+  uring->slots[0] = tgen_uring_slot_create(uring);
+
+  tgen_send_bufs_set(tgen, tgen_uring_send, uring);
+
+  return uring;
+}  /* tgen_uring_create */
+
+
+void tgen_uring_delete(tgen_uring_t *uring)
+{
+  int i;
+
+  for (i = 0; i < TGEN_URING_SLOTS; i++) {
+    if (uring->slots[i] != NULL) {
+      tgen_uring_slot_delete(uring->slots[i]);
+    }
+  }
+  CPRT_EM1(close(uring->sock));
+  free(uring);
+}  /* tgen_uring_delete */
+
+
+/* The totals below are over all threads; read them after tgen_run()
+ * (which waits for every send to complete). */
+uint64_t tgen_uring_msgs_get(tgen_uring_t *uring)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < TGEN_URING_SLOTS; i++) {
+    if (uring->slots[i] != NULL) total += uring->slots[i]->msgs_sent;
+  }
+  return total;
+}  /* tgen_uring_msgs_get */
+
+
+uint64_t tgen_uring_syscalls_get(tgen_uring_t *uring)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < TGEN_URING_SLOTS; i++) {
+    if (uring->slots[i] != NULL) total += uring->slots[i]->syscalls;
+  }
+  return total;
+}  /* tgen_uring_syscalls_get */
+
+
+uint64_t tgen_uring_errors_get(tgen_uring_t *uring)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < TGEN_URING_SLOTS; i++) {
+    if (uring->slots[i] != NULL) total += uring->slots[i]->errors;
+  }
+  return total;
+}  /* tgen_uring_errors_get */
+
+
+/* Merge the submission-to-completion latencies (ns) into "hist". */
+void tgen_uring_latency_hist_get(tgen_uring_t *uring, tgen_hist_t *hist)
+{
+  int i;
+
+  for (i = 0; i < TGEN_URING_SLOTS; i++) {
+    if (uring->slots[i] != NULL) tgen_hist_merge(hist, uring->slots[i]->latency_hist);
+  }
+}  /* tgen_uring_latency_hist_get */
+
+
+void tgen_uring_print(tgen_uring_t *uring)
+{
+  tgen_hist_t *hist = tgen_hist_create();
+  uint64_t msgs = tgen_uring_msgs_get(uring);
+  uint64_t errors = tgen_uring_errors_get(uring);
+  uint64_t syscalls = tgen_uring_syscalls_get(uring);
+
+  tgen_uring_latency_hist_get(uring, hist);
+  printf("uring msgs=%" PRIu64 ", syscalls=%" PRIu64 ", syscalls_per_msg=%.4f, errors=%" PRIu64 ", sqpoll=%d\n",
+      msgs, syscalls, (msgs > 0) ? (double)syscalls / (double)msgs : 0.0,
+      errors, (uring->flags & TGEN_URING_SQPOLL) ? 1 : 0);
+  printf("uring_latency_ns count=%" PRIu64 " p50=%" PRIu64 " p99=%" PRIu64 " p99.9=%" PRIu64 " max=%" PRIu64 "\n",
+      hist->count,
+      tgen_hist_percentile(hist, 50.0), tgen_hist_percentile(hist, 99.0),
+      tgen_hist_percentile(hist, 99.9), hist->max);
+  tgen_hist_delete(hist);
+}  /* tgen_uring_print */
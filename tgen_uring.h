@@ -0,0 +1,54 @@
+/* tgen_uring.h - Include file for the io_uring send backend.
+ * See https://github.com/fordsfords/tgen */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/tgen
+ */
+
+#ifndef TGEN_URING_H
+#define TGEN_URING_H
+
+#include "cprt.h"
+#include "tgen.h"
+#include "tgen_hist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Flags for tgen_uring_create(). */
+#define TGEN_URING_SQPOLL 0x1  /* Kernel thread polls for submissions. */
+
+#define TGEN_URING_SLOTS (TGEN_MAX_THREADS + 1)
+#define TGEN_URING_SQPOLL_IDLE_MS 1000
+
+struct tgen_uring_slot_s;
+
+struct tgen_uring_s {
+  int sock;  /* Connected to the destination. */
+  int flags;  /* TGEN_URING_... */
+  struct tgen_uring_slot_s *slots[TGEN_URING_SLOTS];  /* A ring per thread. */
+};
+typedef struct tgen_uring_s tgen_uring_t;
+
+
+tgen_uring_t *tgen_uring_create(tgen_t *tgen, char *addr, int port, int flags);
+void tgen_uring_delete(tgen_uring_t *uring);
+uint64_t tgen_uring_msgs_get(tgen_uring_t *uring);
+uint64_t tgen_uring_syscalls_get(tgen_uring_t *uring);
+uint64_t tgen_uring_errors_get(tgen_uring_t *uring);
+void tgen_uring_latency_hist_get(tgen_uring_t *uring, tgen_hist_t *hist);
+void tgen_uring_print(tgen_uring_t *uring);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* TGEN_URING_H */
@@ -7,9 +7,25 @@ else :
   LIBS="-pthread -l m -l rt"
 fi
 
-gcc -Wall -g -o tgen_test cprt.c tgen.c tgen_test.c $LIBS
+# The UDP and io_uring backends are Linux only.
+if echo "$OSTYPE" | egrep -i linux >/dev/null; then :
+  LINUX_SRCS="tgen_udp.c tgen_uring.c"
+else :
+  LINUX_SRCS=""
+fi
+
+gcc -Wall -g -o tgen_test cprt.c tgen.c tgen_hist.c tgen_payload.c $LINUX_SRCS tgen_test.c $LIBS
 if [ $? -ne 0 ]; then echo error in tgen.c; exit 1; fi
 
+gcc -Wall -g -o tgen_bench cprt.c tgen.c tgen_hist.c tgen_payload.c tgen_bench.c $LIBS
+if [ $? -ne 0 ]; then echo error in tgen_bench.c; exit 1; fi
+
+# tgen_recv uses recvmmsg(), which is Linux only.
+if echo "$OSTYPE" | egrep -i linux >/dev/null; then :
+  gcc -Wall -g -o tgen_recv cprt.c tgen_hist.c tgen_payload.c tgen_recv.c $LIBS
+  if [ $? -ne 0 ]; then echo error in tgen_recv.c; exit 1; fi
+fi
+
 # Update doc table of contents (see https://github.com/fordsfords/mdtoc).
 if which mdtoc.pl >/dev/null; then mdtoc.pl -b "" README.md;
 elif [ -x ../mdtoc/mdtoc.pl ]; then ../mdtoc/mdtoc.pl -b "" README.md;
@@ -46,6 +62,14 @@ if egrep "sendt, 700 100 20000000" tgen_test.2 >/dev/null; then :; else echo fai
 if egrep "tgen_parse_step: unrecognized input line: 'bad command" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
 if egrep "sendt, 700 100 21000000" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
 if egrep "sendt, 700 100 3000000" tgen_test.2 >/dev/null; then :; else echo failed 5; exit 1; fi
+
+# A loop typed at the repl prompt jumps back into the script.
+./tgen_test -t 2 -f 3 -s "set i 3; label a; sendt 700 bytes 100 persec 1 sec; repl; sendt 700 bytes 100 persec 2 sec" >tgen_test.1 2>tgen_test.2 <<__EOF__
+loop a i
+__EOF__
+if [ "$?" -ne 0 ]; then echo failed 6; exit 1; fi
+if [ "`egrep -c "^sendt, 700 100 1000000$" tgen_test.2`" -ne 2 ]; then echo failed 7; exit 1; fi
+if [ "`egrep -c "^sendt, 700 100 2000000$" tgen_test.2`" -ne 1 ]; then echo failed 8; exit 1; fi
 echo passed
 
 echo test3
@@ -179,3 +203,656 @@ T=`sed -n 's/real \([0-9]*\)\.\([0-9]*\)$/\1\2/p' <time.out`
 if [ "$T" -lt 98 -o "$T" -gt 102 ]; then echo failed 3; exit 1; fi
 if egrep "sendc len=700 rate=100 num_msgs=101, actual rate=100" tgen_test.1 >/dev/null; then :; else echo failed 4; exit 1; fi
 echo passed
+
+echo test10
+# Max rate, so the catch-up loop sends up to 20 messages per batch call.
+./tgen_test -b -t 0 -s "sendc 700 bytes 999 mpersec 1000 msgs" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if egrep "send batch 700 " tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+SEND_CNT=`awk '/^send message 700$/ {n++} /^send batch 700 / {n += $4} END {print n}' <tgen_test.2`
+if [ "$SEND_CNT" -ne 1000 ]; then echo failed 3; exit 1; fi
+echo passed
+
+echo test11
+rm -f time.out
+# Hybrid sleep (flag 4) with print rate (flag 2); most of the time is slept.
+command time -p -o time.out ./tgen_test -f 6 -t 0 -s "sendt 700 bytes 10 persec 1 sec; delay 500 msec" >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+SEND_CNT="`egrep "send message" <tgen_test.2 | wc -l`"
+if [ $SEND_CNT -ne 10 ]; then echo failed 2; exit 1; fi
+T=`sed -n 's/real \([0-9]*\)\.\([0-9]*\)$/\1\2/p' <time.out`
+if [ "$T" -lt 148 -o "$T" -gt 152 ]; then echo failed 3; exit 1; fi
+# Timer wakeup latency can make the actual rate 9.99 (printed as 9).
+if egrep "sendt len=700 rate=10 duration_usec=1000000, actual rate=(9|10), actual msgs=10, actual bytes=7000, slept_usec=99[0-9][0-9][0-9][0-9]$" tgen_test.1 >/dev/null; then :; else echo failed 4; exit 1; fi
+# Each step prints its own time slept, not the total so far.
+./tgen_test -f 6 -t 0 -s "sendt 700 bytes 10 persec 500 msec; sendt 700 bytes 10 persec 500 msec" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 5; exit 1; fi
+if [ "`egrep -c ", slept_usec=4[89][0-9][0-9][0-9][0-9]$" tgen_test.1`" -ne 2 ]; then echo failed 6; exit 1; fi
+echo passed
+
+echo test12
+rm -f time.out
+# Same as test9, but force the CPRT_GETTIME tick clock instead of the TSC.
+CPRT_NO_TSC=1 command time -p -o time.out ./tgen_test -f 2 -t 2 -s "set z 271828; sendc 700 bytes 100 persec 101 msgs" >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+SEND_CNT="`egrep "send message" <tgen_test.2 | wc -l`"
+if [ $SEND_CNT -ne 101 ]; then echo failed 2; exit 1; fi
+T=`sed -n 's/real \([0-9]*\)\.\([0-9]*\)$/\1\2/p' <time.out`
+if [ "$T" -lt 98 -o "$T" -gt 102 ]; then echo failed 3; exit 1; fi
+if egrep "sendc len=700 rate=100 num_msgs=101, actual rate=100" tgen_test.1 >/dev/null; then :; else echo failed 4; exit 1; fi
+echo passed
+
+echo test13
+./tgen_test -t 2 -f 3 -s "catchup burst 5; catchup skip; catchup token 64 # comment" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`wc -l <tgen_test.2`" -ne 3 ]; then echo failed 2; exit 1; fi
+if egrep "catchup, 1 5" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+if egrep "catchup, 2 0" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
+if egrep "catchup, 3 64" tgen_test.2 >/dev/null; then :; else echo failed 5; exit 1; fi
+
+# Max rate, so catch-up policy determines the batch sizes.
+./tgen_test -b -t 0 -s "catchup burst 5; sendc 700 bytes 999 mpersec 1000 msgs" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 6; exit 1; fi
+SEND_CNT=`awk '/^send message 700$/ {n++} /^send batch 700 / {n += $4} END {print n}' <tgen_test.2`
+if [ "$SEND_CNT" -ne 1000 ]; then echo failed 7; exit 1; fi
+MAX_BATCH=`awk 'BEGIN {m=0} /^send batch 700 / {if ($4 > m) m = $4} END {print m}' <tgen_test.2`
+if [ "$MAX_BATCH" -gt 5 ]; then echo failed 8; exit 1; fi
+
+./tgen_test -b -t 0 -s "catchup skip; sendt 700 bytes 999 mpersec 10 msec" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 9; exit 1; fi
+if egrep "send batch" tgen_test.2 >/dev/null; then echo failed 10; exit 1; fi
+if egrep "send message 700" tgen_test.2 >/dev/null; then :; else echo failed 11; exit 1; fi
+
+./tgen_test -b -t 0 -s "catchup token 50; sendc 700 bytes 999 mpersec 1000 msgs" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 12; exit 1; fi
+SEND_CNT=`awk '/^send message 700$/ {n++} /^send batch 700 / {n += $4} END {print n}' <tgen_test.2`
+if [ "$SEND_CNT" -ne 1000 ]; then echo failed 13; exit 1; fi
+MAX_BATCH=`awk 'BEGIN {m=0} /^send batch 700 / {if ($4 > m) m = $4} END {print m}' <tgen_test.2`
+if [ "$MAX_BATCH" -gt 50 ]; then echo failed 14; exit 1; fi
+
+# Skip after long stalls, including billions of sub-tick intervals.
+./tgen_test -t 6
+if [ "$?" -ne 0 ]; then echo failed 15; exit 1; fi
+echo passed
+
+echo test14
+./tgen_test -t 2 -f 3 -s "sendt 700 bytes 5 mpersec 40 min; sendt 1 kbytes 100 persec 24 hour; sendc 700 bytes 9 mpersec 5000 mmsgs" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if egrep "sendt, 700 5000000 2400000000$" tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+if egrep "sendt, 1000 100 86400000000$" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+if egrep "sendc, 700 9000000 5000000000$" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
+
+# Values that don't fit are errors rather than silently wrapping.
+./tgen_test -t 2 -f 3 -s "sendt 3000 mbytes 1 persec 1 sec" 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 5; exit 1; fi
+if egrep "Error: len too large" tgen_test.2 >/dev/null; then :; else echo failed 6; exit 1; fi
+./tgen_test -t 2 -f 3 -s "delay 999999999999999999 hour" 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 7; exit 1; fi
+if egrep "Error: duration too large" tgen_test.2 >/dev/null; then :; else echo failed 8; exit 1; fi
+echo passed
+
+echo test15
+./tgen_test -t 2 -f 3 -s "ramp 700 bytes 10 kpersec 2 mpersec 40 min" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if egrep "ramp, 700 10000 2000000 2400000000$" tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+
+# Linear ramp 1k to 10k persec over 1 sec is 5500 msgs.
+./tgen_test -t 0 -f 2 -s "ramp 700 bytes 1 kpersec 10 kpersec 1 sec" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 3; exit 1; fi
+SEND_CNT="`egrep "send message" <tgen_test.2 | wc -l`"
+if [ $SEND_CNT -lt 5450 -o $SEND_CNT -gt 5550 ]; then echo failed 4; exit 1; fi
+if [ "`egrep "^ramp slice [0-9]: target rate=" tgen_test.1 | wc -l`" -ne 10 ]; then echo failed 5; exit 1; fi
+RATE=`sed -n 's/^ramp slice 9: target rate=9554, actual rate=\([0-9]*\)$/\1/p' <tgen_test.1`
+if [ "$RATE" -lt 9400 -o "$RATE" -gt 9700 ]; then echo failed 6; exit 1; fi
+
+# A ramp too short to reach its later slices reports them as empty.
+./tgen_test -t 0 -f 2 -s "ramp 700 bytes 1 kpersec 10 kpersec 0 usec" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 7; exit 1; fi
+if [ "`egrep "^ramp slice [1-9]: target rate=[0-9]+, actual rate=0$" tgen_test.1 | wc -l`" -ne 9 ]; then echo failed 8; exit 1; fi
+echo passed
+
+echo test16
+./tgen_test -t 2 -f 3 -s "arrival poisson; arrival uniform 50; arrival pareto 150; arrival even" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`wc -l <tgen_test.2`" -ne 4 ]; then echo failed 2; exit 1; fi
+if egrep "arrival, 2 0" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+if egrep "arrival, 3 50" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
+if egrep "arrival, 4 150" tgen_test.2 >/dev/null; then :; else echo failed 5; exit 1; fi
+if egrep "arrival, 1 0" tgen_test.2 >/dev/null; then :; else echo failed 6; exit 1; fi
+
+# Random gaps, but the mean rate still matches (within a few std devs).
+./tgen_test -t 0 -s "arrival poisson; sendt 700 bytes 5 kpersec 1 sec" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 7; exit 1; fi
+SEND_CNT="`egrep "send message" <tgen_test.2 | wc -l`"
+if [ $SEND_CNT -lt 4700 -o $SEND_CNT -gt 5300 ]; then echo failed 8; exit 1; fi
+./tgen_test -t 0 -s "arrival uniform 100; sendt 700 bytes 5 kpersec 1 sec" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 9; exit 1; fi
+SEND_CNT="`egrep "send message" <tgen_test.2 | wc -l`"
+if [ $SEND_CNT -lt 4850 -o $SEND_CNT -gt 5150 ]; then echo failed 10; exit 1; fi
+
+./tgen_test -t 7
+if [ "$?" -ne 0 ]; then echo failed 11; exit 1; fi
+echo passed
+
+echo test17
+printf '# len count\n100 80\n\n4000 20  # snapshots\n' >tgen_test.3
+./tgen_test -t 2 -f 3 -s "size weighted 100 bytes 80 4 kbytes 20; size uniform 64 bytes 1 kbytes; size file tgen_test.3; size fixed" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`wc -l <tgen_test.2`" -ne 4 ]; then echo failed 2; exit 1; fi
+if [ "`egrep -c "size, 2 2 100 4000" tgen_test.2`" -ne 2 ]; then echo failed 3; exit 1; fi
+if egrep "size, 1 0 64 1000" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
+if egrep "size, fixed" tgen_test.2 >/dev/null; then :; else echo failed 5; exit 1; fi
+
+# 80/20 mix (within a few std devs), bytes reported match the lens sent.
+./tgen_test -t 0 -f 2 -s "size file tgen_test.3; sendc 700 bytes 1 mpersec 10 kmsgs; size fixed; sendc 700 bytes 1 mpersec 10 msgs" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 6; exit 1; fi
+SMALL_CNT="`egrep "send message 100$" <tgen_test.2 | wc -l`"
+LARGE_CNT="`egrep "send message 4000$" <tgen_test.2 | wc -l`"
+if [ $SMALL_CNT -lt 7850 -o $SMALL_CNT -gt 8150 ]; then echo failed 7; exit 1; fi
+if [ `expr $SMALL_CNT + $LARGE_CNT` -ne 10000 ]; then echo failed 8; exit 1; fi
+BYTES=`expr $SMALL_CNT \* 100 + $LARGE_CNT \* 4000`
+if egrep "num_msgs=10000, .*actual bytes=$BYTES$" tgen_test.1 >/dev/null; then :; else echo failed 9; exit 1; fi
+if egrep "num_msgs=10, .*actual bytes=7000$" tgen_test.1 >/dev/null; then :; else echo failed 10; exit 1; fi
+if [ "`egrep -c "send message 700$" <tgen_test.2`" -ne 10 ]; then echo failed 11; exit 1; fi
+
+./tgen_test -t 0 -s "size uniform 2 kbytes 1 kbytes" 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 12; exit 1; fi
+echo passed
+
+echo test18
+./tgen_test -t 2 -f 1 -s "burst 700 bytes 10 msgs every 100 usec for 1 sec; burst 1 kbytes 2 kmsgs every 5 msec for 2 min" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if egrep "burst, 700 10 100 1000000" tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+if egrep "burst, 1000 2000 5000 120000000" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+
+# Each burst is one batch call; bursts keep to the schedule.
+rm -f time.out
+command time -p -o time.out ./tgen_test -t 0 -b -f 2 -s "burst 700 bytes 10 msgs every 100 msec for 1 sec" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 4; exit 1; fi
+if [ "`egrep -c "send batch 700 10$" <tgen_test.2`" -ne 10 ]; then echo failed 5; exit 1; fi
+T=`sed -n 's/real \([0-9]*\)\.\([0-9]*\)$/\1\2/p' <time.out`
+if [ "$T" -lt 98 -o "$T" -gt 106 ]; then echo failed 6; exit 1; fi
+if egrep "burst len=700 burst_msgs=10 period_usec=100000 duration_usec=1000000, actual bursts=10, late bursts=0, actual msgs=100, actual bytes=70000$" tgen_test.1 >/dev/null; then :; else echo failed 7; exit 1; fi
+echo passed
+
+echo test19
+./tgen_test -t 0 -f 1 -s "thread 0 cpu 0 { sendc 700 bytes 1 kpersec 10 msgs; }; thread 3 {; sendt 500 bytes 10 persec 1 sec; }; join" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`wc -l <tgen_test.2`" -ne 5 ]; then echo failed 2; exit 1; fi
+if egrep "thread, 0 0" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+if egrep "thread, 3 -1" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
+if egrep "join, 2" tgen_test.2 >/dev/null; then :; else echo failed 5; exit 1; fi
+
+# Two threads (sandboxes may have only one CPU, so both use cpu 0 and
+# share it; allow for that in the rate),
+# implicit join at the end of the script.
+./tgen_test -t 0 -f 2 -s "thread 0 cpu 0 { sendc 700 bytes 1 kpersec 1000 msgs; }; thread 1 cpu 0 {; sendt 500 bytes 2 kpersec 1 sec; }" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 6; exit 1; fi
+if [ "`egrep -c "send message 700$" <tgen_test.2`" -ne 1000 ]; then echo failed 7; exit 1; fi
+if [ "`egrep -c "send message 500$" <tgen_test.2`" -ne 2000 ]; then echo failed 8; exit 1; fi
+if egrep "^thread 0 cpu 0, actual rate=(99[0-9]|1000), actual msgs=1000, actual bytes=700000$" tgen_test.1 >/dev/null; then :; else echo failed 9; exit 1; fi
+if egrep "^join threads=2, actual rate=[0-9]*, actual msgs=3000, actual bytes=1700000$" tgen_test.1 >/dev/null; then :; else echo failed 10; exit 1; fi
+
+./tgen_test -t 0 -s "thread 0 { sendc 1 bytes 1 persec 1 msgs" 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 11; exit 1; fi
+if egrep "no closing" tgen_test.2 >/dev/null; then :; else echo failed 12; exit 1; fi
+echo passed
+
+echo test20
+./tgen_test -t 0 -f 1 -s "at 1760000000 sec; at next 10 msec; sync grp_1 3" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if egrep "at, 1 1760000000000000" tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+if egrep "at, 2 10000" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+if egrep "sync, grp_1 3" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
+
+# Start on a wall-clock boundary.
+./tgen_test -t 0 -f 2 -s "at next 100 msec" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 5; exit 1; fi
+if egrep "^at start_usec=[0-9]*00000, skew_ns=[0-9]*$" tgen_test.1 >/dev/null; then :; else echo failed 6; exit 1; fi
+
+# Two processes meet at a shared memory barrier, twice.
+./tgen_test -t 0 -f 2 -s "sync tst$$ 2; sync tst$$ 2" >tgen_test.3 2>tgen_test.2 &
+sleep 0.2
+./tgen_test -t 0 -f 2 -s "sync tst$$ 2; sync tst$$ 2" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 7; exit 1; fi
+wait $!
+if [ "$?" -ne 0 ]; then echo failed 8; exit 1; fi
+if [ "`cat tgen_test.1 tgen_test.3 | egrep -c "^sync name=tst$$ procs=2, skew_ns=[0-9]*$"`" -ne 4 ]; then echo failed 9; exit 1; fi
+if [ -e /dev/shm/tgen_tst$$ ]; then echo failed 10; exit 1; fi
+
+# A process killed while waiting leaves its count in the segment; the
+# next run discards it instead of releasing early.
+./tgen_test -t 0 -f 2 -s "sync tst$$ 2" >tgen_test.1 2>tgen_test.2 &
+sleep 0.2
+kill -9 $!
+wait $! 2>/dev/null
+if [ -e /dev/shm/tgen_tst$$ ]; then :; else echo failed 11; exit 1; fi
+./tgen_test -t 0 -f 2 -s "sync tst$$ 2" >tgen_test.3 2>tgen_test.2 &
+sleep 0.2
+./tgen_test -t 0 -f 2 -s "sync tst$$ 2" >tgen_test.1 2>/dev/null
+if [ "$?" -ne 0 ]; then echo failed 12; exit 1; fi
+wait $!
+if [ "$?" -ne 0 ]; then echo failed 13; exit 1; fi
+if egrep "^Warning: sync tst$$: discarding 1 stale waiter\(s\)$" tgen_test.2 >/dev/null; then :; else echo failed 14; exit 1; fi
+if [ "`cat tgen_test.1 tgen_test.3 | egrep -c "^sync name=tst$$ procs=2, skew_ns=[0-9]*$"`" -ne 2 ]; then echo failed 15; exit 1; fi
+if [ -e /dev/shm/tgen_tst$$ ]; then echo failed 16; exit 1; fi
+echo passed
+
+echo test21
+./tgen_test -t 4
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+
+# Send histogram (flag 8) with print rate (flag 2).
+./tgen_test -t 0 -f 10 -s "sendc 700 bytes 10 kpersec 1 kmsgs; thread 0 { sendt 7 bytes 10 kpersec 100 msec; }; join" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 2; exit 1; fi
+if [ "`egrep -c ", send_ns p50=[0-9]+ p99=[0-9]+ p99.9=[0-9]+ max=[0-9]+$" tgen_test.1`" -ne 4 ]; then echo failed 3; exit 1; fi
+if egrep "^join threads=1, .*send_ns p50=" tgen_test.1 >/dev/null; then :; else echo failed 4; exit 1; fi
+
+# Without the flag, no histogram.
+./tgen_test -t 0 -f 2 -s "sendc 700 bytes 10 kpersec 10 msgs" >tgen_test.1 2>tgen_test.2
+if egrep "send_ns" tgen_test.1 >/dev/null; then echo failed 5; exit 1; fi
+echo passed
+
+echo test22
+# Gap histogram (flag 16) with print rate (flag 2).
+./tgen_test -t 0 -f 18 -s "sendt 700 bytes 10 kpersec 200 msec; sendc 700 bytes 10 kpersec 1 msgs" >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`egrep -c ", gap_ns p50=[0-9]+ p99=[0-9]+ p99.9=[0-9]+ max=[0-9]+ over2x=[0-9]+ over10x=[0-9]+$" tgen_test.1`" -ne 2 ]; then echo failed 2; exit 1; fi
+# Target gap is 100 usec; p50 is the top of its bucket (within 1/32).
+P50=`sed -n 's/^sendt .*gap_ns p50=\([0-9]*\) .*/\1/p' <tgen_test.1`
+if [ "$P50" -lt 97000 -o "$P50" -gt 104000 ]; then echo failed 3; exit 1; fi
+# A single message has no gaps.
+if egrep "^sendc .*gap_ns p50=0 p99=0 p99.9=0 max=0 over2x=0 over10x=0$" tgen_test.1 >/dev/null; then :; else echo failed 4; exit 1; fi
+echo passed
+
+echo test23
+./tgen_test -t 0 -f 1 -s "report csv 100 msec tgen_test.3; report stop" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if egrep "report, 1 100000 tgen_test.3" tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+if egrep "report, stop" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+
+# CSV time series for the main instance and a thread block; the final
+# sample (written at the end of the script) has the full counts.
+./tgen_test -t 0 -s "report csv 100 msec tgen_test.3; thread 2 cpu 0 { sendc 500 bytes 10 kpersec 5000 msgs; }; sendc 700 bytes 1 kpersec 500 msgs" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 4; exit 1; fi
+if [ "`head -1 tgen_test.3`" != "elapsed_ms,thread,msgs,bytes,msgs_per_sec,bytes_per_sec,catchup_bursts,behind_ns" ]; then echo failed 5; exit 1; fi
+if [ "`egrep -c "^[0-9]+,total," tgen_test.3`" -lt 4 ]; then echo failed 6; exit 1; fi
+if [ "`egrep "^[0-9]+,main," tgen_test.3 | tail -1 | cut -d, -f3-4`" != "500,350000" ]; then echo failed 7; exit 1; fi
+if [ "`egrep "^[0-9]+,2," tgen_test.3 | tail -1 | cut -d, -f3-4`" != "5000,2500000" ]; then echo failed 8; exit 1; fi
+if [ "`egrep "^[0-9]+,total," tgen_test.3 | tail -1 | cut -d, -f3-4`" != "5500,2850000" ]; then echo failed 9; exit 1; fi
+
+# JSON lines.
+./tgen_test -t 0 -s "report json 50 msec tgen_test.3; sendc 700 bytes 1 kpersec 100 msgs; report stop; sendc 700 bytes 1 kpersec 1 msgs" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 10; exit 1; fi
+if egrep '^\{"elapsed_ms":[0-9]+,"thread":"total","msgs":100,"bytes":70000,"msgs_per_sec":[0-9]+,"bytes_per_sec":[0-9]+,"catchup_bursts":[0-9]+,"behind_ns":[0-9]+\}$' tgen_test.3 >/dev/null; then :; else echo failed 11; exit 1; fi
+if egrep '"msgs":101' tgen_test.3 >/dev/null; then echo failed 12; exit 1; fi
+echo passed
+
+echo test24
+# Payload buffers: one buffer callback per message, even when batching.
+./tgen_test -t 0 -p -b -s "catchup burst 100; sendc 700 bytes 999 mpersec 100 msgs; size uniform 1 bytes 9000 bytes; sendc 700 bytes 10 kpersec 100 msgs" >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`egrep -c "^send buf 700$" tgen_test.2`" -ne 100 ]; then echo failed 2; exit 1; fi
+if [ "`egrep -c "^send buf [0-9]+$" tgen_test.2`" -ne 200 ]; then echo failed 3; exit 1; fi
+if egrep "send (batch|message)" tgen_test.2 >/dev/null; then echo failed 4; exit 1; fi
+
+# The REPL can send a len bigger than the script's.
+echo "sendc 20000 bytes 1 kpersec 2 msgs" | ./tgen_test -t 0 -p -s "sendc 10 bytes 1 kpersec 1 msgs; repl" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 5; exit 1; fi
+if [ "`egrep -c "^send buf 20000$" tgen_test.2`" -ne 2 ]; then echo failed 6; exit 1; fi
+echo passed
+
+echo test25
+./tgen_test -t 5 >tgen_test.1
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+
+./tgen_test -t 0 -f 1 -s "payload pattern 3; payload none" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 2; exit 1; fi
+if egrep "payload, 1 3" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+if egrep "payload, 0 0" tgen_test.2 >/dev/null; then :; else echo failed 4; exit 1; fi
+
+# Each message is filled for its (stream, seq); the callback verifies it.
+./tgen_test -t 0 -p -s "payload pattern 3; sendc 65000 bytes 10 kpersec 100 msgs; payload none; sendc 700 bytes 10 kpersec 10 msgs; payload pattern 4; size uniform 1 bytes 100 bytes; sendc 700 bytes 10 kpersec 10 msgs" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 5; exit 1; fi
+if [ "`egrep -c "^payload 3 [0-9]+$" tgen_test.2`" -ne 100 ]; then echo failed 6; exit 1; fi
+if egrep "^payload 3 99$" tgen_test.2 >/dev/null; then :; else echo failed 7; exit 1; fi
+if [ "`egrep -c "^payload 4 [0-9]+$" tgen_test.2`" -ne 10 ]; then echo failed 8; exit 1; fi
+if egrep "^payload 4 119$" tgen_test.2 >/dev/null; then :; else echo failed 9; exit 1; fi
+
+# Needs the buffer callback.
+./tgen_test -t 0 -s "payload pattern 3" 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 10; exit 1; fi
+if egrep "needs a buffer send callback" tgen_test.2 >/dev/null; then :; else echo failed 11; exit 1; fi
+echo passed
+
+echo test26
+./tgen_test -t 0 -f 1 -s "stamp 5; stamp off" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if egrep "stamp, 1 5" tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+if egrep "stamp, 0 0" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+
+# Stamped messages (the callback checks the header and the pattern after it).
+./tgen_test -t 0 -p -s "stamp 5; payload pattern 5; sendc 700 bytes 10 kpersec 20 msgs; stamp off; sendc 700 bytes 10 kpersec 1 msgs" >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 4; exit 1; fi
+if [ "`egrep -c "^stamp 5 [0-9]+ [0-9]+ [0-9]+$" tgen_test.2`" -ne 20 ]; then echo failed 5; exit 1; fi
+if egrep "^stamp 5 19 " tgen_test.2 >/dev/null; then :; else echo failed 6; exit 1; fi
+if egrep "^payload 5 20$" tgen_test.2 >/dev/null; then :; else echo failed 7; exit 1; fi
+# Scheduled times are exactly 100 usec apart (to within tick rounding).
+# (Only the low 12 digits, since awk uses doubles.)
+BAD_SCHED=`awk '/^stamp /{ t = substr($4, length($4) - 11) + 0; d = t - prev; if (d < 0) d += 1e12;
+  if (n++ && (d < 99990 || d > 100010)) bad++; prev = t } END { print bad + 0 }' tgen_test.2`
+if [ "$BAD_SCHED" -ne 0 ]; then echo failed 8; exit 1; fi
+
+./tgen_test -t 0 -s "stamp 5" 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 9; exit 1; fi
+
+# Stamp and payload pattern share the stream; the later one sets it.
+./tgen_test -t 0 -p -s "payload pattern 5; stamp 7; sendc 700 bytes 10 kpersec 3 msgs; payload pattern 6; sendc 700 bytes 10 kpersec 3 msgs" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 10; exit 1; fi
+if [ "`egrep -c "^stamp 7 [0-2] " tgen_test.2`" -ne 3 ]; then echo failed 11; exit 1; fi
+if [ "`egrep -c "^stamp 6 [3-5] " tgen_test.2`" -ne 3 ]; then echo failed 12; exit 1; fi
+
+./tgen_test -t 8
+if [ "$?" -ne 0 ]; then echo failed 13; exit 1; fi
+echo passed
+
+echo test27
+if [ -x tgen_recv ]; then :
+  PORT=`expr 12000 + $$ % 1000`
+  ./tgen_recv -p $PORT -i 300 -d 10 >tgen_recv.1 2>tgen_recv.2 &
+  # Its first line is printed once the socket is bound.
+  TRIES=0
+  until egrep "^tgen_recv: port $PORT," tgen_recv.1 >/dev/null 2>&1; do :
+    TRIES=`expr $TRIES + 1`
+    if [ $TRIES -gt 500 ]; then echo failed 5; exit 1; fi
+    sleep 0.01
+  done
+
+  # Stamped datagrams for stream 7 with seqs 0 1 2 4 3 3 6 (one
+  # reordered, one duplicate, seq 5 lost), then one unstamped.
+  for SEQ in 0 1 2 4 3 3 6; do :
+    printf "TGN1\x07\x00\x00\x00\x0$SEQ\x00\x00\x00\x00\x00\x00\x00" >tgen_test.3
+    printf "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" >>tgen_test.3
+    cat tgen_test.3 >/dev/udp/127.0.0.1/$PORT
+  done
+  echo "not stamped" >/dev/udp/127.0.0.1/$PORT
+
+  wait $!
+  STATUS=$?
+
+  # Success status is expected
+  if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+  if egrep "^recv msgs=8 bytes=236 .*, streams=1, lost=1, dups=1, reordered=1, too_old=0, bad_payload=0, unstamped=1, " tgen_recv.1 >/dev/null; then :; else echo failed 2; exit 1; fi
+  if egrep "^stream 7 msgs=7 highest_seq=6, lost=1, dups=1, reordered=1, " tgen_recv.1 >/dev/null; then :; else echo failed 3; exit 1; fi
+  if egrep "^latency_ns count=7 p50=[0-9]+ p99=[0-9]+ p99.9=[0-9]+ max=[0-9]+$" tgen_recv.1 >/dev/null; then :; else echo failed 4; exit 1; fi
+else :
+  echo "skipped (no tgen_recv)"
+fi
+echo passed
+
+echo test28
+if [ -x tgen_recv ]; then :
+  PORT=`expr 13000 + $$ % 1000`
+  ./tgen_recv -p $PORT -i 1000 -d 10 -n 1500 -v >tgen_recv.1 2>tgen_recv.2 &
+  TRIES=0
+  until egrep "^tgen_recv: port $PORT," tgen_recv.1 >/dev/null 2>&1; do :
+    TRIES=`expr $TRIES + 1`
+    if [ $TRIES -gt 500 ]; then echo failed 6; exit 1; fi
+    sleep 0.01
+  done
+
+  # Bursts of 100 go out 32 per sendmmsg() (4 calls each).
+  ./tgen_test -t 0 -u 127.0.0.1:$PORT -s "stamp 5; payload pattern 5; sendc 200 bytes 100 kpersec 1000 msgs; burst 200 bytes 100 msgs every 1 msec for 5 msec" >tgen_test.1 2>tgen_test.2
+  STATUS=$?
+
+  # Success status is expected
+  if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+  wait $!
+  if egrep "^udp msgs=1500, syscalls=[0-9]+, syscalls_per_msg=0\.[0-9]+, errors=0$" tgen_test.1 >/dev/null; then :; else echo failed 2; exit 1; fi
+  if awk '/^udp msgs=/ { split($3, a, "="); sub(",", "", a[2]); exit (a[2] + 0 <= 1020) ? 0 : 1 }' tgen_test.1; then :; else echo failed 3; exit 1; fi
+  if egrep "^recv msgs=1500 bytes=300000 .*, streams=1, lost=0, dups=0, reordered=0, too_old=0, bad_payload=0, unstamped=0, " tgen_recv.1 >/dev/null; then :; else echo failed 4; exit 1; fi
+  if egrep "^stream 5 msgs=1500 highest_seq=1499, " tgen_recv.1 >/dev/null; then :; else echo failed 5; exit 1; fi
+
+  # Nobody listening: dropped sends are errors, not msgs.
+  ./tgen_test -t 0 -u 127.0.0.1:$PORT -s "sendc 200 bytes 10 kpersec 100 msgs" >tgen_test.1 2>tgen_test.2
+  if [ "$?" -ne 0 ]; then echo failed 7; exit 1; fi
+  if awk '/^udp msgs=/ { split($2, m, "="); split($5, e, "="); exit (m[2] + e[2] == 100 && e[2] > 0) ? 0 : 1 }' tgen_test.1; then :; else echo failed 8; exit 1; fi
+else :
+  echo "skipped (no tgen_recv)"
+fi
+echo passed
+
+echo test29
+if [ -x tgen_recv ]; then :
+  PORT=`expr 14000 + $$ % 1000`
+  ./tgen_recv -p $PORT -i 1000 -d 10 -n 3000 -v >tgen_recv.1 2>tgen_recv.2 &
+  TRIES=0
+  until egrep "^tgen_recv: port $PORT," tgen_recv.1 >/dev/null 2>&1; do :
+    TRIES=`expr $TRIES + 1`
+    if [ $TRIES -gt 500 ]; then echo failed 9; exit 1; fi
+    sleep 0.01
+  done
+
+  # Without and with SQPOLL, one stream each.
+  ./tgen_test -t 0 -r 127.0.0.1:$PORT -s "stamp 1; payload pattern 1; sendc 200 bytes 100 kpersec 1000 msgs; burst 200 bytes 100 msgs every 1 msec for 5 msec" >tgen_test.1 2>tgen_test.2
+  STATUS=$?
+  if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+  ./tgen_test -t 0 -q -r 127.0.0.1:$PORT -s "stamp 2; payload pattern 2; sendc 200 bytes 100 kpersec 1000 msgs; burst 200 bytes 100 msgs every 1 msec for 5 msec" >>tgen_test.1 2>>tgen_test.2
+  STATUS=$?
+  if [ "$STATUS" -ne 0 ]; then echo failed 2; exit 1; fi
+  wait $!
+
+  if egrep "^uring msgs=1500, syscalls=[0-9]+, syscalls_per_msg=[01]\.[0-9]+, errors=0, sqpoll=0$" tgen_test.1 >/dev/null; then :; else echo failed 3; exit 1; fi
+  if egrep "^uring msgs=1500, syscalls=[0-9]+, syscalls_per_msg=0\.[0-9]+, errors=0, sqpoll=1$" tgen_test.1 >/dev/null; then :; else echo failed 4; exit 1; fi
+  if [ "`egrep -c '^uring_latency_ns count=1500 p50=[0-9]+ p99=[0-9]+ p99.9=[0-9]+ max=[0-9]+$' tgen_test.1`" -ne 2 ]; then echo failed 5; exit 1; fi
+  if egrep "^recv msgs=3000 bytes=600000 .*, streams=2, lost=0, dups=0, reordered=0, too_old=0, bad_payload=0, unstamped=0, " tgen_recv.1 >/dev/null; then :; else echo failed 6; exit 1; fi
+
+  # Nobody listening: sends fail (counted), but the script finishes.
+  ./tgen_test -t 0 -r 127.0.0.1:$PORT -s "sendc 200 bytes 10 kpersec 100 msgs" >tgen_test.1 2>tgen_test.2
+  STATUS=$?
+  if [ "$STATUS" -ne 0 ]; then echo failed 7; exit 1; fi
+  if egrep "^uring msgs=100, syscalls=[0-9]+, syscalls_per_msg=[0-9.]+, errors=[1-9][0-9]*, sqpoll=0$" tgen_test.1 >/dev/null; then :; else echo failed 8; exit 1; fi
+else :
+  echo "skipped (no tgen_recv)"
+fi
+echo passed
+
+echo test30
+./tgen_bench -d 50 -r 10,1000,max -s 1,1024 >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`wc -l <tgen_test.1`" -ne 7 ]; then echo failed 2; exit 1; fi
+if head -1 tgen_test.1 | egrep "^size,rate,msgs,duration_usec,achieved_rate,rate_error_pct,gap_target_ns,gap_err_p50_ns,gap_err_p99_ns,gap_err_p999_ns,gap_err_max_ns,gaps_over_2x,unpaced_cycles_per_msg$" >/dev/null; then :; else echo failed 3; exit 1; fi
+if [ "`egrep -c '^(1|1024),(10|1000),[0-9]+,[0-9]+,[0-9]+,-?[0-9.]+,[0-9]+,-?[0-9]+,-?[0-9]+,-?[0-9]+,-?[0-9]+,[0-9]+,na$' tgen_test.1`" -ne 4 ]; then echo failed 4; exit 1; fi
+if [ "`egrep -c '^(1|1024),max,[0-9]+,[0-9]+,[0-9]+,-?[0-9.]+,[0-9]+,-?[0-9]+,-?[0-9]+,-?[0-9]+,-?[0-9]+,[0-9]+,[0-9.]+$' tgen_test.1`" -ne 2 ]; then echo failed 8; exit 1; fi
+# Counts are exact for paced points; 10/sec for 50 ms is still 2 msgs.
+if egrep "^1,10,2,[0-9]+,10,.*,100000000," tgen_test.1 >/dev/null; then :; else echo failed 5; exit 1; fi
+if egrep "^1024,1000,50," tgen_test.1 >/dev/null; then :; else echo failed 6; exit 1; fi
+# The unpaced rate should beat the highest paced one.
+if awk -F, '$2 == "max" && $5 > 1000 { n++ } END { exit (n == 2) ? 0 : 1 }' tgen_test.1; then :; else echo failed 7; exit 1; fi
+echo passed
+
+echo test31
+# Loops run from compiled code; a label may be at the very end.
+./tgen_test -t 0 -s "set i 3; label a; set j 2; label b; sendc 10 bytes 1 mpersec 1 msgs; loop b j; sendc 20 bytes 1 mpersec 1 msgs; loop a i; label z" 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`egrep -c '^send message 10$' tgen_test.2`" -ne 6 ]; then echo failed 2; exit 1; fi
+if [ "`egrep -c '^send message 20$' tgen_test.2`" -ne 3 ]; then echo failed 3; exit 1; fi
+
+# Unknown label is found before anything runs.
+./tgen_test -t 0 -s "sendc 700 bytes 1 persec 1 msgs; set i 2; loop q i" >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Failure status is expected
+if [ "$STATUS" -eq 0 ]; then echo failed 4; exit 1; fi
+if egrep "loop to unknown label: q" tgen_test.2 >/dev/null; then :; else echo failed 5; exit 1; fi
+if egrep "send message" tgen_test.2 >/dev/null; then echo failed 6; exit 1; fi
+
+./tgen_bench -m dispatch -n 1000 >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 7; exit 1; fi
+if egrep "^set_loop,2000,[0-9]+,[0-9.]+$" tgen_test.1 >/dev/null; then :; else echo failed 8; exit 1; fi
+if egrep "^sendc_loop,2000,[0-9]+,[0-9.]+$" tgen_test.1 >/dev/null; then :; else echo failed 9; exit 1; fi
+echo passed
+
+echo test32
+# Every error is reported with its line and column, and nothing runs.
+./tgen_test -t 0 -s "sendt 700 bytes 100 persec 1 sec
+sendc 3000 mbytes 1 persec 1 msgs; set i 1 extra" >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Failure status is expected
+if [ "$STATUS" -eq 0 ]; then echo failed 1; exit 1; fi
+if egrep "^Error: len too large \(line 2, col 7\)$" tgen_test.2 >/dev/null; then :; else echo failed 2; exit 1; fi
+if egrep "^Error: unexpected 'extra' \(line 2, col 44\)$" tgen_test.2 >/dev/null; then :; else echo failed 3; exit 1; fi
+if [ "`egrep -c '^Error:' tgen_test.2`" -ne 3 ]; then echo failed 4; exit 1; fi
+if egrep "send message" tgen_test.2 >/dev/null; then echo failed 5; exit 1; fi
+# (tgen_test leaves it to tgen_run() to refuse the script.)
+if egrep "^Error: not running a script with 2 error\(s\)$" tgen_test.2 >/dev/null; then :; else echo failed 10; exit 1; fi
+
+# A bad thread header is the only error; its block is skipped whole.
+./tgen_test -t 0 -s "thread 99 cpu 1 {
+sendc 1 bytes 1 persec 1 msgs
+}
+sendc 2 bytes 1 mpersec 1 msgs" >tgen_test.1 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 11; exit 1; fi
+if egrep "^Error: thread number must be 0 to 63 \(line 1, col 8\)$" tgen_test.2 >/dev/null; then :; else echo failed 12; exit 1; fi
+if egrep "^Error: not running a script with 1 error\(s\)$" tgen_test.2 >/dev/null; then :; else echo failed 13; exit 1; fi
+if [ "`egrep -c '^(Error|tgen_parse_step):' tgen_test.2`" -ne 2 ]; then echo failed 14; exit 1; fi
+if egrep "send message" tgen_test.2 >/dev/null; then echo failed 15; exit 1; fi
+
+# A size file that can't be loaded, and a loop to a label that is never
+# set, are script errors too; parsing goes on past them.
+./tgen_test -t 0 -s "sendc 1 bytes 1 persec 1 msgs; badkw 3; size file /nonexistent; sendc x" >tgen_test.1 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 16; exit 1; fi
+if egrep "^Error: size file '/nonexistent' not loaded \(line 1, col 51\)$" tgen_test.2 >/dev/null; then :; else echo failed 17; exit 1; fi
+if egrep "^Error: expected len \(line 1, col 71\)$" tgen_test.2 >/dev/null; then :; else echo failed 18; exit 1; fi
+if egrep "^Error: not running a script with 3 error\(s\)$" tgen_test.2 >/dev/null; then :; else echo failed 19; exit 1; fi
+./tgen_test -t 0 -s "set i 2
+loop q i" >tgen_test.1 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 20; exit 1; fi
+if egrep "^Error: loop to unknown label: q \(line 2, col 6\)$" tgen_test.2 >/dev/null; then :; else echo failed 21; exit 1; fi
+
+# Hex numbers.
+./tgen_test -t 0 -f 1 -s "sendc 0x10 bytes 1 mpersec 2 msgs" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 6; exit 1; fi
+if egrep "^sendc, 16 1000000 2$" tgen_test.2 >/dev/null; then :; else echo failed 7; exit 1; fi
+
+./tgen_bench -m parse -n 1000 >tgen_test.1 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 8; exit 1; fi
+if egrep "^parse,1000,[0-9]+,[0-9]+,[0-9.]+$" tgen_test.1 >/dev/null; then :; else echo failed 9; exit 1; fi
+echo passed
+
+echo test33
+# Script file with includes, one inside a loop and one inside a thread block.
+printf 'sendc 10 bytes 1 mpersec 2 msgs\ninclude tgen_test.4 # once\nset i 2\nlabel a\n  include tgen_test.4\nloop a i\nthread 0 { include tgen_test.4; }\n' >tgen_test.3
+printf 'sendc 20 bytes 1 mpersec 1 msgs' >tgen_test.4
+./tgen_test -t 0 -F tgen_test.3 2>tgen_test.2
+STATUS=$?
+
+# Success status is expected
+if [ "$STATUS" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`egrep -c '^send message 10$' tgen_test.2`" -ne 2 ]; then echo failed 2; exit 1; fi
+if [ "`egrep -c '^send message 20$' tgen_test.2`" -ne 4 ]; then echo failed 3; exit 1; fi
+
+# Errors in an included file name the file; recursion is stopped.
+printf 'sendc 20 bytes 1 mpersec 1 msgs extra\ninclude tgen_test.4\n' >tgen_test.4
+./tgen_test -t 0 -F tgen_test.3 2>tgen_test.2
+STATUS=$?
+
+# Failure status is expected
+if [ "$STATUS" -eq 0 ]; then echo failed 4; exit 1; fi
+if egrep "^Error: unexpected 'extra' \(tgen_test.4 line 1, col 33\)$" tgen_test.2 >/dev/null; then :; else echo failed 5; exit 1; fi
+if egrep "^Error: includes nested more than 16 deep \(tgen_test.4 line 2, col 9\)$" tgen_test.2 >/dev/null; then :; else echo failed 6; exit 1; fi
+if egrep "send message" tgen_test.2 >/dev/null; then echo failed 7; exit 1; fi
+rm -f tgen_test.4
+
+./tgen_test -t 0 -F tgen_test.4 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 8; exit 1; fi
+if egrep "^Error: could not read script file 'tgen_test.4': " tgen_test.2 >/dev/null; then :; else echo failed 9; exit 1; fi
+
+./tgen_bench -m parse -n 1000 >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 10; exit 1; fi
+if egrep "^parse_file,1000,[0-9]+,[0-9]+,[0-9.]+$" tgen_test.1 >/dev/null; then :; else echo failed 11; exit 1; fi
+if [ -f tgen_bench.tmp ]; then echo failed 12; exit 1; fi
+
+./tgen_test -t 0 -F . 2>tgen_test.2
+if [ "$?" -eq 0 ]; then echo failed 13; exit 1; fi
+if egrep "^Error: could not read script file '.': Is a directory$" tgen_test.2 >/dev/null; then :; else echo failed 14; exit 1; fi
+echo passed
+
+echo test34
+# Packed (32-bit) and wide send steps, looped over.
+./tgen_test -t 0 -f 1 -s "set i 2; label a; sendc 5 bytes 4000 mpersec 3 msgs; sendc 6 bytes 5000 mpersec 3 msgs; sendt 7 bytes 1 persec 2 hour; sendt 8 bytes 1 persec 1 sec; loop a i" 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 1; exit 1; fi
+if [ "`egrep -c '^sendc, 5 4000000000 3$' tgen_test.2`" -ne 2 ]; then echo failed 2; exit 1; fi
+if [ "`egrep -c '^sendc, 6 5000000000 3$' tgen_test.2`" -ne 2 ]; then echo failed 3; exit 1; fi
+if [ "`egrep -c '^sendt, 7 1 7200000000$' tgen_test.2`" -ne 2 ]; then echo failed 4; exit 1; fi
+if [ "`egrep -c '^sendt, 8 1 1000000$' tgen_test.2`" -ne 2 ]; then echo failed 5; exit 1; fi
+
+./tgen_bench -m replay -n 1000 >tgen_test.1 2>tgen_test.2
+if [ "$?" -ne 0 ]; then echo failed 6; exit 1; fi
+if egrep "^replay,1000,16000,16.00,[0-9]+,[0-9.]+,([0-9.]+|na)$" tgen_test.1 >/dev/null; then :; else echo failed 7; exit 1; fi
+if egrep "^replay_wide,1000,24000,24.00,[0-9]+,[0-9.]+,([0-9.]+|na)$" tgen_test.1 >/dev/null; then :; else echo failed 8; exit 1; fi
+echo passed